@@ -1,5 +1,5 @@
 #!/bin/zsh
 mkdir build/
-cmake -G Ninja -DCMAKE_BUILD_TYPE=Release -S ./ -B build/
+cmake -G Ninja -DCMAKE_BUILD_TYPE=Release -DENABLE_AVX2=ON -S ./ -B build/
 ninja -j 16 -C build/
 ./build/parksnrec
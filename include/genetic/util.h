@@ -5,6 +5,8 @@
 #ifndef PARKSNREC_UTIL_H
 #define PARKSNREC_UTIL_H
 
+#include <atomic>
+#include <cstdint>
 #include <random>
 #include <blt/std/time.h>
 #include <variant>
@@ -17,11 +19,85 @@ namespace parks {
     constexpr unsigned int HEIGHT = 512;
     constexpr unsigned int CHANNELS = 3;
     
+    /**
+     * xoshiro256** generator. Its whole state is four words so every thread can own one, see threadRandom().
+     */
+    class Random {
+        private:
+            uint64_t state[4]{};
+            
+            static inline uint64_t rotl(uint64_t x, int k) {
+                return (x << k) | (x >> (64 - k));
+            }
+        public:
+            explicit Random(uint64_t seed) {
+                // splitmix64 spreads the seed over the state, which must not be all zero
+                for (auto& s : state) {
+                    uint64_t z = (seed += 0x9E3779B97F4A7C15ull);
+                    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+                    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+                    s = z ^ (z >> 31);
+                }
+            }
+            
+            inline uint64_t next() {
+                auto result = rotl(state[1] * 5, 7) * 9;
+                auto t = state[1] << 17;
+                state[2] ^= state[0];
+                state[3] ^= state[1];
+                state[1] ^= state[2];
+                state[0] ^= state[3];
+                state[2] ^= t;
+                state[3] = rotl(state[3], 45);
+                return result;
+            }
+            
+            // uniform in [0, 1)
+            inline double nextDouble() {
+                return (double) (next() >> 11) * 0x1.0p-53;
+            }
+    };
+    
+    namespace detail {
+        inline std::atomic<uint64_t> randomSeed{(uint64_t) blt::system::getCurrentTimeNanoseconds()};
+        // bumped by setRandomSeed() so every thread picks up the new seed
+        inline std::atomic<uint64_t> randomEpoch{0};
+        inline std::atomic<uint64_t> randomStreams{0};
+    }
+    
+    /**
+     * Reseeds every thread's generator. Threads are given streams in the order they first draw a number after this,
+     * so a run replays exactly when the same seed is set and the same threads draw in the same order.
+     */
+    inline void setRandomSeed(uint64_t seed) {
+        detail::randomSeed = seed;
+        detail::randomStreams = 0;
+        detail::randomEpoch++;
+    }
+    
+    /**
+     * @return the seed of the run, random unless setRandomSeed() was called. Log it so the run can be replayed.
+     */
+    inline uint64_t getRandomSeed() {
+        return detail::randomSeed;
+    }
+    
+    /**
+     * @return this thread's generator, seeded from getRandomSeed() and the thread's stream
+     */
+    inline Random& threadRandom() {
+        thread_local uint64_t epoch = ~0ull;
+        thread_local Random random{0};
+        if (epoch != detail::randomEpoch.load(std::memory_order_relaxed)) {
+            epoch = detail::randomEpoch.load(std::memory_order_relaxed);
+            auto stream = detail::randomStreams.fetch_add(1, std::memory_order_relaxed);
+            random = Random(detail::randomSeed.load(std::memory_order_relaxed) ^ (stream * 0xD1B54A32D192ED03ull));
+        }
+        return random;
+    }
+    
     inline static double randomDouble(double min, double max) {
-        std::mt19937 rng(blt::system::getCurrentTimeNanoseconds());
-        static std::uniform_real_distribution<double> gen(0, 1);
-        
-        return gen(rng) * (max - min) + min;
+        return threadRandom().nextDouble() * (max - min) + min;
     }
     
     inline static int randomInt(int min, int max) {
@@ -0,0 +1,112 @@
+//
+// Created by brett on 7/28/23.
+//
+
+#ifndef PARKSNREC_ARENA_V3_H
+#define PARKSNREC_ARENA_V3_H
+
+#include <parks/memory.h>
+#include <cstddef>
+#include <memory_resource>
+
+namespace parks::genetic {
+    
+    /**
+     * Bump allocator for the trees of one generation. Nodes and node arrays are carved out of large blocks and
+     * individual frees do nothing, release() hands every block back at once when the generation retires.
+     * Like the monotonic resource underneath it, an arena must only be used by one thread at a time.
+     */
+    class GenerationArena {
+        private:
+            // counts what the bump allocator asks its upstream for
+            class CountingResource : public std::pmr::memory_resource {
+                public:
+                    size_t blocks = 0;
+                    size_t bytes = 0;
+                protected:
+                    void* do_allocate(size_t size, size_t alignment) override;
+                    void do_deallocate(void* p, size_t size, size_t alignment) override;
+                    [[nodiscard]] bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+                        return this == &other;
+                    }
+            };
+            
+            // tagged allocations still live in the arena, indexed by memory::Tag
+            struct LiveAllocations {
+                size_t count = 0;
+                size_t bytes = 0;
+            };
+            
+            CountingResource upstream;
+            std::pmr::monotonic_buffer_resource resource;
+            LiveAllocations live[memory::TAG_COUNT];
+        public:
+            explicit GenerationArena(size_t initialSize = 1 << 20): resource(initialSize, &upstream) {}
+            
+            GenerationArena(const GenerationArena&) = delete;
+            GenerationArena& operator=(const GenerationArena&) = delete;
+            
+            [[nodiscard]] inline std::pmr::memory_resource* get() {
+                return &resource;
+            }
+            
+            /**
+             * Allocates from the arena, counted under tag until it is deallocated or the arena is released
+             */
+            void* allocate(memory::Tag tag, size_t size, size_t alignment);
+            void deallocate(memory::Tag tag, void* p, size_t size, size_t alignment);
+            
+            /**
+             * Frees everything allocated from the arena, counting whatever was still live as freed in one go per tag.
+             * Nothing allocated from it may be used afterwards.
+             */
+            void release();
+            
+            /**
+             * @return bytes currently reserved from the system
+             */
+            [[nodiscard]] inline size_t reservedBytes() const {
+                return upstream.bytes;
+            }
+            
+            [[nodiscard]] inline size_t reservedBlocks() const {
+                return upstream.blocks;
+            }
+            
+            ~GenerationArena() {
+                release();
+            }
+    };
+    
+    /**
+     * @return the arena trees built on this thread allocate from, nullptr if they use the heap
+     */
+    GenerationArena* treeArena();
+    
+    /**
+     * @return treeArena()'s resource or the default resource if there is none
+     */
+    inline std::pmr::memory_resource* treeResource() {
+        auto* arena = treeArena();
+        return arena != nullptr ? arena->get() : std::pmr::get_default_resource();
+    }
+    
+    /**
+     * Nodes created on this thread while the scope is alive come from the arena.
+     * Scopes nest, the previous arena is restored on destruction.
+     */
+    class ArenaScope {
+        private:
+            GenerationArena* previous;
+        public:
+            explicit ArenaScope(GenerationArena& arena);
+            
+            ArenaScope(const ArenaScope&) = delete;
+            ArenaScope& operator=(const ArenaScope&) = delete;
+            
+            ~ArenaScope();
+    };
+    
+}
+
+#endif //PARKSNREC_ARENA_V3_H
@@ -15,6 +15,14 @@ namespace parks::genetic {
     constexpr double colorMutationChance = 0.2;
     constexpr double functionMutationChance = 0.2;
     
+    // defaults for evolving a population, see Population
+    constexpr size_t populationSize = 64;
+    constexpr size_t tournamentSize = 4;
+    constexpr size_t eliteCount = 2;
+    constexpr double crossoverChance = 0.6;
+    constexpr double mutationChance = 0.8;
+    constexpr int treeHeight = 7;
+    
     struct Color {
         double r, g, b;
         bool bw = false;
@@ -102,16 +110,25 @@ namespace parks::genetic {
         Color left, right;
     };
     
+    // most parameters any function takes, the noise functions' five scalars
+    constexpr unsigned int MAX_PARAMETERS = 5;
+    
     class ParameterSet {
         private:
-            std::vector<Color> parameters;
+            // stored inline so sets can be copied and passed to functions without touching the heap
+            Color parameters[MAX_PARAMETERS]{Color{0}, Color{0}, Color{0}, Color{0}, Color{0}};
+            unsigned int count = 0;
         public:
-            ParameterSet() = default;
-            
             inline const Color& operator[](int index) const {return parameters[index];}
-            inline size_t size(){return parameters.size();}
+            [[nodiscard]] inline size_t size() const {return count;}
             
-            void add(Color c) {parameters.push_back(c);}
+            void add(Color c) {
+                if (count >= MAX_PARAMETERS) {
+                    BLT_ERROR("Parameter set is full, MAX_PARAMETERS (%d) needs raising!", MAX_PARAMETERS);
+                    return;
+                }
+                parameters[count++] = c;
+            }
     };
     
 }
@@ -0,0 +1,258 @@
+//
+// Created by brett on 7/24/23.
+//
+
+#ifndef PARKSNREC_COMPILER_V3_H
+#define PARKSNREC_COMPILER_V3_H
+
+#include <genetic/v3/functions_v3.h>
+#include <genetic/v3/noise_v3.h>
+#include <genetic/v3/profile_v3.h>
+#include <vector>
+
+namespace parks::genetic {
+
+    class GeneticTree;
+    class LinearTree;
+
+    enum class OperandType : unsigned char {
+        ZERO, X, Y, CONSTANT, SLOT, COLUMN, ROW
+    };
+
+    /**
+     * Where an instruction reads one of its arguments from. Constants index into the program's constant pool,
+     * slots index into the per-pixel scratch buffer (the output of instruction 'index'), columns and rows index into
+     * the program's x-only and y-only subprograms
+     */
+    struct Operand {
+        OperandType type = OperandType::ZERO;
+        unsigned int index = 0;
+    };
+
+    struct Instruction {
+        FunctionID op;
+        Operand left, right;
+        // index into the program's parameter pool
+        unsigned int params;
+        // heap position of the tree node this instruction was lowered from
+        unsigned int node;
+    };
+
+    /**
+     * Outputs of a program's x-only and y-only subprograms for one image size, built by CompiledTree::buildTables().
+     * Every batch holds BATCH_SIZE consecutive columns (or rows), so pixel x of column table k is
+     * columns[k][x / BATCH_SIZE] lane x % BATCH_SIZE.
+     */
+    template<typename T>
+    struct BasicAxisTables {
+        std::vector<std::vector<BasicColorBatch<T>>> columns;
+        std::vector<std::vector<BasicColorBatch<T>>> rows;
+    };
+    
+    typedef BasicAxisTables<double> AxisTables;
+    typedef BasicAxisTables<float> FloatAxisTables;
+
+    /**
+     * Per-thread scratch space for batch evaluation, sized by CompiledTree::prepare()
+     */
+    template<typename T>
+    struct BasicBatchState {
+        std::vector<BasicColorBatch<T>> slots;
+        std::vector<BasicColorBatch<T>> constants;
+        BasicColorBatch<T> x{}, y{}, zero{};
+        const BasicAxisTables<T>* tables = nullptr;
+        // indexed by instruction, null if noise is always computed
+        const std::vector<NoiseBinding>* noise = nullptr;
+        // row table values broadcast for the row currently being evaluated
+        std::vector<BasicColorBatch<T>> rows;
+        unsigned int row = 0;
+        unsigned int column = 0;
+        bool rowsValid = false;
+#ifdef PARKSNREC_OP_PROFILE
+        // indexed by instruction, reset by prepare() and read back with OperatorProfile::add()
+        std::vector<OperatorCost> profile;
+#endif
+    };
+    
+    typedef BasicBatchState<double> BatchState;
+    typedef BasicBatchState<float> FloatBatchState;
+    
+    /**
+     * A GeneticTree lowered into a linear postfix instruction stream. Every instruction writes its result into the slot
+     * matching its own index, so by the time an instruction runs all of its arguments have already been computed.
+     * Nodes which take no arguments (RAND_SCALAR, RAND_COLOR) and any subtree which doesn't depend on x or y are
+     * evaluated once at compile time and inlined as constants.
+     * Subtrees which only depend on x (or only on y) have one value per column (or row) instead of one per pixel. They
+     * are split off into their own programs, evaluated once per image into AxisTables and read back with COLUMN and
+     * ROW operands, cutting their cost from width * height to width + height evaluations.
+     */
+    class CompiledTree {
+        private:
+            friend GeneticTree;
+            friend LinearTree;
+
+            std::vector<Instruction> instructions;
+            std::vector<Color> constants;
+            std::vector<ParameterSet> parameters;
+            Operand result;
+            // subprograms which only read x. rows only read y, which is renamed to x so both are evaluated the same way
+            std::vector<CompiledTree> columns;
+            std::vector<CompiledTree> rows;
+
+            // number of operators evaluated at compile time because their subtree doesn't depend on the pixel
+            unsigned int foldedNodes = 0;
+            
+            Operand addConstant(Color c);
+            Operand addInstruction(FunctionID op, Operand left, Operand right, const ParameterSet& set, unsigned int node);
+            /**
+             * Evaluates an operator whose arguments are both invariant and stores the result as a constant
+             */
+            Operand fold(FunctionID op, Operand left, Operand right, const ParameterSet& set);
+            /**
+             * Moves the largest x-only and y-only subtrees into column and row subprograms. Run once the whole tree has
+             * been compiled.
+             */
+            void separate();
+            /**
+             * Copies the subtree ending in instruction index into another program, marking the instructions it used
+             */
+            Operand extract(unsigned int index, bool swapAxes, CompiledTree& into, std::vector<char>& extracted) const;
+            
+            [[nodiscard]] static inline bool isInvariant(Operand operand) {
+                return operand.type == OperandType::CONSTANT || operand.type == OperandType::ZERO;
+            }
+
+            template<typename T>
+            [[nodiscard]] inline const BasicColorBatch<T>& fetch(Operand operand, const BasicBatchState<T>& state) const {
+                switch (operand.type) {
+                    case OperandType::X:
+                        return state.x;
+                    case OperandType::Y:
+                        return state.y;
+                    case OperandType::CONSTANT:
+                        return state.constants[operand.index];
+                    case OperandType::SLOT:
+                        return state.slots[operand.index];
+                    case OperandType::COLUMN:
+                        return state.tables->columns[operand.index][state.column];
+                    case OperandType::ROW:
+                        return state.rows[operand.index];
+                    default:
+                        return state.zero;
+                }
+            }
+            
+            [[nodiscard]] inline Color fetch(Operand operand, double x, double y, const Color* slots) const {
+                switch (operand.type) {
+                    case OperandType::X:
+                        return Color(x);
+                    case OperandType::Y:
+                        return Color(y);
+                    case OperandType::CONSTANT:
+                        return constants[operand.index];
+                    case OperandType::SLOT:
+                        return slots[operand.index];
+                    case OperandType::COLUMN:
+                        return slots[instructions.size() + operand.index];
+                    case OperandType::ROW:
+                        return slots[instructions.size() + columns.size() + operand.index];
+                    default:
+                        return Color(0);
+                }
+            }
+        public:
+            CompiledTree() = default;
+
+            /**
+             * Runs the program for a single pixel
+             * @param slots scratch buffer of at least scratchSize() colors, reused between calls
+             */
+            Color execute(double x, double y, Color* slots) const;
+
+            /**
+             * Evaluates the column and row subprograms for every column and row of a width * height image
+             * @tparam T precision the tables are evaluated in, must match the batch state they are used with
+             * @param profile receives the cost of the subprograms when profiling is compiled in
+             */
+            template<typename T = double>
+            [[nodiscard]] BasicAxisTables<T> buildTables(unsigned int width, unsigned int height, OperatorProfile* profile = nullptr) const;
+
+            /**
+             * Sizes the scratch buffers of a batch state for this program and broadcasts the constants into it.
+             * Must be called before executeBatch() whenever the state is used with a different program.
+             * @param tables built by buildTables() for the image being rendered, must outlive the state's use
+             * @param noise cached noise fields for the image being rendered, one per instruction. See NoiseCache::bind()
+             */
+            template<typename T>
+            void prepare(BasicBatchState<T>& state, const BasicAxisTables<T>* tables = nullptr, const std::vector<NoiseBinding>* noise = nullptr) const;
+            
+            /**
+             * Evaluates BATCH_SIZE pixels of a row at once, starting at pixel (x, y) of a width * height image.
+             * x must be a multiple of BATCH_SIZE and the size must match the tables the state was prepared with.
+             * Lanes past the right edge of the image are computed but hold meaningless values.
+             * The double version matches execute() bit for bit. The float version runs the arithmetic operators in
+             * single precision, transcendental and noise operators are still computed in double and rounded.
+             * @return the batch holding the output colors, only valid until the next call using the same state
+             */
+            template<typename T>
+            const BasicColorBatch<T>& executeBatch(unsigned int x, unsigned int y, unsigned int width, unsigned int height, BasicBatchState<T>& state) const;
+            
+            /**
+             * @return true if the output is a single scalar channel which should be displayed in greyscale
+             */
+            [[nodiscard]] bool resultIsBW() const;
+            
+            [[nodiscard]] inline size_t slotCount() const {
+                return instructions.size();
+            }
+            
+            /**
+             * @return size of the scratch buffer execute() needs, the slots followed by the subprogram results and their slots
+             */
+            [[nodiscard]] size_t scratchSize() const;
+            
+            /**
+             * @return number of instructions run once per column or row rather than once per pixel
+             */
+            [[nodiscard]] size_t axisInstructionCount() const;
+
+            /**
+             * Runs a single instruction on the given arguments, used by backends which can't inline an operator
+             */
+            [[nodiscard]] Color executeInstruction(size_t index, Color left, Color right) const;
+            
+            [[nodiscard]] inline const std::vector<Instruction>& getInstructions() const {
+                return instructions;
+            }
+            
+            /**
+             * @return the parameters of instruction index
+             */
+            [[nodiscard]] inline const ParameterSet& getParameters(size_t index) const {
+                return parameters[instructions[index].params];
+            }
+            
+            [[nodiscard]] inline const std::vector<Color>& getConstants() const {
+                return constants;
+            }
+            
+            [[nodiscard]] inline Operand getResult() const {
+                return result;
+            }
+            
+            [[nodiscard]] inline const std::vector<CompiledTree>& getColumns() const {
+                return columns;
+            }
+            
+            [[nodiscard]] inline const std::vector<CompiledTree>& getRows() const {
+                return rows;
+            }
+            
+            [[nodiscard]] inline unsigned int getFoldedCount() const {
+                return foldedNodes;
+            }
+    };
+
+}
+
+#endif //PARKSNREC_COMPILER_V3_H
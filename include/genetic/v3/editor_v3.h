@@ -0,0 +1,94 @@
+//
+// Created by brett on 7/28/23.
+//
+
+#ifndef PARKSNREC_EDITOR_V3_H
+#define PARKSNREC_EDITOR_V3_H
+
+#include <genetic/v3/program_v3.h>
+#include <genetic/v3/screening_v3.h>
+#include "ImNodesEz.h"
+
+namespace parks::genetic {
+    
+    class Program {
+        private:
+            struct ImNode_t
+            {
+                int height{};
+                int index{};
+                FunctionID id;
+                ImVec2 pos{};
+                bool selected{};
+                ImNodes::Ez::SlotInfo inputs[1]{};
+                ImNodes::Ez::SlotInfo outputs[2]{};
+            };
+            std::vector<ImNode_t> treeNodes;
+            
+            unsigned char pixels[WIDTH * HEIGHT * CHANNELS];
+            GeneticTree* tree;
+            GeneticTree* last_tree = nullptr;
+            GeneticTree* saved_tree = nullptr;
+            
+            void regenTreeDisplay();
+            
+            float renderProgress = 0;
+            
+            FitnessScores scores{MetricID::SIMILARITY, MetricID::BRIGHTNESS, MetricID::CONTRAST, MetricID::COLORFULNESS};
+            bool fitnessValid = false;
+            // set when the fused metrics in scores came from the last render
+            bool fitnessFused = false;
+            
+            void startRender();
+            
+            bool useJit = false;
+            long jitMismatches = 0;
+            bool jitCompared = false;
+            
+            bool useFloat = false;
+            PrecisionReport precisionReport;
+            bool precisionCompared = false;
+            
+            NoiseBenchmark noiseBenchmark;
+            bool noiseBenchmarked = false;
+            
+            ScreeningReport screeningReport;
+            bool screened = false;
+            
+            // copy of the last profiled render, refreshed once the render started by startRender() finishes
+            OperatorProfile profile;
+            bool profileValid = false;
+            char profilePath[256] = "operator_profile.csv";
+            std::string profileStatus;
+            
+            void drawProfile();
+        public:
+            Program() = default;
+            
+            void run();
+            void draw();
+        
+            [[nodiscard]] float getRenderProgress() const{
+                return renderProgress;
+            }
+            
+            [[nodiscard]] static inline bool isRendering() {
+                return RenderPool::get().busy();
+            }
+            
+            inline unsigned char* getPixels(){
+                return pixels;
+            }
+            
+            ~Program(){
+                // the pool may still be writing into our pixels
+                RenderPool::get().wait();
+                delete tree;
+                delete last_tree;
+                delete saved_tree;
+            }
+    };
+    
+}
+
+#endif //PARKSNREC_EDITOR_V3_H
@@ -0,0 +1,112 @@
+//
+// Created by brett on 7/28/23.
+//
+
+#ifndef PARKSNREC_EVOLUTION_V3_H
+#define PARKSNREC_EVOLUTION_V3_H
+
+#include <genetic/v3/program_v3.h>
+#include <genetic/v3/screening_v3.h>
+#include <genetic/v3/arena_v3.h>
+#include <utility>
+#include <vector>
+
+namespace parks::genetic {
+    
+    struct EvolutionConfig {
+        size_t populationSize = parks::genetic::populationSize;
+        // candidates drawn for each tournament, the fittest of them becomes a parent
+        size_t tournamentSize = parks::genetic::tournamentSize;
+        // best candidates copied into the next generation unchanged
+        size_t eliteCount = parks::genetic::eliteCount;
+        int treeHeight = parks::genetic::treeHeight;
+        // score candidates with screenCandidates() instead of rendering every one at full resolution
+        bool screen = false;
+        ScreeningConfig screening;
+        // build each generation's trees in a GenerationArena instead of on the heap
+        bool arena = true;
+    };
+    
+    struct GenerationStats {
+        size_t generation = 0;
+        double best = 0;
+        // mean over candidates which were scored at full resolution
+        double mean = 0;
+        // full resolution scores made for this generation
+        size_t evaluations = 0;
+        double seconds = 0;
+    };
+    
+    /**
+     * A generation of trees evolved with tournament selection and elitism. Nothing here touches the UI, so it can
+     * run headless. Every method blocks on the render pool.
+     */
+    class Population {
+        private:
+            EvolutionConfig config;
+            std::vector<GeneticTree*> members;
+            std::vector<double> fitness;
+            size_t generation = 0;
+            
+            // the current generation lives in arenas[currentArena], the next one is built in the other
+            GenerationArena arenas[2];
+            size_t currentArena = 0;
+            
+            // deletes the members and releases the current arena. Trees built in it only have their shells freed,
+            // their nodes go with the arena
+            void retire();
+            // scores every member, returning the number of full resolution evaluations
+            size_t evaluate();
+            GeneticTree* select();
+            GenerationStats stats(size_t evaluations, double seconds) const;
+        public:
+            explicit Population(EvolutionConfig config = {});
+            
+            Population(const Population&) = delete;
+            Population& operator=(const Population&) = delete;
+            
+            /**
+             * Creates and scores the first generation
+             */
+            GenerationStats initialize();
+            /**
+             * Breeds and scores the next generation
+             */
+            GenerationStats step();
+            
+            /**
+             * @return the fittest member of the current generation, owned by the population
+             */
+            [[nodiscard]] GeneticTree* best() const;
+            
+            /**
+             * @return copies of the n fittest members with their fitness, owned by the caller
+             */
+            [[nodiscard]] std::vector<std::pair<GeneticTree*, double>> fittest(size_t n) const;
+            /**
+             * Replaces the least fit members with already scored trees from elsewhere, taking ownership of them
+             */
+            void replaceWorst(const std::vector<std::pair<GeneticTree*, double>>& trees);
+            
+            [[nodiscard]] inline size_t getGeneration() const {
+                return generation;
+            }
+            
+            [[nodiscard]] inline const GenerationArena& getArena() const {
+                return arenas[currentArena];
+            }
+            
+            [[nodiscard]] inline const std::vector<GeneticTree*>& getMembers() const {
+                return members;
+            }
+            
+            [[nodiscard]] inline const std::vector<double>& getFitness() const {
+                return fitness;
+            }
+            
+            ~Population();
+    };
+    
+}
+
+#endif //PARKSNREC_EVOLUTION_V3_H
@@ -0,0 +1,227 @@
+//
+// Created by brett on 7/28/23.
+//
+
+#ifndef PARKSNREC_FITNESS_V3_H
+#define PARKSNREC_FITNESS_V3_H
+
+#include <genetic/util.h>
+#include <cstdint>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace parks::genetic {
+    
+    // half widths of the two neighbourhoods the fitness compares, similarity(.., 3) and aroundSimilarity(.., 5)
+    constexpr int SIMILARITY_RADIUS = 2;
+    constexpr int AROUND_RADIUS = 4;
+    // rows a banded metric reduces at a time. The renderer's tiles are this high so each band is one row of tiles
+    constexpr unsigned int FITNESS_BAND_HEIGHT = 8;
+    
+    /**
+     * Scores a rendered width * height image with the SIMILARITY metric, the same value rendering with it produces.
+     * Matches GeneticTree::evaluateReference() bit for bit for full resolution images.
+     * Pixels are packed into 32 bit keys and the neighbourhood comparisons are done one offset at a time across
+     * whole rows, with the bands split between the render pool's workers. The per-pixel terms are summed afterwards
+     * in the reference's order.
+     * Blocks until done, must not be called from a render pool worker.
+     */
+    double evaluateFitness(const unsigned char* pixels, unsigned int width = WIDTH, unsigned int height = HEIGHT);
+    
+    enum class MetricID {
+        SIMILARITY, BRIGHTNESS, CONTRAST, COLORFULNESS
+    };
+    
+    constexpr size_t METRIC_COUNT = 4;
+    
+    /**
+     * Running sums a fused metric keeps for one tile. Each metric decides what its entries mean.
+     */
+    struct MetricTotals {
+        double v[5]{};
+        // pixels accumulated so far, kept by FitnessReduction
+        size_t pixels = 0;
+    };
+    
+    /**
+     * A fitness measure of a rendered image. Fused metrics only look at the pixels of one tile at a time, so the
+     * renderer can accumulate them while the tile is still in cache and merge the tiles once the image is complete.
+     * Banded metrics compare pixels with their neighbours (like the similarity), they count a band of
+     * FITNESS_BAND_HEIGHT rows into per-pixel counts as soon as the tiles of the band and of its halo have rendered,
+     * and sum the counts of the whole image once at the end. Metrics which need the whole image score it after
+     * rendering instead.
+     */
+    class FitnessMetric {
+        public:
+            typedef std::function<void(const unsigned char* tile, unsigned int width, unsigned int height, size_t stride, MetricTotals& totals)> accumulate_func;
+            typedef std::function<void(MetricTotals& into, const MetricTotals& tile)> merge_func;
+            typedef std::function<double(const MetricTotals& totals)> finish_func;
+            typedef std::function<double(const unsigned char* pixels, unsigned int width, unsigned int height)> image_func;
+            // keys holds every pixel as r | g << 8 | b << 16, counts the metric's planes of width * height counts each
+            typedef std::function<void(const uint32_t* keys, unsigned int width, unsigned int height, unsigned int y, unsigned int rows,
+                                       uint8_t* counts)> band_func;
+            typedef std::function<double(const unsigned char* pixels, const uint8_t* counts, unsigned int width, unsigned int height)> sum_func;
+        private:
+            accumulate_func accumulateFunc;
+            merge_func mergeFunc;
+            finish_func finishFunc;
+            image_func imageFunc;
+            band_func bandFunc;
+            sum_func sumFunc;
+            unsigned int haloRows = 0;
+            unsigned int topRows = 0;
+            unsigned int countPlanes = 0;
+        public:
+            const std::string name;
+            
+            FitnessMetric(std::string name, accumulate_func accumulate, merge_func merge, finish_func finish):
+                    accumulateFunc(std::move(accumulate)), mergeFunc(std::move(merge)), finishFunc(std::move(finish)), name(std::move(name)) {}
+            FitnessMetric(std::string name, image_func image): imageFunc(std::move(image)), name(std::move(name)) {}
+            /**
+             * @param halo rows above and below a band that band reads
+             * @param top rows at the top of the image every band reads
+             * @param planes per-pixel counts the metric keeps
+             */
+            FitnessMetric(std::string name, unsigned int halo, unsigned int top, unsigned int planes, band_func band, sum_func sum):
+                    bandFunc(std::move(band)), sumFunc(std::move(sum)), haloRows(halo), topRows(top), countPlanes(planes), name(std::move(name)) {}
+            FitnessMetric(const FitnessMetric& f) = delete;
+            FitnessMetric& operator=(const FitnessMetric& f) = delete;
+            
+            [[nodiscard]] inline bool fused() const {
+                return accumulateFunc != nullptr;
+            }
+            
+            [[nodiscard]] inline bool banded() const {
+                return bandFunc != nullptr;
+            }
+            
+            [[nodiscard]] inline unsigned int halo() const {
+                return haloRows;
+            }
+            
+            [[nodiscard]] inline unsigned int anchorRows() const {
+                return topRows;
+            }
+            
+            [[nodiscard]] inline unsigned int planes() const {
+                return countPlanes;
+            }
+            
+            /**
+             * Adds a width * height rectangle of pixels to totals, starting at tile with rows stride pixels apart.
+             * Fused metrics only.
+             */
+            inline void accumulate(const unsigned char* tile, unsigned int width, unsigned int height, size_t stride, MetricTotals& totals) const {
+                accumulateFunc(tile, width, height, stride, totals);
+            }
+            
+            inline void merge(MetricTotals& into, const MetricTotals& tile) const {
+                mergeFunc(into, tile);
+            }
+            
+            [[nodiscard]] inline double finish(const MetricTotals& totals) const {
+                return finishFunc(totals);
+            }
+            
+            /**
+             * Writes the counts of rows [y, y + rows). Banded metrics only, the halo and top rows must be in keys.
+             */
+            inline void countBand(const uint32_t* keys, unsigned int width, unsigned int height, unsigned int y, unsigned int rows,
+                                  uint8_t* counts) const {
+                bandFunc(keys, width, height, y, rows, counts);
+            }
+            
+            /**
+             * @return the value of an image once every band is counted. Banded metrics only.
+             */
+            [[nodiscard]] inline double sum(const unsigned char* pixels, const uint8_t* counts, unsigned int width, unsigned int height) const {
+                return sumFunc(pixels, counts, width, height);
+            }
+            
+            /**
+             * Scores a complete image. Whole image metrics only, may use the render pool so must not be called from it.
+             */
+            [[nodiscard]] inline double evaluate(const unsigned char* pixels, unsigned int width, unsigned int height) const {
+                return imageFunc(pixels, width, height);
+            }
+    };
+    
+    const FitnessMetric& fitnessMetric(MetricID id);
+    
+    /**
+     * The metrics to score a render with and, once it has finished, their values in the same order.
+     */
+    struct FitnessScores {
+        std::vector<MetricID> metrics;
+        // how much each metric contributes to combined(), missing weights count as 1
+        std::vector<double> weights;
+        std::vector<double> values;
+        
+        FitnessScores() = default;
+        FitnessScores(std::initializer_list<MetricID> metrics): metrics(metrics) {}
+        
+        [[nodiscard]] double combined() const;
+        
+        /**
+         * @return the value of a metric, NaN if it wasn't requested or hasn't been scored
+         */
+        [[nodiscard]] double get(MetricID id) const;
+    };
+    
+    /**
+     * Per-tile totals of the fused metrics and per-pixel counts of the banded metrics in one render. Tiles are rows of
+     * tileWidth * FITNESS_BAND_HEIGHT pixels and may be accumulated by any thread in any order, each only touching its
+     * own entries. The thread finishing the last tile a band depends on counts that band. Tiles are merged and counts
+     * summed in a fixed order so the scores don't depend on scheduling.
+     */
+    class FitnessReduction {
+        private:
+            std::vector<MetricID> fused;
+            std::vector<MetricTotals> totals;
+            std::vector<MetricID> banded;
+            // the planes of every banded metric one after another, each width * height
+            std::vector<uint8_t> counts;
+            // first plane of each banded metric
+            std::vector<size_t> countOffsets;
+            // the image packed into keys as its tiles finish, only filled when there are banded metrics
+            std::vector<uint32_t> keys;
+            // per band, tiles still to be accumulated before the band can be reduced
+            std::unique_ptr<std::atomic<unsigned int>[]> pending;
+            const unsigned char* pixels = nullptr;
+            unsigned int width = 0, height = 0;
+            unsigned int tilesX = 0, bands = 0;
+            // bands either side of a band it depends on, and bands at the top every band depends on
+            unsigned int haloBands = 0, anchorBands = 0;
+            
+            void countBand(unsigned int band);
+        public:
+            FitnessReduction() = default;
+            FitnessReduction(const FitnessScores& scores, const unsigned char* pixels, unsigned int width, unsigned int height, unsigned int tileWidth);
+            
+            [[nodiscard]] inline bool empty() const {
+                return fused.empty() && banded.empty();
+            }
+            
+            /**
+             * Accumulates the rectangle at (x, y) as the given tile. The rectangle must lie within one band.
+             */
+            void accumulate(size_t tile, unsigned int x, unsigned int y, unsigned int tileWidth, unsigned int tileHeight);
+            /**
+             * Writes the value of every fused and banded metric into scores. Must only be called once all tiles are
+             * accumulated.
+             */
+            void finish(FitnessScores& scores) const;
+    };
+    
+    /**
+     * Scores the whole image metrics in scores, which can't be reduced while rendering. Blocks, must not be called from
+     * the render pool.
+     */
+    void evaluatePostMetrics(const unsigned char* pixels, FitnessScores& scores, unsigned int width = WIDTH, unsigned int height = HEIGHT);
+    
+}
+
+#endif //PARKSNREC_FITNESS_V3_H
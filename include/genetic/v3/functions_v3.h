@@ -5,11 +5,15 @@
 #ifndef PARKSNREC_FUNCTIONS_V3_H
 #define PARKSNREC_FUNCTIONS_V3_H
 
+#include <cmath>
+#include <cstddef>
 #include <functional>
 #include <utility>
 #include <genetic/util.h>
 #include <genetic/v3/arguments.h>
-#include <unordered_set>
+#include <algorithm>
+#include <string>
+#include <vector>
 
 namespace parks::genetic {
     
@@ -26,82 +30,198 @@ namespace parks::genetic {
     constexpr unsigned char ARGS_FUNCS = 0b00100000;
     
 
-    Color randScalar(OperatorArguments args, const ParameterSet& params);
-    Color randColor(OperatorArguments args, const ParameterSet& params);
-    Color add(OperatorArguments args, const ParameterSet& params);
-    Color subtract(OperatorArguments args, const ParameterSet& params);
-    Color multiply(OperatorArguments args, const ParameterSet& params);
-    Color divide(OperatorArguments args, const ParameterSet& params);
-    Color mod(OperatorArguments args, const ParameterSet& params);
-    Color round(OperatorArguments args, const ParameterSet& params);
-    Color min(OperatorArguments args, const ParameterSet& params);
-    Color max(OperatorArguments args, const ParameterSet& params);
-    Color abs(OperatorArguments args, const ParameterSet& params);
-    Color log(OperatorArguments args, const ParameterSet& params);
-    Color sin(OperatorArguments args, const ParameterSet& params);
-    Color cos(OperatorArguments args, const ParameterSet& params);
-    Color atan(OperatorArguments args, const ParameterSet& params);
+    template<typename T>
+    inline Color applyFunc(T op, Color left, Color right) {
+        return Color(op(left.r, right.r), op(left.g, right.g), op(left.b, right.b));
+    }
+    
+    // the per pixel operators are defined here so the evaluators can inline them, see callFunction()
+    inline Color randScalar(OperatorArguments, const ParameterSet& params) {
+        return params[0];
+    }
+    
+    inline Color randColor(OperatorArguments, const ParameterSet& params) {
+        return params[0];
+    }
+    
+    inline Color add(OperatorArguments args, const ParameterSet&) {
+        return applyFunc(std::plus(), args.left, args.right);
+    }
+    
+    inline Color subtract(OperatorArguments args, const ParameterSet&) {
+        return applyFunc(std::minus(), args.left, args.right);
+    }
+    
+    inline Color multiply(OperatorArguments args, const ParameterSet&) {
+        return applyFunc(std::multiplies(), args.left, args.right);
+    }
+    
+    inline Color divide(OperatorArguments args, const ParameterSet&) {
+        return applyFunc(std::divides(), args.left, args.right);
+    }
+    
+    inline Color mod(OperatorArguments args, const ParameterSet&) {
+        return applyFunc(floatMod(), args.left, args.right);
+    }
+    
+    inline Color round(OperatorArguments args, const ParameterSet&) {
+        return Color(std::round(args.left.r), std::round(args.left.g), std::round(args.left.b));
+    }
+    
+    inline Color min(OperatorArguments args, const ParameterSet&) {
+        return Color(std::min(args.left.r, args.right.r), std::min(args.left.g, args.right.g), std::min(args.left.b, args.right.b));
+    }
+    
+    inline Color max(OperatorArguments args, const ParameterSet&) {
+        return Color(std::max(args.left.r, args.right.r), std::max(args.left.g, args.right.g), std::max(args.left.b, args.right.b));
+    }
+    
+    inline Color abs(OperatorArguments args, const ParameterSet&) {
+        return Color(std::abs(args.left.r), std::abs(args.left.g), std::abs(args.left.b));
+    }
+    
+    inline Color log(OperatorArguments args, const ParameterSet&) {
+        return Color(std::log(args.left.r), std::log(args.left.g), std::log(args.left.b));
+    }
+    
+    inline Color sin(OperatorArguments args, const ParameterSet&) {
+        return Color(std::sin(args.left.r), std::sin(args.left.g), std::sin(args.left.b));
+    }
+    
+    inline Color cos(OperatorArguments args, const ParameterSet&) {
+        return Color(std::cos(args.left.r), std::cos(args.left.g), std::cos(args.left.b));
+    }
+    
+    inline Color atan(OperatorArguments args, const ParameterSet&) {
+        return Color(std::atan(args.left.r), std::atan(args.left.g), std::atan(args.left.b));
+    }
+    
     Color noise(OperatorArguments args, const ParameterSet& params);
     Color colorNoise(OperatorArguments args, const ParameterSet& params);
     
+    constexpr unsigned int BATCH_SIZE = 64;
+    
+    /**
+     * A run of BATCH_SIZE horizontally adjacent pixels stored as one array per channel
+     */
+    template<typename T>
+    struct alignas(32) BasicColorBatch {
+        T r[BATCH_SIZE];
+        T g[BATCH_SIZE];
+        T b[BATCH_SIZE];
+        
+        [[nodiscard]] inline Color get(unsigned int lane) const {
+            // built by hand, the three argument constructor would normalize the values
+            Color c{0};
+            c.r = r[lane];
+            c.g = g[lane];
+            c.b = b[lane];
+            return c;
+        }
+        
+        inline void set(unsigned int lane, Color c) {
+            r[lane] = (T) c.r;
+            g[lane] = (T) c.g;
+            b[lane] = (T) c.b;
+        }
+        
+        inline void fill(Color c) {
+            for (unsigned int i = 0; i < BATCH_SIZE; i++)
+                set(i, c);
+        }
+    };
+    
+    typedef BasicColorBatch<double> ColorBatch;
+    // 12 bytes a pixel instead of the 32 of a Color, with twice as many values per SIMD register as ColorBatch
+    typedef BasicColorBatch<float> FloatColorBatch;
+    
+    // batch versions of the arithmetic operators. the double versions produce exactly the same values as the per-pixel
+    // functions, the float versions run the same operations in single precision. instantiated for double and float
+    template<typename T>
+    void addBatch(const BasicColorBatch<T>& left, const BasicColorBatch<T>& right, BasicColorBatch<T>& out);
+    template<typename T>
+    void subtractBatch(const BasicColorBatch<T>& left, const BasicColorBatch<T>& right, BasicColorBatch<T>& out);
+    template<typename T>
+    void multiplyBatch(const BasicColorBatch<T>& left, const BasicColorBatch<T>& right, BasicColorBatch<T>& out);
+    template<typename T>
+    void divideBatch(const BasicColorBatch<T>& left, const BasicColorBatch<T>& right, BasicColorBatch<T>& out);
+    template<typename T>
+    void modBatch(const BasicColorBatch<T>& left, const BasicColorBatch<T>& right, BasicColorBatch<T>& out);
+    template<typename T>
+    void minBatch(const BasicColorBatch<T>& left, const BasicColorBatch<T>& right, BasicColorBatch<T>& out);
+    template<typename T>
+    void maxBatch(const BasicColorBatch<T>& left, const BasicColorBatch<T>& right, BasicColorBatch<T>& out);
+    template<typename T>
+    void roundBatch(const BasicColorBatch<T>& left, BasicColorBatch<T>& out);
+    template<typename T>
+    void absBatch(const BasicColorBatch<T>& left, BasicColorBatch<T>& out);
+    // noise operators evaluated NOISE_LANES pixels at a time, the same values as noise() and colorNoise()
+    template<typename T>
+    void noiseBatch(const BasicColorBatch<T>& left, const BasicColorBatch<T>& right, const ParameterSet& params, BasicColorBatch<T>& out);
+    template<typename T>
+    void colorNoiseBatch(const BasicColorBatch<T>& left, const BasicColorBatch<T>& right, const ParameterSet& params, BasicColorBatch<T>& out);
+    
     enum class FunctionID {
          RAND_SCALAR, RAND_COLOR, ADD, SUBTRACT, MULTIPLY, DIVIDE, MOD, ROUND, MIN, MAX, ABS, LOG, SIN, COS, ATAN, NOISE, COLOR_NOISE
     };
     
     class Function {
         private:
-            std::function<Color(OperatorArguments, ParameterSet)> func;
+            Color (* func)(OperatorArguments, const ParameterSet&);
             unsigned int requiredScalars;
             unsigned int requiredColors;
             unsigned char acceptsArgs;
         public:
-            const std::string name;
-            Function(std::string name, std::function<Color(OperatorArguments, ParameterSet)> func, unsigned int requiredScalars, unsigned int requiredColors, unsigned int acceptsArgs): func(std::move(func)), requiredScalars(requiredScalars), requiredColors(requiredColors), acceptsArgs(acceptsArgs), name(std::move(name)) {
+            const FunctionID id;
+            const char* const name;
+            constexpr Function(FunctionID id, const char* name, Color (* func)(OperatorArguments, const ParameterSet&), unsigned int requiredScalars,
+                               unsigned int requiredColors, unsigned int acceptsArgs):
+                    func(func), requiredScalars(requiredScalars), requiredColors(requiredColors), acceptsArgs(acceptsArgs), id(id), name(name) {
             }
             Function(const Function& f) = delete;
             Function& operator=(const Function& f) = delete;
             // in the case of single argument, it is provided to the left side!
-            [[nodiscard]] inline bool singleArgument() const {
+            [[nodiscard]] constexpr bool singleArgument() const {
                 return acceptsArgs & ARGS_SINGLE;
             }
             
-            [[nodiscard]] inline bool bothArgument() const {
+            [[nodiscard]] constexpr bool bothArgument() const {
                 return acceptsArgs & ARGS_BOTH;
             }
             
-            [[nodiscard]] inline bool dontCareArgument() const {
+            [[nodiscard]] constexpr bool dontCareArgument() const {
                 return acceptsArgs & ARGS_DONT_CARE;
             }
             
-            [[nodiscard]] inline bool allowsArgument() const {
+            [[nodiscard]] constexpr bool allowsArgument() const {
                 return bothArgument() || dontCareArgument() || singleArgument();
             }
             
-            [[nodiscard]] inline bool disallowsArgument() const {
+            [[nodiscard]] constexpr bool disallowsArgument() const {
                 return acceptsArgs & ARGS_NONE;
             }
             
-            [[nodiscard]] inline bool allowedVariables() const {
+            [[nodiscard]] constexpr bool allowedVariables() const {
                 return acceptsArgs & ARGS_VARIABLES;
             }
             
-            [[nodiscard]] inline bool allowedScalars() const {
+            [[nodiscard]] constexpr bool allowedScalars() const {
                 return acceptsArgs & ARGS_SCALARS;
             }
             
-            [[nodiscard]] inline bool allowedColors() const {
+            [[nodiscard]] constexpr bool allowedColors() const {
                 return acceptsArgs & ARGS_COLORS;
             }
             
-            [[nodiscard]] inline bool allowedFuncs() const {
+            [[nodiscard]] constexpr bool allowedFuncs() const {
                 return acceptsArgs & ARGS_FUNCS;
             }
             
-            [[nodiscard]] inline unsigned int getRequiredScalars() const{
+            [[nodiscard]] constexpr unsigned int getRequiredScalars() const{
                 return requiredScalars;
             }
             
-            [[nodiscard]] inline unsigned int getRequiredColors() const{
+            [[nodiscard]] constexpr unsigned int getRequiredColors() const{
                 return requiredColors;
             }
             
@@ -115,56 +235,209 @@ namespace parks::genetic {
                 return set;
             }
             
-            [[nodiscard]] inline Color call(OperatorArguments args, const ParameterSet& set) const {
-                return func(args, set);
+            /**
+             * Only for callFunction<id>(), everything else calls through callFunction() so the operator is inlined
+             */
+            [[nodiscard]] constexpr auto getOperator() const {
+                return func;
+            }
+            
+    };
+    
+    constexpr size_t FUNCTION_COUNT = (size_t) FunctionID::COLOR_NOISE + 1;
+    
+    // indexed by FunctionID
+    inline constexpr Function FUNCTION_TABLE[FUNCTION_COUNT] = {
+            {FunctionID::RAND_SCALAR, "RS", randScalar, 1, 0, ARGS_NONE},
+            {FunctionID::RAND_COLOR, "RC", randColor, 0, 1, ARGS_NONE},
+            {FunctionID::ADD, "+", add, 0, 0, ARGS_BOTH | ARGS_SCALARS | ARGS_COLORS | ARGS_VARIABLES | ARGS_FUNCS},
+            {FunctionID::SUBTRACT, "-", subtract, 0, 0, ARGS_BOTH | ARGS_SCALARS | ARGS_COLORS | ARGS_VARIABLES | ARGS_FUNCS},
+            {FunctionID::MULTIPLY, "*", multiply, 0, 0, ARGS_BOTH | ARGS_SCALARS | ARGS_COLORS | ARGS_VARIABLES | ARGS_FUNCS},
+            {FunctionID::DIVIDE, "/", divide, 0, 0, ARGS_BOTH | ARGS_SCALARS | ARGS_COLORS | ARGS_VARIABLES | ARGS_FUNCS},
+            {FunctionID::MOD, "%", mod, 0, 0, ARGS_BOTH | ARGS_SCALARS | ARGS_COLORS | ARGS_VARIABLES | ARGS_FUNCS},
+            {FunctionID::ROUND, "ROUND", round, 0, 0, ARGS_SINGLE | ARGS_VARIABLES | ARGS_FUNCS},
+            {FunctionID::MIN, "MIN", min, 0, 0, ARGS_BOTH | ARGS_SCALARS | ARGS_COLORS | ARGS_VARIABLES | ARGS_FUNCS},
+            {FunctionID::MAX, "MAX", max, 0, 0, ARGS_BOTH | ARGS_SCALARS | ARGS_COLORS | ARGS_VARIABLES | ARGS_FUNCS},
+            {FunctionID::ABS, "ABS", abs, 0, 0, ARGS_SINGLE | ARGS_VARIABLES | ARGS_FUNCS},
+            {FunctionID::LOG, "LOG", log, 0, 0, ARGS_SINGLE | ARGS_SCALARS | ARGS_COLORS | ARGS_VARIABLES | ARGS_FUNCS},
+            {FunctionID::SIN, "SIN", sin, 0, 0, ARGS_SINGLE | ARGS_VARIABLES | ARGS_FUNCS},
+            {FunctionID::COS, "COS", cos, 0, 0, ARGS_SINGLE | ARGS_VARIABLES | ARGS_FUNCS},
+            {FunctionID::ATAN, "ATAN", atan, 0, 0, ARGS_SINGLE | ARGS_VARIABLES | ARGS_FUNCS},
+            {FunctionID::NOISE, "Noise", noise, 5, 0, ARGS_BOTH | ARGS_VARIABLES},
+            {FunctionID::COLOR_NOISE, "ColorNoise", colorNoise, 5, 0, ARGS_BOTH | ARGS_VARIABLES},
+    };
+    
+    constexpr bool functionTableInOrder() {
+        for (size_t i = 0; i < FUNCTION_COUNT; i++) {
+            if (FUNCTION_TABLE[i].id != (FunctionID) i)
+                return false;
+        }
+        return true;
+    }
+    static_assert(functionTableInOrder(), "FUNCTION_TABLE must list every function in FunctionID order");
+    
+    /**
+     * @return the function's entry in FUNCTION_TABLE, usable in constant expressions
+     */
+    template<FunctionID id>
+    constexpr const Function& function() {
+        return FUNCTION_TABLE[(size_t) id];
+    }
+    
+    /**
+     * Calls a function known at compile time. The operator is called directly so it can be inlined into the caller.
+     */
+    template<FunctionID id>
+    inline Color callFunction(OperatorArguments args, const ParameterSet& params) {
+        constexpr auto op = function<id>().getOperator();
+        return op(args, params);
+    }
+    
+    /**
+     * Calls any function, switching to the matching callFunction<id>()
+     */
+    inline Color callFunction(FunctionID id, OperatorArguments args, const ParameterSet& params) {
+        switch (id) {
+            case FunctionID::RAND_SCALAR:
+                return callFunction<FunctionID::RAND_SCALAR>(args, params);
+            case FunctionID::RAND_COLOR:
+                return callFunction<FunctionID::RAND_COLOR>(args, params);
+            case FunctionID::ADD:
+                return callFunction<FunctionID::ADD>(args, params);
+            case FunctionID::SUBTRACT:
+                return callFunction<FunctionID::SUBTRACT>(args, params);
+            case FunctionID::MULTIPLY:
+                return callFunction<FunctionID::MULTIPLY>(args, params);
+            case FunctionID::DIVIDE:
+                return callFunction<FunctionID::DIVIDE>(args, params);
+            case FunctionID::MOD:
+                return callFunction<FunctionID::MOD>(args, params);
+            case FunctionID::ROUND:
+                return callFunction<FunctionID::ROUND>(args, params);
+            case FunctionID::MIN:
+                return callFunction<FunctionID::MIN>(args, params);
+            case FunctionID::MAX:
+                return callFunction<FunctionID::MAX>(args, params);
+            case FunctionID::ABS:
+                return callFunction<FunctionID::ABS>(args, params);
+            case FunctionID::LOG:
+                return callFunction<FunctionID::LOG>(args, params);
+            case FunctionID::SIN:
+                return callFunction<FunctionID::SIN>(args, params);
+            case FunctionID::COS:
+                return callFunction<FunctionID::COS>(args, params);
+            case FunctionID::ATAN:
+                return callFunction<FunctionID::ATAN>(args, params);
+            case FunctionID::NOISE:
+                return callFunction<FunctionID::NOISE>(args, params);
+            case FunctionID::COLOR_NOISE:
+                return callFunction<FunctionID::COLOR_NOISE>(args, params);
+        }
+        // not a valid id
+        return Color{0};
+    }
+    
+
+    
+    // child positions of a node, see FunctionStorage::select(FunctionID, ChildSlot)
+    enum class ChildSlot {
+        LEFT, RIGHT
+    };
+    
+    /**
+     * A fixed weighted distribution over functions, sampled in constant time with Walker's alias method
+     */
+    class AliasTable {
+        private:
+            std::vector<FunctionID> values;
+            // chance a sample landing in a column keeps that column's value instead of taking its alias
+            std::vector<double> keep;
+            std::vector<unsigned int> alias;
+        public:
+            AliasTable() = default;
+            /**
+             * Functions with a weight of zero or less are never sampled
+             */
+            explicit AliasTable(const std::vector<std::pair<FunctionID, double>>& weights);
+            
+            [[nodiscard]] inline bool empty() const {
+                return values.empty();
             }
             
+            [[nodiscard]] inline FunctionID sample() const {
+                auto u = randomDouble(0, (double) values.size());
+                auto column = std::min((size_t) u, values.size() - 1);
+                return u - (double) column < keep[column] ? values[column] : values[alias[column]];
+            }
     };
     
+    /**
+     * Runtime state of the function table, the weights random selections are made with
+     */
     class FunctionStorage {
         private:
-            std::unordered_set<FunctionID> functionsInStorage;
-            Function** functions;
-            size_t size = 0;
+            // registered functions in id order
+            std::vector<FunctionID> registered;
+            std::vector<double> weights;
+            AliasTable table;
+            // functions allowed below each parent, indexed by parent id * 2 + slot
+            std::vector<AliasTable> childTables;
+            
+            void buildTables();
+            
+            [[nodiscard]] inline const AliasTable& childTable(FunctionID parent, ChildSlot slot) const {
+                return childTables[(size_t) parent * 2 + (size_t) slot];
+            }
         public:
-            FunctionStorage(std::initializer_list<std::pair<FunctionID, Function*>>&& init);
+            /**
+             * Registers every function in FUNCTION_TABLE with a weight of 1
+             */
+            FunctionStorage();
+            
+            [[nodiscard]] constexpr const Function& operator[](FunctionID id) const {
+                return FUNCTION_TABLE[(size_t) id];
+            }
+            
+            /**
+             * @return a random function, chosen with the current weights
+             */
+            [[nodiscard]] inline FunctionID select() const {
+                return table.sample();
+            }
             
-            [[nodiscard]] const Function& operator[](FunctionID id) const {
-                return *functions[(int)id];
+            /**
+             * @return a random function for the given child of parent, chosen with the current weights from the
+             * functions the parent accepts there. Only valid if accepts(parent, slot)
+             */
+            [[nodiscard]] inline FunctionID select(FunctionID parent, ChildSlot slot) const {
+                return childTable(parent, slot).sample();
             }
             
-            inline FunctionID select(){
-                auto first = functionsInStorage.begin();
-                std::advance(first, randomInt(0, (int)functionsInStorage.size()));
-                return *first;
+            /**
+             * @return true if parent takes any function in that slot
+             */
+            [[nodiscard]] inline bool accepts(FunctionID parent, ChildSlot slot) const {
+                return !childTable(parent, slot).empty();
             }
             
-            ~FunctionStorage(){
-                for (size_t i = 0; i < size; i++)
-                    delete functions[i];
-                delete[] functions;
+            /**
+             * Sets how likely a function is to be selected relative to the others, 1 by default and 0 to never select
+             * it. Rebuilds the selection tables so it must not be called while other threads are selecting.
+             * @return false if the weight is negative or would leave nothing to select
+             */
+            bool setWeight(FunctionID id, double weight);
+            
+            [[nodiscard]] inline double getWeight(FunctionID id) const {
+                return weights[(int)id];
             }
+            
+            /**
+             * @return true and the function's id in id if a function is registered under name
+             */
+            bool find(const std::string& name, FunctionID& id) const;
     };
     
-    inline FunctionStorage functions = {
-            {FunctionID::RAND_SCALAR, new Function{"RS", parks::genetic::randScalar, 1, 0, ARGS_NONE}},
-            {FunctionID::RAND_COLOR, new Function{"RC", parks::genetic::randColor, 0, 1, ARGS_NONE}},
-            {FunctionID::ADD, new Function{"+", parks::genetic::add, 0, 0, ARGS_BOTH | ARGS_SCALARS | ARGS_COLORS | ARGS_VARIABLES | ARGS_FUNCS}},
-            {FunctionID::SUBTRACT, new Function{"-", parks::genetic::subtract, 0, 0, ARGS_BOTH | ARGS_SCALARS | ARGS_COLORS | ARGS_VARIABLES | ARGS_FUNCS}},
-            {FunctionID::MULTIPLY, new Function{"*", parks::genetic::multiply, 0, 0, ARGS_BOTH | ARGS_SCALARS | ARGS_COLORS | ARGS_VARIABLES | ARGS_FUNCS}},
-            {FunctionID::DIVIDE, new Function{"/", parks::genetic::divide, 0, 0, ARGS_BOTH | ARGS_SCALARS | ARGS_COLORS | ARGS_VARIABLES | ARGS_FUNCS}},
-            {FunctionID::MOD, new Function{"%", parks::genetic::mod, 0, 0, ARGS_BOTH | ARGS_SCALARS | ARGS_COLORS | ARGS_VARIABLES | ARGS_FUNCS}},
-            {FunctionID::ROUND, new Function{"ROUND", parks::genetic::round, 0, 0, ARGS_SINGLE | ARGS_VARIABLES | ARGS_FUNCS}},
-            {FunctionID::MIN, new Function{"MIN", parks::genetic::min, 0, 0, ARGS_BOTH | ARGS_SCALARS | ARGS_COLORS | ARGS_VARIABLES | ARGS_FUNCS}},
-            {FunctionID::MAX, new Function{"MAX", parks::genetic::max, 0, 0, ARGS_BOTH | ARGS_SCALARS | ARGS_COLORS | ARGS_VARIABLES | ARGS_FUNCS}},
-            {FunctionID::ABS, new Function{"ABS", parks::genetic::abs, 0, 0, ARGS_SINGLE | ARGS_VARIABLES | ARGS_FUNCS}},
-            {FunctionID::LOG, new Function{"LOG", parks::genetic::log, 0, 0, ARGS_SINGLE | ARGS_SCALARS | ARGS_COLORS | ARGS_VARIABLES | ARGS_FUNCS}},
-            {FunctionID::SIN, new Function{"SIN", parks::genetic::sin, 0, 0, ARGS_SINGLE | ARGS_VARIABLES | ARGS_FUNCS}},
-            {FunctionID::COS, new Function{"COS", parks::genetic::cos, 0, 0, ARGS_SINGLE | ARGS_VARIABLES | ARGS_FUNCS}},
-            {FunctionID::ATAN, new Function{"ATAN", parks::genetic::atan, 0, 0, ARGS_SINGLE | ARGS_VARIABLES | ARGS_FUNCS}},
-            {FunctionID::NOISE, new Function{"Noise", parks::genetic::noise, 5, 0, ARGS_BOTH | ARGS_VARIABLES}},
-            {FunctionID::COLOR_NOISE, new Function{"ColorNoise", parks::genetic::colorNoise, 5, 0, ARGS_BOTH | ARGS_VARIABLES}},
-    };
+    inline FunctionStorage functions;
 
 }
 
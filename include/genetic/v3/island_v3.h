@@ -0,0 +1,102 @@
+//
+// Created by brett on 7/28/23.
+//
+
+#ifndef PARKSNREC_ISLAND_V3_H
+#define PARKSNREC_ISLAND_V3_H
+
+#include <genetic/v3/evolution_v3.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace parks::genetic {
+    
+    enum class Topology {
+        // island i sends to island i + 1, wrapping around
+        RING,
+        // every island sends to every other island
+        FULL
+    };
+    
+    struct IslandConfig {
+        size_t id = 0;
+        // host:port of every island indexed by id, this island listens on the port of its own entry
+        std::vector<std::string> addresses;
+        Topology topology = Topology::RING;
+        // generations between sending migrants
+        size_t migrationInterval = 10;
+        size_t migrants = 2;
+    };
+    
+    /**
+     * Connects one Population to the other islands of an island model over TCP, so islands can be separate
+     * processes on one machine or spread over several. Migration is asynchronous: migrants are sent to this
+     * island's destinations every migrationInterval generations and whatever has arrived replaces the worst members
+     * before the next generation. Islands should use the same fitness metrics so the scores they send compare.
+     */
+    class Island {
+        private:
+            IslandConfig config;
+            int listenSocket = -1;
+            std::thread listener;
+            std::atomic_bool running = false;
+            
+            std::mutex inboxMutex;
+            std::vector<std::pair<GeneticTree*, double>> inbox;
+            
+            // destinations which have accepted a connection before, and ones which have since gone away
+            std::vector<char> reached;
+            std::vector<char> gone;
+            size_t sent = 0;
+            std::atomic<size_t> received = 0;
+            
+            void listenLoop();
+            void receive(int connection);
+            bool send(size_t destination, const std::vector<unsigned char>& message);
+        public:
+            explicit Island(IslandConfig config);
+            
+            Island(const Island&) = delete;
+            Island& operator=(const Island&) = delete;
+            
+            /**
+             * Starts listening on this island's port
+             * @return false if the address is invalid or the port couldn't be bound
+             */
+            bool start();
+            
+            [[nodiscard]] std::vector<size_t> destinations() const;
+            
+            /**
+             * Sends copies of the population's fittest members if this generation is a migration generation
+             */
+            void emigrate(const Population& population);
+            /**
+             * Moves every migrant received so far into the population
+             * @return number of migrants added
+             */
+            size_t immigrate(Population& population);
+            
+            [[nodiscard]] inline size_t getSent() const {
+                return sent;
+            }
+            
+            [[nodiscard]] inline size_t getReceived() const {
+                return received;
+            }
+            
+            ~Island();
+    };
+    
+    /**
+     * Parses "host:port"
+     * @return false if there is no port
+     */
+    bool splitAddress(const std::string& address, std::string& host, uint16_t& port);
+    
+}
+
+#endif //PARKSNREC_ISLAND_V3_H
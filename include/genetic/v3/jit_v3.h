@@ -0,0 +1,108 @@
+//
+// Created by brett on 7/26/23.
+//
+
+#ifndef PARKSNREC_JIT_V3_H
+#define PARKSNREC_JIT_V3_H
+
+#include <genetic/v3/compiler_v3.h>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace parks::genetic {
+
+    /**
+     * One colour as seen by jitted code, r and g share the low SSE register and b sits in the high one
+     */
+    struct alignas(32) JitRegister {
+        double v[4];
+    };
+
+    /**
+     * Per-thread scratch space for a JitTree. Entry 0 holds x, entry 1 holds y, then one entry per instruction output
+     * followed by the current column and row table values.
+     */
+    struct JitState {
+        std::vector<JitRegister> registers;
+        const AxisTables* tables = nullptr;
+    };
+
+    /**
+     * Native x86-64 code generated from a CompiledTree. The arithmetic operators are emitted inline as packed SSE
+     * instructions working on all three channels at once, everything else (transcendentals, noise) calls back into
+     * the interpreter. The generated code must produce the same bits as the interpreter; compare with
+     * GeneticTree::compareBackends().
+     */
+    class JitTree {
+        private:
+            // keeps the functions used by callouts alive for as long as the code exists
+            std::shared_ptr<const CompiledTree> program;
+            void (* code)(JitRegister*, const JitRegister*, const CompiledTree*) = nullptr;
+            void* codePage = nullptr;
+            size_t codeSize = 0;
+            // masks followed by the program's constants
+            std::vector<JitRegister> constants;
+            bool bw = false;
+
+            [[nodiscard]] inline const JitRegister& fetch(Operand operand, const JitState& state) const {
+                switch (operand.type) {
+                    case OperandType::X:
+                        return state.registers[0];
+                    case OperandType::Y:
+                        return state.registers[1];
+                    case OperandType::SLOT:
+                        return state.registers[2 + operand.index];
+                    case OperandType::COLUMN:
+                        return state.registers[2 + program->slotCount() + operand.index];
+                    case OperandType::ROW:
+                        return state.registers[2 + program->slotCount() + program->getColumns().size() + operand.index];
+                    case OperandType::CONSTANT:
+                        return constants[3 + operand.index];
+                    default:
+                        return constants[0];
+                }
+            }
+        public:
+            explicit JitTree(std::shared_ptr<const CompiledTree> program);
+
+            JitTree(const JitTree&) = delete;
+            JitTree& operator=(const JitTree&) = delete;
+
+            /**
+             * @return true if this machine can run jitted code (x86-64 Linux with SSE4.1)
+             */
+            static bool supported();
+
+            /**
+             * @return false if code generation failed, in which case the interpreter must be used instead
+             */
+            [[nodiscard]] inline bool valid() const {
+                return code != nullptr;
+            }
+
+            /**
+             * @param tables built by CompiledTree::buildTables() for the image being rendered
+             */
+            void prepare(JitState& state, const AxisTables* tables) const;
+
+            /**
+             * Same contract as CompiledTree::executeBatch, one native call per pixel. Column and row table values are
+             * copied into the register file before each call.
+             */
+            void executeBatch(unsigned int x, unsigned int y, unsigned int width, unsigned int height, JitState& state, ColorBatch& out) const;
+
+            [[nodiscard]] inline bool resultIsBW() const {
+                return bw;
+            }
+
+            [[nodiscard]] inline size_t getCodeSize() const {
+                return codeSize;
+            }
+
+            ~JitTree();
+    };
+
+}
+
+#endif //PARKSNREC_JIT_V3_H
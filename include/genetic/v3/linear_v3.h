@@ -0,0 +1,140 @@
+//
+// Created by brett on 7/28/23.
+//
+
+#ifndef PARKSNREC_LINEAR_V3_H
+#define PARKSNREC_LINEAR_V3_H
+
+#include <genetic/v3/program_v3.h>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+namespace parks::genetic {
+
+    // bits of LinearNode::children
+    constexpr uint8_t LINEAR_LEFT = 1;
+    constexpr uint8_t LINEAR_RIGHT = 2;
+
+    /**
+     * One node of a LinearTree. Nodes are plain data so whole subtrees can be moved and copied with memcpy.
+     */
+    struct LinearNode {
+        FunctionID op;
+        // which children follow this node in the tree, LINEAR_LEFT and / or LINEAR_RIGHT
+        uint8_t children;
+        uint8_t parameterCount;
+        // first of this node's parameters in the tree's pool
+        uint32_t parameterIndex;
+        // number of nodes in the subtree rooted here, including this one
+        uint32_t size;
+    };
+    static_assert(std::is_trivially_copyable_v<LinearNode>);
+
+    /**
+     * A tree stored as an array of nodes in prefix order: each node is followed by its left subtree and then its
+     * right subtree, so every subtree is a contiguous span. Parameters live in one pool kept in the same order as the
+     * nodes, making a subtree's parameters contiguous as well. Unlike GeneticTree the storage only grows with the
+     * number of nodes, not with the height of the tree.
+     */
+    class LinearTree {
+        private:
+            std::vector<LinearNode> nodes;
+            std::vector<Color> parameters;
+
+            // every walk over the nodes is iterative, deep trees are what this layout is for and would overflow the stack
+            void generate(int maxDepth);
+            void appendFromTree(GeneticTree& tree, int pos);
+            /**
+             * @return the height of every node in the subtree rooted at node, indexed from node
+             */
+            [[nodiscard]] std::vector<int> heights(uint32_t node) const;
+            [[nodiscard]] int height(uint32_t node) const;
+            /**
+             * @return the subtree rooted at node in postorder, left subtrees before right ones
+             */
+            [[nodiscard]] std::vector<uint32_t> postorder(uint32_t node) const;
+            [[nodiscard]] ParameterSet parameterSet(uint32_t node) const;
+
+            // evaluate or compile a single node once its children are done
+            Color execute_node(double x, double y, uint32_t node, bool hasLeft, bool hasRight, Color leftC, Color rightC) const;
+            Operand compile_node(uint32_t node, bool hasLeft, bool hasRight, Operand leftO, Operand rightO, CompiledTree& program) const;
+        public:
+            LinearTree() = default;
+
+            /**
+             * @return a random tree built with GeneticTree's rules, except that functions which don't care about their
+             * arguments keep each child with a probability of 0.8 rather than always. At most maxDepth levels deep
+             */
+            static LinearTree random(int maxDepth);
+            static LinearTree fromTree(GeneticTree& tree);
+            /**
+             * @return the tree in GeneticTree's layout owned by the caller, or nullptr if it is taller than MAX_HEIGHT
+             */
+            [[nodiscard]] GeneticTree* toTree() const;
+
+            /**
+             * @return index of the node's left child, or -1 if it has none
+             */
+            [[nodiscard]] inline int64_t left(uint32_t node) const {
+                if (!(nodes[node].children & LINEAR_LEFT))
+                    return -1;
+                return node + 1;
+            }
+
+            /**
+             * @return index of the node's right child, or -1 if it has none
+             */
+            [[nodiscard]] inline int64_t right(uint32_t node) const {
+                if (!(nodes[node].children & LINEAR_RIGHT))
+                    return -1;
+                if (nodes[node].children & LINEAR_LEFT)
+                    return node + 1 + nodes[node + 1].size;
+                return node + 1;
+            }
+
+            /**
+             * @return a standalone copy of the subtree rooted at node
+             */
+            [[nodiscard]] LinearTree subtree(uint32_t node) const;
+            /**
+             * Replaces the subtree rooted at node with replacement. The node keeps its place as its parent's child.
+             */
+            void replaceSubtree(uint32_t node, const LinearTree& replacement);
+
+            /**
+             * Swaps a random subtree of this tree with a random subtree of other, at any depth
+             */
+            void crossover(LinearTree& other);
+            void mutate();
+
+            Color execute(double x, double y) const;
+            /**
+             * Same contract as GeneticTree::compile(), instruction node indices refer to positions in this tree
+             */
+            [[nodiscard]] CompiledTree compile() const;
+            /**
+             * Renders the tree with the interpreter, blocking until the image and scores are complete
+             */
+            void processImage(unsigned char* pixels, FitnessScores* scores = nullptr) const;
+
+            [[nodiscard]] inline size_t size() const {
+                return nodes.size();
+            }
+
+            [[nodiscard]] inline int depth() const {
+                return nodes.empty() ? 0 : height(0);
+            }
+
+            [[nodiscard]] inline const std::vector<LinearNode>& getNodes() const {
+                return nodes;
+            }
+
+            [[nodiscard]] inline const std::vector<Color>& getParameters() const {
+                return parameters;
+            }
+    };
+
+}
+
+#endif //PARKSNREC_LINEAR_V3_H
@@ -0,0 +1,115 @@
+//
+// Created by brett on 7/27/23.
+//
+
+#ifndef PARKSNREC_NOISE_CACHE_H
+#define PARKSNREC_NOISE_CACHE_H
+
+#include <genetic/v3/compiler_v3.h>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace parks::genetic {
+    
+    // default memory budget of the noise cache, a NOISE field at 512x512 is 1mb and a COLOR_NOISE field 3mb
+    constexpr size_t NOISE_CACHE_BUDGET = 128 * 1024 * 1024;
+    
+    /**
+     * Everything a noise instruction's output depends on
+     */
+    struct NoiseKey {
+        FunctionID op;
+        // only the first channel of each parameter is read
+        double params[5];
+        OperandType left, right;
+        unsigned int width, height;
+        
+        bool operator==(const NoiseKey& other) const;
+    };
+    
+    struct NoiseKeyHash {
+        size_t operator()(const NoiseKey& key) const;
+    };
+    
+    /**
+     * The noise fields used by one render
+     */
+    struct BoundNoise {
+        // one per instruction, see BatchState::noise
+        std::vector<NoiseBinding> bindings;
+        // keeps the fields being read alive even if the cache evicts them mid render
+        std::vector<std::shared_ptr<const NoiseField>> reading;
+        // fields which missed the cache, filled in while rendering and handed to NoiseCache::insert() once every
+        // tile is done
+        std::vector<std::pair<NoiseKey, std::shared_ptr<NoiseField>>> pending;
+    };
+    
+    /**
+     * Least recently used cache of full resolution noise fields. Noise nodes only read x and y so their output only
+     * depends on their parameters, which tend to survive mutation and crossover unchanged.
+     */
+    class NoiseCache {
+        private:
+            typedef std::list<std::pair<NoiseKey, std::shared_ptr<const NoiseField>>> entry_list;
+            
+            // most recently used at the front
+            entry_list entries;
+            std::unordered_map<NoiseKey, entry_list::iterator, NoiseKeyHash> index;
+            size_t usedBytes = 0;
+            size_t budget;
+            std::mutex mutex;
+            
+            std::atomic<size_t> hits{0};
+            std::atomic<size_t> misses{0};
+            
+            void evict();
+        public:
+            explicit NoiseCache(size_t budget = NOISE_CACHE_BUDGET): budget(budget) {}
+            
+            /**
+             * @return true if the instruction's output can be cached, it must be noise reading only x and y
+             */
+            static bool cacheable(const Instruction& ins);
+            
+            /**
+             * Looks up every cacheable instruction of a program for a width * height render
+             */
+            BoundNoise bind(const CompiledTree& program, unsigned int width, unsigned int height);
+            
+            /**
+             * Adds the fields a finished render filled in, evicting the least recently used ones to stay within budget
+             */
+            void insert(BoundNoise& render);
+            
+            void clear();
+            void setBudget(size_t bytes);
+            
+            [[nodiscard]] inline size_t getHits() const {
+                return hits;
+            }
+            
+            [[nodiscard]] inline size_t getMisses() const {
+                return misses;
+            }
+            
+            [[nodiscard]] size_t size();
+            [[nodiscard]] size_t bytes();
+            
+            [[nodiscard]] inline size_t getBudget() const {
+                return budget;
+            }
+            
+            /**
+             * @return the cache shared by every render
+             */
+            static NoiseCache& get();
+    };
+    
+}
+
+#endif //PARKSNREC_NOISE_CACHE_H
@@ -0,0 +1,100 @@
+//
+// Created by brett on 7/27/23.
+//
+
+#ifndef PARKSNREC_NOISE_V3_H
+#define PARKSNREC_NOISE_V3_H
+
+#include <genetic/v3/functions_v3.h>
+#include <cstddef>
+#include <vector>
+
+// defined next to the stb perlin implementation in perlin.cpp
+const unsigned char* stb_perlin_randtab();
+const unsigned char* stb_perlin_randtab_grad_idx();
+
+namespace parks::genetic {
+    
+    // number of points turbulenceNoise() evaluates per call, one AVX2 register of floats
+    constexpr unsigned int NOISE_LANES = 8;
+    
+    /**
+     * stb_perlin_turbulence_noise3 for NOISE_LANES points at once, producing exactly the same bits as calling stb for
+     * each point (the arithmetic is done in the same order and neither version may be built with FMA contraction).
+     * Without AVX2 this simply calls stb for each point.
+     * @param x, y, z NOISE_LANES coordinates each
+     * @param out receives NOISE_LANES results
+     */
+    void turbulenceNoise(const float* x, const float* y, const float* z, float lacunarity, float gain, int octaves, float* out);
+    
+    /**
+     * The full resolution output of one NOISE or COLOR_NOISE instruction. Values are stored as floats, which is exact
+     * since turbulence is computed in single precision and the normalization of colors doesn't add any bits.
+     */
+    struct NoiseField {
+        unsigned int width = 0, height = 0;
+        // one value per pixel, g and b are only used by COLOR_NOISE
+        std::vector<float> r, g, b;
+        
+        NoiseField(unsigned int width, unsigned int height, bool color): width(width), height(height), r(width * height) {
+            if (color) {
+                g.resize(width * height);
+                b.resize(width * height);
+            }
+        }
+        
+        [[nodiscard]] inline size_t bytes() const {
+            return (r.size() + g.size() + b.size()) * sizeof(float);
+        }
+        
+        template<typename T>
+        inline void load(unsigned int x, unsigned int y, BasicColorBatch<T>& out) const {
+            auto count = std::min(BATCH_SIZE, width - x);
+            auto offset = (size_t) y * width + x;
+            for (unsigned int i = 0; i < count; i++) {
+                out.r[i] = r[offset + i];
+                out.g[i] = g.empty() ? 0 : g[offset + i];
+                out.b[i] = b.empty() ? 0 : b[offset + i];
+            }
+        }
+        
+        template<typename T>
+        inline void store(unsigned int x, unsigned int y, const BasicColorBatch<T>& in) {
+            auto count = std::min(BATCH_SIZE, width - x);
+            auto offset = (size_t) y * width + x;
+            for (unsigned int i = 0; i < count; i++) {
+                r[offset + i] = (float) in.r[i];
+                if (!g.empty()) {
+                    g[offset + i] = (float) in.g[i];
+                    b[offset + i] = (float) in.b[i];
+                }
+            }
+        }
+    };
+    
+    /**
+     * Where one instruction of a render reads its noise from (a cached field) or writes it to (a field being filled
+     * for the cache). Both are null for instructions which aren't cached noise.
+     */
+    struct NoiseBinding {
+        const NoiseField* read = nullptr;
+        NoiseField* write = nullptr;
+    };
+    
+    struct NoiseBenchmark {
+        size_t points = 0;
+        double stbNanosPerPoint = 0;
+        double batchNanosPerPoint = 0;
+        // points where the two implementations disagree, and the largest disagreement
+        size_t mismatches = 0;
+        float maxError = 0;
+    };
+    
+    /**
+     * Times stb_perlin_turbulence_noise3 against turbulenceNoise() on the same random points and parameters
+     */
+    NoiseBenchmark benchmarkNoise(size_t points);
+    
+}
+
+#endif //PARKSNREC_NOISE_V3_H
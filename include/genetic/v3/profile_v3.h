@@ -0,0 +1,110 @@
+//
+// Created by brett on 7/28/23.
+//
+
+#ifndef PARKSNREC_PROFILE_V3_H
+#define PARKSNREC_PROFILE_V3_H
+
+#include <genetic/v3/functions_v3.h>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+#endif
+
+namespace parks::genetic {
+
+    class CompiledTree;
+
+    /**
+     * @return true if the interpreter was built with PARKSNREC_OP_PROFILE (the ENABLE_OP_PROFILE cmake option).
+     * Without it the interpreter contains no profiling code and every profile stays empty.
+     */
+    constexpr bool operatorProfilingEnabled() {
+#ifdef PARKSNREC_OP_PROFILE
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    /**
+     * @return a cheap monotonic timestamp, the tsc on x86 and nanoseconds elsewhere
+     */
+    inline uint64_t cycleCount() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    struct OperatorCost {
+        // one per pixel the operator was evaluated for, a batch counts BATCH_SIZE
+        uint64_t calls = 0;
+        uint64_t cycles = 0;
+
+        inline OperatorCost& operator+=(const OperatorCost& other) {
+            calls += other.calls;
+            cycles += other.cycles;
+            return *this;
+        }
+    };
+
+    struct NodeCost {
+        FunctionID op;
+        OperatorCost cost;
+    };
+
+    /**
+     * Where the batch interpreter spent its time during one render, by FunctionID and by the tree node each
+     * instruction was lowered from. Operators folded into constants at compile time never run and don't appear.
+     * JIT renders aren't profiled.
+     */
+    class OperatorProfile {
+        public:
+            // indexed by FunctionID
+            std::array<OperatorCost, FUNCTION_COUNT> functions{};
+            // keyed by heap position for a GeneticTree, node index for a LinearTree
+            std::map<unsigned int, NodeCost> nodes;
+            unsigned int width = 0, height = 0;
+
+            /**
+             * Adds the costs a batch state collected while running program, one per instruction
+             */
+            void add(const CompiledTree& program, const std::vector<OperatorCost>& costs);
+
+            [[nodiscard]] uint64_t totalCycles() const;
+
+            [[nodiscard]] inline bool empty() const {
+                return nodes.empty();
+            }
+
+            /**
+             * Writes one line per node followed by one per function, with a header row
+             */
+            void writeCsv(std::ostream& out) const;
+            /**
+             * @return false if the file couldn't be written
+             */
+            bool writeCsv(const std::string& path) const;
+
+            /**
+             * Replaces the profile returned by last(), called once a profiled render has finished
+             */
+            static void publish(OperatorProfile profile);
+            /**
+             * @return a copy of the most recently finished profiled render's profile
+             */
+            static OperatorProfile last();
+    };
+
+}
+
+#endif //PARKSNREC_PROFILE_V3_H
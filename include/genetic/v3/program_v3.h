@@ -6,7 +6,13 @@
 #define PARKSNREC_PROGRAM_V3_H
 
 #include <genetic/v3/functions_v3.h>
-#include "ImNodesEz.h"
+#include <genetic/v3/arena_v3.h>
+#include <genetic/v3/compiler_v3.h>
+#include <genetic/v3/render_pool.h>
+#include <genetic/v3/jit_v3.h>
+#include <genetic/v3/noise_v3.h>
+#include <genetic/v3/noise_cache.h>
+#include <genetic/v3/fitness_v3.h>
 
 namespace parks::genetic {
     
@@ -14,15 +20,81 @@ namespace parks::genetic {
         FunctionID op;
         unsigned int pos{};
         ParameterSet set;
+        // arena the node was allocated from, nullptr for the heap
+        GenerationArena* arena = treeArena();
         
         GeneticNode(FunctionID op, unsigned int pos, ParameterSet set);
+        
+        // nodes come from the thread's tree arena when there is one, see ArenaScope
+        static void* operator new(size_t size);
+        static void operator delete(GeneticNode* node, std::destroying_delete_t);
+        // only used by new when the constructor throws, delete expressions always take the destroying delete
+        static void operator delete(void* p, size_t size);
+    };
+    
+    // tallest tree stored in the pointer layout, whose array holds 2^MAX_HEIGHT + 1 slots however few nodes exist
+    constexpr int MAX_HEIGHT = 16;
+    
+    // a tile is the unit of work handed to the render pool, sized so a tile's pixels stay in cache. A row of tiles
+    // is one band of the banded fitness metrics
+    constexpr unsigned int TILE_WIDTH = BATCH_SIZE;
+    constexpr unsigned int TILE_HEIGHT = FITNESS_BAND_HEIGHT;
+    
+    enum class RenderBackend {
+        INTERPRETER, JIT
+    };
+    
+    // precision the interpreter evaluates a render in, the JIT is always double precision
+    enum class Precision {
+        DOUBLE, FLOAT
+    };
+    
+    // largest per channel difference between a float and a double render which still counts as the same pixel
+    constexpr int FLOAT_CHANNEL_TOLERANCE = 1;
+    // fraction of pixels which may fall outside FLOAT_CHANNEL_TOLERANCE. operators such as mod, round and the
+    // wrap around in Color can turn a tiny rounding difference into a completely different value
+    constexpr double FLOAT_PIXEL_TOLERANCE = 0.01;
+    
+    /**
+     * Differences between the 8 bit images rendered in float and in double precision
+     */
+    struct PrecisionReport {
+        long differentPixels = 0;
+        long outsideTolerance = 0;
+        int maxDifference = 0;
+        
+        [[nodiscard]] inline bool withinTolerance() const {
+            return (double) outsideTolerance <= FLOAT_PIXEL_TOLERANCE * WIDTH * HEIGHT;
+        }
     };
     
+    /**
+     * Starts rendering a compiled program into a width * height image on the shared render pool, with the same
+     * contract as GeneticTree::beginProcessImage(). The jit is used when given, otherwise the interpreter in the
+     * given precision.
+     */
+    void renderProgram(std::shared_ptr<const CompiledTree> program, std::shared_ptr<const JitTree> jit, unsigned char* pixels, unsigned int width,
+                       unsigned int height, Precision precision, FitnessScores* scores);
+    
+    class LinearTree;
+    
     class GeneticTree {
+        friend class LinearTree;
         private:
             GeneticNode** nodes;
             int size = 1;
             int max_height;
+            // arena the tree was built in, which its node array comes from. nullptr for the heap
+            GenerationArena* arena = treeArena();
+            
+            // compiled forms of the tree, dropped whenever the tree changes
+            std::shared_ptr<const CompiledTree> compiledCache;
+            std::shared_ptr<const JitTree> jitCache;
+            
+            inline void invalidateCache() {
+                compiledCache = nullptr;
+                jitCache = nullptr;
+            }
             
             static size_t getPixelPosition(unsigned int x, unsigned int y){
                 return x * CHANNELS + y * WIDTH * CHANNELS;
@@ -33,16 +105,17 @@ namespace parks::genetic {
             void generateRandomTree(int n);
             
             Color execute_internal(double x, double y, int node);
+            Operand compile_internal(int node, CompiledTree& program) const;
+            
+            void beginRender(unsigned char* pixels, unsigned int width, unsigned int height, RenderBackend backend, Precision precision,
+                             FitnessScores* scores);
         public:
             explicit GeneticTree(GeneticNode** nodes, int size): nodes(nodes), size(size), max_height(size) { }
             explicit GeneticTree(int max_height): max_height(max_height) {
                 for (int i = 0; i < max_height; i++)
                     size *= 2;
                 size += 1;
-                nodes = new GeneticNode*[size];
-                
-                for (int i = 0; i < size; i++)
-                    nodes[i] = nullptr;
+                nodes = allocateNodes(size);
                 
                 //nodes[0] = new GeneticNode(FunctionID::ADD, 0, functions[FunctionID::ADD].generateRandomParameters());
                 
@@ -51,6 +124,21 @@ namespace parks::genetic {
             
             Color execute(double x, double y);
             
+            /**
+             * Lowers the tree into a flat instruction stream. The result is independent of this tree and
+             * produces the same colors as execute() for every pixel.
+             */
+            [[nodiscard]] CompiledTree compile() const;
+            
+            /**
+             * @return the compiled tree, cached until the tree is next modified
+             */
+            std::shared_ptr<const CompiledTree> getCompiled();
+            /**
+             * @return native code for the tree, cached until the tree is next modified. nullptr if jitting isn't possible
+             */
+            std::shared_ptr<const JitTree> getJit();
+            
             static inline int left(int pos){
                 return 2 * (pos + 1);
             }
@@ -86,17 +174,68 @@ namespace parks::genetic {
             static int height(int node);
             [[nodiscard]] int subtreeSize(int n) const;
             
+            /**
+             * @return an array of count null node pointers from the thread's tree arena or the heap, counted under
+             * memory::Tag::GENETIC_NODE_ARRAYS. Freed with freeNodes(), passing the arena it came from
+             */
+            static GeneticNode** allocateNodes(size_t count);
+            static void freeNodes(GeneticNode** nodes, size_t count, GenerationArena* arena = treeArena());
+            
             void deleteSubtree(int n);
             std::pair<GeneticNode**, size_t> moveSubtree(int n);
             void insertSubtree(int n, GeneticNode** tree, size_t size);
             GeneticNode** copySubtree(int n);
             
-            void processImage(unsigned char* pixels);
+            /**
+             * Renders the tree into pixels using the shared render pool, blocking until the image is complete.
+             * If scores is given every metric in it is scored as well.
+             */
+            void processImage(unsigned char* pixels, RenderBackend backend = RenderBackend::INTERPRETER, Precision precision = Precision::DOUBLE,
+                              FitnessScores* scores = nullptr);
+            /**
+             * Renders a width * height image with the interpreter, blocking until it and scores are complete. Pixel
+             * (x, y) samples the same point as pixel (x * WIDTH / width, y * HEIGHT / height) of a full render.
+             */
+            void processImage(unsigned char* pixels, unsigned int width, unsigned int height, FitnessScores* scores = nullptr);
+            /**
+             * Starts rendering the tree into pixels on the shared render pool and returns immediately. The tree may be
+             * modified or deleted while rendering but pixels must stay valid until RenderPool::get().wait() returns.
+             * Falls back to the interpreter if the JIT backend is requested but unavailable. The precision only applies
+             * to the interpreter.
+             * Fused and banded metrics in scores are reduced as the tiles are rendered and are valid once the pool is
+             * done, whole image metrics must be scored afterwards with evaluatePostMetrics(). scores must stay valid as long as pixels.
+             */
+            void beginProcessImage(unsigned char* pixels, RenderBackend backend = RenderBackend::INTERPRETER, Precision precision = Precision::DOUBLE,
+                                   FitnessScores* scores = nullptr);
+            /**
+             * Evaluates every pixel with both the interpreter and the JIT and compares the unquantised colors.
+             * NaNs compare equal regardless of payload since they all produce the same pixel.
+             * @return number of mismatching pixels, or -1 if the JIT is unavailable
+             */
+            long compareBackends();
+            /**
+             * Renders the tree with the interpreter in both precisions and compares the 8 bit output. Blocks until
+             * both renders are done.
+             */
+            PrecisionReport comparePrecision();
+            /**
+             * @return fitness of a rendered image, see evaluateFitness()
+             */
             static double evaluate(const unsigned char* pixels);
+            /**
+             * The original single threaded fitness, comparing every pixel's neighbourhood one byte at a time.
+             * Kept to check evaluate() against, which must match it bit for bit.
+             */
+            static double evaluateReference(const unsigned char* pixels);
+            /**
+             * Scores every metric in scores for an already rendered image, giving the same values as rendering with them.
+             */
+            static void evaluate(const unsigned char* pixels, FitnessScores& scores, unsigned int width = WIDTH, unsigned int height = HEIGHT);
             
             double evaluate();
             
             void deleteTree(){
+                invalidateCache();
                 for (int i = 0; i < size; i++) {
                     delete nodes[i];
                     nodes[i] = nullptr;
@@ -107,56 +246,64 @@ namespace parks::genetic {
                 return size;
             }
             
+            /**
+             * @return the arena the tree was built in, nullptr if it is on the heap
+             */
+            [[nodiscard]] inline GenerationArena* getArena() const {
+                return arena;
+            }
+            
+            /**
+             * Drops the nodes and the node array without freeing them, they are reclaimed in bulk when the arena is
+             * released. Only for trees built entirely in an arena that is about to be released, leaves the tree empty.
+             */
+            void abandonNodes() {
+                invalidateCache();
+                nodes = nullptr;
+                size = 0;
+            }
+            
+            /**
+             * @return nodes the tree holds, every one of them counted live under memory::Tag::GENETIC_NODES
+             */
+            [[nodiscard]] inline size_t nodeCount() const {
+                size_t count = 0;
+                for (int i = 0; i < size; i++)
+                    count += nodes[i] != nullptr;
+                return count;
+            }
+            
             void mutate();
             
             void crossover(GeneticTree* other);
             
+            /**
+             * @return a new child of the two parents, which are left unchanged. Crossover and mutation happen with
+             * crossoverChance and mutationChance
+             */
             static GeneticTree* breed(GeneticTree* parent1, GeneticTree* parent2);
             
-            ~GeneticTree(){
-                deleteTree();
-                delete[] nodes;
-            }
-    };
-    
-    class Program {
-        private:
-            struct ImNode_t
-            {
-                int height{};
-                int index{};
-                FunctionID id;
-                ImVec2 pos{};
-                bool selected{};
-                ImNodes::Ez::SlotInfo inputs[1]{};
-                ImNodes::Ez::SlotInfo outputs[2]{};
-            };
-            std::vector<ImNode_t> treeNodes;
-            
-            unsigned char pixels[WIDTH * HEIGHT * CHANNELS];
-            GeneticTree* tree;
-            GeneticTree* last_tree = nullptr;
-            GeneticTree* saved_tree = nullptr;
-            
-            void regenTreeDisplay();
-            
-            float renderProgress = 0;
-        public:
-            Program() = default;
-            
-            void run();
-            void draw();
-        
-            [[nodiscard]] float getRenderProgress() const{
-                return renderProgress;
-            }
+            /**
+             * @return a deep copy of this tree, owned by the caller
+             */
+            GeneticTree* copy();
             
-            inline unsigned char* getPixels(){
-                return pixels;
-            }
+            /**
+             * Appends a binary encoding of the tree to out, read back with deserialize(). Doubles are stored in the
+             * machine's byte order, so the encoding is only portable between machines of the same architecture.
+             */
+            void serialize(std::vector<unsigned char>& out) const;
+            /**
+             * Reads a tree written by serialize() starting at data[offset], advancing offset past it. The data may come
+             * from an untrusted peer: trees without a root, taller than MAX_HEIGHT or with nodes missing their parent
+             * are rejected.
+             * @return the tree owned by the caller, or nullptr if the data is truncated or malformed
+             */
+            static GeneticTree* deserialize(const std::vector<unsigned char>& data, size_t& offset);
             
-            ~Program(){
-                delete tree;
+            ~GeneticTree(){
+                deleteTree();
+                freeNodes(nodes, size, arena);
             }
     };
     
@@ -0,0 +1,104 @@
+//
+// Created by brett on 7/25/23.
+//
+
+#ifndef PARKSNREC_RENDER_POOL_H
+#define PARKSNREC_RENDER_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace parks::genetic {
+
+    /**
+     * Persistent pool of worker threads which runs one job at a time. A job is a number of independent tasks, the task
+     * indices are split evenly between the workers up front and workers which run out of tasks steal half of the
+     * remaining range from another worker.
+     */
+    class RenderPool {
+        public:
+            // called with the task index and the index of the worker running it
+            typedef std::function<void(size_t, size_t)> task_func;
+        private:
+            // packed [begin, end) range of task indices, begin in the upper 32 bits. Only ever modified by CAS
+            // (or by the owner when it is empty) so stealing never needs a lock
+            struct alignas(64) WorkQueue {
+                std::atomic<uint64_t> range{0};
+            };
+
+            std::vector<std::thread> workers;
+            std::unique_ptr<WorkQueue[]> queues;
+
+            task_func job;
+            std::atomic<size_t> totalTasks{0};
+            std::atomic<size_t> completedTasks{0};
+
+            std::mutex jobMutex;
+            std::condition_variable jobStarted;
+            std::condition_variable jobFinished;
+            uint64_t jobGeneration = 0;
+            size_t activeWorkers = 0;
+            bool running = true;
+
+            static inline uint64_t pack(uint64_t begin, uint64_t end) {
+                return (begin << 32) | end;
+            }
+
+            bool pop(size_t worker, size_t& task);
+            bool steal(size_t worker);
+            void workerLoop(size_t worker);
+        public:
+            /**
+             * @param threads number of workers, 0 uses the number of hardware threads
+             */
+            explicit RenderPool(size_t threads = 0);
+
+            RenderPool(const RenderPool&) = delete;
+            RenderPool& operator=(const RenderPool&) = delete;
+
+            /**
+             * Starts running func for every task in [0, tasks) and returns immediately.
+             * Waits for the previous job to finish first.
+             */
+            void dispatch(size_t tasks, task_func func);
+
+            /**
+             * Blocks until the current job (if any) has finished
+             */
+            void wait();
+
+            [[nodiscard]] bool busy();
+
+            /**
+             * @return fraction of the tasks in the current or last job which have completed
+             */
+            [[nodiscard]] float progress() const;
+
+            [[nodiscard]] inline size_t threadCount() const {
+                return workers.size();
+            }
+
+            /**
+             * @return the pool shared by the renderer, sized to the machine's core count unless setSharedThreads() was
+             * called first
+             */
+            static RenderPool& get();
+            
+            /**
+             * Sets how many workers the shared pool starts with. Only has an effect before the first call to get(), for
+             * when several processes share one machine.
+             */
+            static void setSharedThreads(size_t threads);
+
+            ~RenderPool();
+    };
+
+}
+
+#endif //PARKSNREC_RENDER_POOL_H
@@ -0,0 +1,60 @@
+//
+// Created by brett on 7/28/23.
+//
+
+#ifndef PARKSNREC_SCREENING_V3_H
+#define PARKSNREC_SCREENING_V3_H
+
+#include <genetic/v3/fitness_v3.h>
+#include <vector>
+
+namespace parks::genetic {
+    
+    class GeneticTree;
+    
+    /**
+     * One low resolution pass. Candidates scoring above the percentile of this pass move on to the next.
+     */
+    struct ScreeningStage {
+        unsigned int resolution;
+        double percentile;
+    };
+    
+    struct ScreeningConfig {
+        // lowest resolution first, every resolution should divide WIDTH so the samples line up with the full render
+        std::vector<ScreeningStage> stages{{32, 0.5}, {128, 0.5}};
+        // the score is the combined() value of these metrics
+        FitnessScores metrics{MetricID::SIMILARITY};
+    };
+    
+    struct ScreeningReport {
+        size_t candidates = 0;
+        // candidates left after each stage, the last entry is the number rendered at full resolution
+        std::vector<size_t> survivors;
+        // wall time spent screening, including the full resolution renders of the survivors
+        double screenedSeconds = 0;
+        
+        // only filled in when measured. every candidate is scored at every resolution to find how well each
+        // stage's scores correlate (pearson) with the full resolution score and how long scoring everything would take
+        bool measured = false;
+        std::vector<double> correlation;
+        double fullSeconds = 0;
+        
+        [[nodiscard]] inline double savedSeconds() const {
+            return fullSeconds - screenedSeconds;
+        }
+    };
+    
+    /**
+     * Scores a generation, rendering most candidates only at the low resolutions of the config's stages. Blocks and
+     * uses the render pool.
+     * @param fitness receives the full resolution score of each candidate, -infinity for candidates which were rejected
+     * @param measure also render the rejected candidates to fill in the correlation and full time of the report.
+     * The screening time is then the time the screened renders took, as if the others weren't done
+     */
+    ScreeningReport screenCandidates(const std::vector<GeneticTree*>& candidates, std::vector<double>& fitness,
+                                     const ScreeningConfig& config = {}, bool measure = false);
+    
+}
+
+#endif //PARKSNREC_SCREENING_V3_H
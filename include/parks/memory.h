@@ -0,0 +1,92 @@
+//
+// Created by brett on 7/28/23.
+//
+
+#ifndef PARKSNREC_MEMORY_H
+#define PARKSNREC_MEMORY_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace parks::memory {
+
+    /**
+     * What an allocation is for. Every tag belongs to one subsystem, see subsystemName()
+     */
+    enum class Tag {
+        // genetic
+        GENETIC_NODES, GENETIC_NODE_ARRAYS,
+        // resources
+        TEXTURE_DECODE,
+        // renderer, memory owned by the gl driver
+        GL_TEXTURES, GL_BUFFERS
+    };
+    constexpr size_t TAG_COUNT = (size_t) Tag::GL_BUFFERS + 1;
+
+    struct TagStats {
+        uint64_t allocations = 0;
+        uint64_t frees = 0;
+        // every byte ever allocated
+        uint64_t bytes = 0;
+        uint64_t liveBytes = 0;
+        uint64_t peakBytes = 0;
+
+        [[nodiscard]] inline uint64_t live() const {
+            // the counters are read one at a time while other threads keep allocating
+            return allocations > frees ? allocations - frees : 0;
+        }
+    };
+
+    namespace detail {
+        struct alignas(64) Counters {
+            std::atomic<uint64_t> allocations{0};
+            std::atomic<uint64_t> frees{0};
+            std::atomic<uint64_t> bytes{0};
+            std::atomic<uint64_t> liveBytes{0};
+            std::atomic<uint64_t> peakBytes{0};
+        };
+
+        // indexed by Tag
+        extern Counters counters[TAG_COUNT];
+    }
+
+    /**
+     * Counts an allocation made at a tagged site. Lock free, just a few relaxed atomic adds.
+     */
+    inline void allocated(Tag tag, size_t bytes) {
+        auto& c = detail::counters[(size_t) tag];
+        c.allocations.fetch_add(1, std::memory_order_relaxed);
+        c.bytes.fetch_add(bytes, std::memory_order_relaxed);
+        auto live = c.liveBytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+        auto peak = c.peakBytes.load(std::memory_order_relaxed);
+        while (live > peak && !c.peakBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed));
+    }
+
+    /**
+     * Counts the release of count allocations counted with allocated(), bytes must match their total
+     */
+    inline void freed(Tag tag, size_t bytes, uint64_t count = 1) {
+        auto& c = detail::counters[(size_t) tag];
+        c.frees.fetch_add(count, std::memory_order_relaxed);
+        c.liveBytes.fetch_sub(bytes, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] TagStats stats(Tag tag);
+    /**
+     * Lowers every peak to what is live now, so a later peak can be told apart from startup
+     */
+    void resetPeaks();
+
+    const char* tagName(Tag tag);
+    const char* subsystemName(Tag tag);
+
+    /**
+     * @return one line per tag which has seen an allocation, for logs and run summaries
+     */
+    [[nodiscard]] std::string summary();
+
+}
+
+#endif //PARKSNREC_MEMORY_H
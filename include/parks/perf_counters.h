@@ -0,0 +1,142 @@
+//
+// Created by brett on 7/28/23.
+//
+
+#ifndef PARKSNREC_PERF_COUNTERS_H
+#define PARKSNREC_PERF_COUNTERS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace parks::perf {
+
+    enum class Phase {
+        RENDER, FITNESS, UPLOAD
+    };
+    constexpr size_t PHASE_COUNT = (size_t) Phase::UPLOAD + 1;
+
+    enum class Counter {
+        CYCLES, INSTRUCTIONS, L1D_MISSES, LLC_MISSES, BRANCH_MISSES
+    };
+    constexpr size_t COUNTER_COUNT = (size_t) Counter::BRANCH_MISSES + 1;
+
+    /**
+     * Everything measured in one phase, summed over every thread which worked on it. Counters only count user space
+     * and only on the thread inside the scope, so a thread blocked waiting on others adds nothing.
+     */
+    struct PhaseTotals {
+        uint64_t calls = 0;
+        // thread time, a phase running on 8 threads at once adds up 8 times as fast as the clock on the wall
+        uint64_t nanoseconds = 0;
+        // calls during which the counters were on the cpu for at least part of the time, only these add to counters
+        uint64_t countedCalls = 0;
+        // how long the counters were enabled and actually counting over the counted calls. When the kernel multiplexes
+        // the group running is shorter and counters are scaled up from the part that was counted
+        uint64_t enabledNanoseconds = 0;
+        uint64_t runningNanoseconds = 0;
+        uint64_t counters[COUNTER_COUNT]{};
+
+        [[nodiscard]] inline uint64_t get(Counter counter) const {
+            return counters[(size_t) counter];
+        }
+
+        /**
+         * @return false if the phase ran but the counters never got on the cpu, eg when the NMI watchdog holds a counter
+         */
+        [[nodiscard]] inline bool scheduled() const {
+            return countedCalls > 0;
+        }
+        
+        /**
+         * @return the share of the enabled time the counters were counting, below 1 means the counts are estimates
+         */
+        [[nodiscard]] inline double runningFraction() const {
+            return enabledNanoseconds == 0 ? 0 : (double) runningNanoseconds / (double) enabledNanoseconds;
+        }
+        
+        [[nodiscard]] inline double instructionsPerCycle() const {
+            auto cycles = get(Counter::CYCLES);
+            return cycles == 0 ? 0 : (double) get(Counter::INSTRUCTIONS) / (double) cycles;
+        }
+
+        /**
+         * @return misses of counter per thousand instructions
+         */
+        [[nodiscard]] inline double perKiloInstruction(Counter counter) const {
+            auto instructions = get(Counter::INSTRUCTIONS);
+            return instructions == 0 ? 0 : 1000.0 * (double) get(counter) / (double) instructions;
+        }
+    };
+
+    namespace detail {
+        extern std::atomic<bool> enabled;
+    }
+
+    /**
+     * Starts or stops measuring. Counters are opened on each thread the first time it enters a phase while enabled.
+     */
+    void setEnabled(bool enabled);
+
+    [[nodiscard]] inline bool enabled() {
+        return detail::enabled.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @return true if the calling thread could open the hardware counters. When false only calls and time are measured.
+     */
+    [[nodiscard]] bool available();
+    /**
+     * @return why the counters couldn't be opened, empty if they could
+     */
+    [[nodiscard]] std::string unavailableReason();
+    /**
+     * @return false if the cpu or kernel doesn't provide this counter, its totals stay 0
+     */
+    [[nodiscard]] bool supported(Counter counter);
+
+    [[nodiscard]] PhaseTotals totals(Phase phase);
+    void reset();
+
+    const char* phaseName(Phase phase);
+    const char* counterName(Counter counter);
+
+    /**
+     * @return one line per phase which has been entered, for logs and run summaries
+     */
+    [[nodiscard]] std::string summary();
+
+    /**
+     * Adds the counters and time of the calling thread between construction and destruction to a phase. Scopes nested
+     * inside another on the same thread are ignored so nothing is counted twice. When measuring is disabled this is a
+     * single relaxed load.
+     */
+    class Scope {
+        private:
+            Phase phase;
+            bool active = false;
+            uint64_t begin = 0;
+            uint64_t values[COUNTER_COUNT]{};
+            uint64_t enabledTime = 0, runningTime = 0;
+
+            void start();
+            void finish();
+        public:
+            explicit Scope(Phase phase): phase(phase) {
+                if (enabled())
+                    start();
+            }
+
+            Scope(const Scope&) = delete;
+            Scope& operator=(const Scope&) = delete;
+
+            ~Scope() {
+                if (active)
+                    finish();
+            }
+    };
+
+}
+
+#endif //PARKSNREC_PERF_COUNTERS_H
@@ -12,6 +12,7 @@
 #include <string>
 #include <unordered_map>
 #include <stb/stb_image.h>
+#include <parks/memory.h>
 
 namespace parks {
     
@@ -21,6 +22,8 @@ namespace parks {
             struct {
                 int width = 0, height = 0, channels = 4;
             } textureInfo;
+            // what the driver holds for the current storage, counted under memory::Tag::GL_TEXTURES
+            size_t allocatedBytes = 0;
         public:
             GLTexture2D() {
                 glGenTextures(1, &textureID);
@@ -35,6 +38,10 @@ namespace parks {
                 bind();
                 glTexImage2D(GL_TEXTURE_2D, 0, storage_type, width, height, 0, storage_type, type,
                              nullptr);
+                if (allocatedBytes != 0)
+                    memory::freed(memory::Tag::GL_TEXTURES, allocatedBytes);
+                allocatedBytes = (size_t) width * height * channels * (type == GL_FLOAT ? sizeof(float) : 1);
+                memory::allocated(memory::Tag::GL_TEXTURES, allocatedBytes);
                 textureInfo.width = width;
                 textureInfo.height = height;
                 textureInfo.channels = channels;
@@ -53,6 +60,8 @@ namespace parks {
             
             ~GLTexture2D() {
                 glDeleteTextures(1, &textureID);
+                if (allocatedBytes != 0)
+                    memory::freed(memory::Tag::GL_TEXTURES, allocatedBytes);
             }
     };
     
@@ -89,6 +98,7 @@ namespace parks {
             struct VBO {
                 GLuint vboID;
                 GLuint bindType;
+                GLuint size;
             };
             
             VAO vao;
@@ -122,9 +132,11 @@ namespace parks {
             void createVBO(VBOData data) {
                 VBO vbo{};
                 vbo.bindType = data.target;
+                vbo.size = data.size;
                 glGenBuffers(1, &vbo.vboID);
                 glBindBuffer(data.target, vbo.vboID);
                 glBufferData(data.target, data.size, data.data, data.usage);
+                memory::allocated(memory::Tag::GL_BUFFERS, data.size);
                 associatedVBOs.push_back(vbo);
                 if (vbo.bindType == GL_ELEMENT_ARRAY_BUFFER)
                     ebo = vbo;
@@ -152,8 +164,10 @@ namespace parks {
             
             ~VAOStorageObject() {
                 glDeleteVertexArrays(1, &vao.vaoID);
-                for (const auto& v : associatedVBOs)
+                for (const auto& v : associatedVBOs) {
                     glDeleteBuffers(1, &v.vboID);
+                    memory::freed(memory::Tag::GL_BUFFERS, v.size);
+                }
             }
     };
     
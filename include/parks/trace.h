@@ -0,0 +1,82 @@
+//
+// Created by brett on 7/28/23.
+//
+
+#ifndef PARKSNREC_TRACE_H
+#define PARKSNREC_TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace parks::trace {
+
+    // events each thread can hold per recording, anything past this is dropped and counted
+    constexpr size_t EVENTS_PER_THREAD = 1 << 16;
+
+    namespace detail {
+        extern std::atomic<bool> recording;
+
+        uint64_t now();
+        void record(const char* name, const char* category, uint64_t begin, uint64_t end, int64_t arg);
+    }
+
+    /**
+     * Clears any previous recording and starts recording events from every thread
+     */
+    void start();
+    void stop();
+
+    [[nodiscard]] inline bool recording() {
+        return detail::recording.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Names the calling thread in the trace, threads which aren't named show up by their id
+     */
+    void setThreadName(const std::string& name);
+
+    /**
+     * Writes everything recorded so far as Chrome trace event json, which chrome://tracing and ui.perfetto.dev open.
+     * Safe to call while other threads are still recording, events they finish afterwards are left out.
+     * @return false if the file couldn't be written
+     */
+    bool write(const std::string& path);
+
+    /**
+     * @return events dropped because a thread's buffer was full
+     */
+    [[nodiscard]] size_t dropped();
+
+    /**
+     * Records the time between construction and destruction as one event on the calling thread. When nothing is
+     * being recorded this is a single relaxed load. name and category must be string literals, they are stored as
+     * pointers.
+     */
+    class Scope {
+        private:
+            const char* name;
+            const char* category;
+            int64_t arg;
+            uint64_t begin = 0;
+        public:
+            /**
+             * @param arg shown in the event's args when not negative, eg a tile index
+             */
+            explicit Scope(const char* name, const char* category, int64_t arg = -1): name(name), category(category), arg(arg) {
+                if (recording())
+                    begin = detail::now();
+            }
+
+            Scope(const Scope&) = delete;
+            Scope& operator=(const Scope&) = delete;
+
+            ~Scope() {
+                if (begin != 0 && recording())
+                    detail::record(name, category, begin, detail::now(), arg);
+            }
+    };
+
+}
+
+#endif //PARKSNREC_TRACE_H
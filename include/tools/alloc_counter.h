@@ -0,0 +1,20 @@
+//
+// Created by brett on 7/28/23.
+//
+
+#ifndef PARKSNREC_ALLOC_COUNTER_H
+#define PARKSNREC_ALLOC_COUNTER_H
+
+#include <cstddef>
+
+namespace parks {
+    
+    /**
+     * @return every heap allocation the process has made so far. Counted by the operator new replacements in
+     * alloc_counter.cpp, which only the headless tools link.
+     */
+    size_t heapAllocations();
+    
+}
+
+#endif //PARKSNREC_ALLOC_COUNTER_H
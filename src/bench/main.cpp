@@ -0,0 +1,291 @@
+//
+// Created by brett on 7/28/23.
+//
+#include <genetic/v3/program_v3.h>
+#include <genetic/v3/linear_v3.h>
+#include <parks/renderer/OpenGL.h>
+#include <tools/alloc_counter.h>
+#include <GLFW/glfw3.h>
+#include <blt/std/logging.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace parks;
+using namespace parks::genetic;
+
+// microbenchmarks of the genetic and render hot paths over a fixed seed corpus of trees, written out as json so
+// results can be compared between releases
+
+// results are written here so the compiler can't drop the work being timed
+static volatile double doubleSink;
+static volatile int functionSink;
+
+struct BenchResult {
+    std::string name;
+    int height = 0;
+    std::string unit;
+    // one entry per sample, in unit
+    std::vector<double> samples;
+    double allocationsPerSample = 0;
+
+    // with fewer samples p99 is just the slowest one, so it is left out
+    static constexpr size_t P99_SAMPLES = 100;
+
+    [[nodiscard]] inline bool hasP99() const {
+        return samples.size() >= P99_SAMPLES;
+    }
+
+    [[nodiscard]] double percentile(double p) const {
+        auto sorted = samples;
+        std::sort(sorted.begin(), sorted.end());
+        auto index = (size_t) (p * (double) (sorted.size() - 1) + 0.5);
+        return sorted[std::min(index, sorted.size() - 1)];
+    }
+
+    [[nodiscard]] double mean() const {
+        double total = 0;
+        for (auto s : samples)
+            total += s;
+        return total / (double) samples.size();
+    }
+};
+
+/**
+ * Times count calls of run(i), each divided by work to give a per pixel / per call figure
+ */
+template<typename F>
+static BenchResult measure(const std::string& name, int height, const std::string& unit, size_t count, double work, F&& run) {
+    BenchResult result;
+    result.name = name;
+    result.height = height;
+    result.unit = unit;
+    result.samples.reserve(count);
+
+    auto allocationsBefore = heapAllocations();
+    for (size_t i = 0; i < count; i++) {
+        auto start = std::chrono::steady_clock::now();
+        run(i);
+        auto end = std::chrono::steady_clock::now();
+        result.samples.push_back((double) std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / work);
+    }
+    result.allocationsPerSample = (double) (heapAllocations() - allocationsBefore) / (double) count;
+
+    if (result.hasP99()) {
+        BLT_INFO("%-14s h=%-2d %10.1f %s (p50) %10.1f (p90) %10.1f (p99) %8.1f allocations", name.c_str(), height, result.percentile(0.5),
+                 unit.c_str(), result.percentile(0.9), result.percentile(0.99), result.allocationsPerSample);
+    } else {
+        BLT_INFO("%-14s h=%-2d %10.1f %s (p50) %10.1f (p90) %10.1f (max) %8.1f allocations", name.c_str(), height, result.percentile(0.5),
+                 unit.c_str(), result.percentile(0.9), result.percentile(1), result.allocationsPerSample);
+    }
+    return result;
+}
+
+static std::vector<int> parseList(const std::string& list) {
+    std::vector<int> values;
+    std::stringstream stream(list);
+    std::string part;
+    while (std::getline(stream, part, ','))
+        values.push_back(std::atoi(part.c_str()));
+    return values;
+}
+
+static void writeJson(const std::string& path, uint64_t seed, const std::vector<BenchResult>& results) {
+    std::ofstream out(path);
+    out << "{\n  \"seed\": " << seed << ",\n  \"width\": " << WIDTH << ",\n  \"height\": " << HEIGHT << ",\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const auto& r = results[i];
+        out << "    {\"name\": \"" << r.name << "\", \"tree_height\": " << r.height << ", \"unit\": \"" << r.unit << "\", \"samples\": "
+            << r.samples.size() << ", \"mean\": " << r.mean() << ", \"min\": " << r.percentile(0) << ", \"p50\": " << r.percentile(0.5)
+            << ", \"p90\": " << r.percentile(0.9) << ", \"p99\": ";
+        if (r.hasP99())
+            out << r.percentile(0.99);
+        else
+            out << "null";
+        out << ", \"max\": " << r.percentile(1)
+            << ", \"allocations\": " << r.allocationsPerSample << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+// an invisible window is enough for a context, nullptr if there is no display
+static GLFWwindow* createContext() {
+    if (!glfwInit())
+        return nullptr;
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GLFW_TRUE);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    auto window = glfwCreateWindow(1, 1, "parksnrec_bench", nullptr, nullptr);
+    if (window == nullptr) {
+        glfwTerminate();
+        return nullptr;
+    }
+    glfwMakeContextCurrent(window);
+    if (gladLoadGL(glfwGetProcAddress) == 0) {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+        return nullptr;
+    }
+    return window;
+}
+
+static void usage() {
+    BLT_INFO("usage: parksnrec_bench [options]");
+    BLT_INFO("    --seed n          seed the tree corpus is generated from (default 1)");
+    BLT_INFO("    --heights list    comma separated tree heights to benchmark (default 3,5,7,9)");
+    BLT_INFO("    --trees n         trees in the corpus at each height (default 16)");
+    BLT_INFO("    --threads n       render threads (default all hardware threads)");
+    BLT_INFO("    --output file     where the json results are written (default parksnrec_bench.json)");
+    BLT_INFO("    --no-gl           skip the texture upload benchmark");
+}
+
+int main(int argc, const char** argv) {
+    uint64_t seed = 1;
+    std::vector<int> heights = {3, 5, 7, 9};
+    size_t treeCount = 16;
+    std::string output = "parksnrec_bench.json";
+    bool gl = true;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        auto next = [&]() -> const char* {
+            if (i + 1 >= argc) {
+                BLT_ERROR("%s expects a value", arg.c_str());
+                std::exit(1);
+            }
+            return argv[++i];
+        };
+        if (arg == "--seed")
+            seed = std::strtoull(next(), nullptr, 10);
+        else if (arg == "--heights")
+            heights = parseList(next());
+        else if (arg == "--trees")
+            treeCount = std::max<size_t>(1, std::strtoul(next(), nullptr, 10));
+        else if (arg == "--threads")
+            RenderPool::setSharedThreads(std::strtoul(next(), nullptr, 10));
+        else if (arg == "--output")
+            output = next();
+        else if (arg == "--no-gl")
+            gl = false;
+        else {
+            usage();
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+
+    std::vector<BenchResult> results;
+    std::vector<unsigned char> pixels(WIDTH * HEIGHT * CHANNELS);
+    const double imagePixels = WIDTH * HEIGHT;
+
+    results.push_back(measure("select", 0, "ns/call", 256, 1024, [](size_t) {
+        for (int i = 0; i < 1024; i++)
+            functionSink = (int) functions.select();
+    }));
+
+    for (auto height : heights) {
+        // every height starts from the same seed so adding heights doesn't change the others' corpus
+        setRandomSeed(seed + (uint64_t) height);
+        std::vector<std::unique_ptr<GeneticTree>> corpus;
+        results.push_back(measure("generate", height, "ns/tree", treeCount, 1, [&](size_t) {
+            corpus.push_back(std::make_unique<GeneticTree>(height));
+        }));
+
+        // execute() is slow enough that a 64x64 grid of samples per tree is plenty
+        constexpr unsigned int EXECUTE_GRID = 64;
+        results.push_back(measure("execute", height, "ns/pixel", treeCount, EXECUTE_GRID * EXECUTE_GRID, [&](size_t i) {
+            double sink = 0;
+            for (unsigned int y = 0; y < EXECUTE_GRID; y++) {
+                for (unsigned int x = 0; x < EXECUTE_GRID; x++)
+                    sink += corpus[i]->execute((double) x / EXECUTE_GRID, (double) y / EXECUTE_GRID).r;
+            }
+            doubleSink = sink;
+        }));
+
+        // the first render compiles the tree, the rest hit the cache like an evolution run's renders
+        for (auto& tree : corpus)
+            tree->getCompiled();
+        results.push_back(measure("processImage", height, "ns/pixel", treeCount, imagePixels, [&](size_t i) {
+            corpus[i]->processImage(pixels.data());
+        }));
+        if (JitTree::supported()) {
+            for (auto& tree : corpus)
+                tree->getJit();
+            results.push_back(measure("processImageJit", height, "ns/pixel", treeCount, imagePixels, [&](size_t i) {
+                corpus[i]->processImage(pixels.data(), RenderBackend::JIT);
+            }));
+        }
+
+        std::vector<std::vector<unsigned char>> images(treeCount, std::vector<unsigned char>(WIDTH * HEIGHT * CHANNELS));
+        for (size_t i = 0; i < treeCount; i++)
+            corpus[i]->processImage(images[i].data());
+        results.push_back(measure("evaluate", height, "ns/pixel", treeCount, imagePixels, [&](size_t i) {
+            doubleSink = GeneticTree::evaluate(images[i].data());
+        }));
+
+        // copies are made outside the timed region so only the operator itself is measured
+        std::vector<std::unique_ptr<GeneticTree>> copies;
+        for (auto& tree : corpus)
+            copies.emplace_back(tree->copy());
+        results.push_back(measure("mutate", height, "ns/call", treeCount, 1, [&](size_t i) {
+            copies[i]->mutate();
+        }));
+        results.push_back(measure("crossover", height, "ns/call", treeCount, 1, [&](size_t i) {
+            copies[i]->crossover(copies[(i + 1) % treeCount].get());
+        }));
+        results.push_back(measure("copy", height, "ns/call", treeCount, 1, [&](size_t i) {
+            delete corpus[i]->copy();
+        }));
+
+        // the same corpus in LinearTree's prefix order layout
+        std::vector<LinearTree> linear;
+        for (auto& tree : corpus)
+            linear.push_back(LinearTree::fromTree(*tree));
+        results.push_back(measure("linearExecute", height, "ns/pixel", treeCount, EXECUTE_GRID * EXECUTE_GRID, [&](size_t i) {
+            double sink = 0;
+            for (unsigned int y = 0; y < EXECUTE_GRID; y++) {
+                for (unsigned int x = 0; x < EXECUTE_GRID; x++)
+                    sink += linear[i].execute((double) x / EXECUTE_GRID, (double) y / EXECUTE_GRID).r;
+            }
+            doubleSink = sink;
+        }));
+        results.push_back(measure("linearCopy", height, "ns/call", treeCount, 1, [&](size_t i) {
+            LinearTree copy = linear[i];
+            functionSink = (int) copy.size();
+        }));
+        results.push_back(measure("linearMutate", height, "ns/call", treeCount, 1, [&](size_t i) {
+            linear[i].mutate();
+        }));
+        results.push_back(measure("linearCrossover", height, "ns/call", treeCount, 1, [&](size_t i) {
+            linear[i].crossover(linear[(i + 1) % treeCount]);
+        }));
+    }
+
+    if (gl) {
+        if (auto window = createContext()) {
+            {
+                GLTexture2D texture;
+                texture.upload(pixels.data(), GL_UNSIGNED_BYTE, WIDTH, HEIGHT, CHANNELS);
+                glFinish();
+                // glFinish so the time includes the transfer, not just queueing it
+                results.push_back(measure("upload", 0, "ns/pixel", 256, imagePixels, [&](size_t) {
+                    texture.upload(pixels.data(), GL_UNSIGNED_BYTE, WIDTH, HEIGHT, CHANNELS);
+                    glFinish();
+                }));
+            }
+            glfwDestroyWindow(window);
+            glfwTerminate();
+        } else
+            BLT_WARN("No OpenGL context available, skipping the upload benchmark");
+    }
+
+    writeJson(output, seed, results);
+    BLT_INFO("Wrote %zu results to %s", results.size(), output.c_str());
+    return 0;
+}
@@ -0,0 +1,360 @@
+//
+// Created by brett on 7/28/23.
+//
+#include <genetic/v3/evolution_v3.h>
+#include <genetic/v3/island_v3.h>
+#include <parks/trace.h>
+#include <parks/perf_counters.h>
+#include <parks/memory.h>
+#include <tools/alloc_counter.h>
+#include <blt/std/logging.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace parks;
+using namespace parks::genetic;
+
+// headless evolution driver, never opens a window or creates a GL context so it can run on machines without displays
+
+// resident set size in kilobytes
+static size_t residentKB() {
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0, resident = 0;
+    statm >> pages >> resident;
+    return resident * (size_t) sysconf(_SC_PAGESIZE) / 1024;
+}
+
+static size_t peakResidentKB() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static void usage() {
+    BLT_INFO("usage: parksnrec_evolve [options]");
+    BLT_INFO("    --generations n   generations to run (default 100)");
+    BLT_INFO("    --population n    trees per generation (default %zu)", populationSize);
+    BLT_INFO("    --tournament n    tournament size (default %zu)", tournamentSize);
+    BLT_INFO("    --elites n        best trees kept unchanged each generation (default %zu)", eliteCount);
+    BLT_INFO("    --height n        height of randomly generated trees (default %d)", treeHeight);
+    BLT_INFO("    --screen          score at low resolution first, only promising trees are rendered in full");
+    BLT_INFO("    --output file     write the best image of the last generation as a binary ppm");
+    BLT_INFO("    --no-arena        allocate trees on the heap instead of in per generation arenas");
+    BLT_INFO("    --weights list    comma separated name=weight selection weights, eg SIN=2,Noise=0.25 (default 1 each)");
+    BLT_INFO("    --seed n          seed for every random choice, logged at startup so any run can be replayed");
+    BLT_INFO("    --threads n       render threads (default all hardware threads, shared out between local islands)");
+    BLT_INFO("    --counters        measure hardware performance counters per phase, falling back to wall clock time");
+    BLT_INFO("    --trace file      record a chrome trace of the run, open it in chrome://tracing or ui.perfetto.dev");
+    BLT_INFO("    --render-allocations  count the heap allocations made rendering one random tree, then exit");
+    BLT_INFO("island model:");
+    BLT_INFO("    --islands n       fork n islands on this machine, listening on consecutive ports on localhost");
+    BLT_INFO("    --base-port n     first port used by --islands (default 7600)");
+    BLT_INFO("    --island id       run a single island of a model spread over several machines");
+    BLT_INFO("    --addresses list  comma separated host:port of every island, indexed by island id");
+    BLT_INFO("    --topology name   ring or full (default ring)");
+    BLT_INFO("    --interval n      generations between migrations (default 10)");
+    BLT_INFO("    --migrants n      trees sent per migration (default 2)");
+}
+
+static std::vector<std::string> splitList(const std::string& list) {
+    std::vector<std::string> parts;
+    std::stringstream stream(list);
+    std::string part;
+    while (std::getline(stream, part, ','))
+        parts.push_back(part);
+    return parts;
+}
+
+static void writePPM(const std::string& path, const unsigned char* pixels) {
+    std::ofstream out(path, std::ios::binary);
+    out << "P6\n" << WIDTH << " " << HEIGHT << "\n255\n";
+    out.write((const char*) pixels, WIDTH * HEIGHT * CHANNELS);
+}
+
+// heap allocations made rendering a random tree, pixel by pixel through the function table and through the render pool
+static void reportRenderAllocations(int height) {
+    GeneticTree tree(height);
+    
+    auto before = heapAllocations();
+    for (unsigned int j = 0; j < HEIGHT; j++) {
+        for (unsigned int i = 0; i < WIDTH; i++)
+            tree.execute((double) i / WIDTH, (double) j / HEIGHT);
+    }
+    auto executed = heapAllocations() - before;
+    
+    std::vector<unsigned char> pixels(WIDTH * HEIGHT * CHANNELS);
+    // the first render compiles the tree and starts the pool
+    tree.processImage(pixels.data());
+    before = heapAllocations();
+    tree.processImage(pixels.data());
+    auto rendered = heapAllocations() - before;
+    
+    BLT_INFO("execute(): %zu heap allocations, %.3f per pixel", executed, (double) executed / (WIDTH * HEIGHT));
+    BLT_INFO("processImage(): %zu heap allocations, %.3f per pixel", rendered, (double) rendered / (WIDTH * HEIGHT));
+}
+
+// name=weight pairs separated by commas, names as in the function table
+static bool applyWeights(const std::string& list) {
+    for (const auto& entry : splitList(list)) {
+        auto split = entry.find('=');
+        FunctionID id;
+        if (split == std::string::npos || !functions.find(entry.substr(0, split), id)) {
+            BLT_ERROR("Unknown function weight %s", entry.c_str());
+            return false;
+        }
+        if (!functions.setWeight(id, std::strtod(entry.substr(split + 1).c_str(), nullptr)))
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, const char** argv) {
+    EvolutionConfig config;
+    IslandConfig islandConfig;
+    size_t generations = 100;
+    std::string output;
+    size_t threads = 0;
+    size_t localIslands = 0;
+    uint16_t basePort = 7600;
+    bool island = false;
+    bool renderAllocations = false;
+    std::string tracePath;
+    
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        auto next = [&]() -> const char* {
+            if (i + 1 >= argc) {
+                BLT_ERROR("%s expects a value", arg.c_str());
+                std::exit(1);
+            }
+            return argv[++i];
+        };
+        if (arg == "--generations")
+            generations = std::strtoul(next(), nullptr, 10);
+        else if (arg == "--population")
+            config.populationSize = std::strtoul(next(), nullptr, 10);
+        else if (arg == "--tournament")
+            config.tournamentSize = std::strtoul(next(), nullptr, 10);
+        else if (arg == "--elites")
+            config.eliteCount = std::strtoul(next(), nullptr, 10);
+        else if (arg == "--height")
+            config.treeHeight = std::atoi(next());
+        else if (arg == "--screen")
+            config.screen = true;
+        else if (arg == "--no-arena")
+            config.arena = false;
+        else if (arg == "--output")
+            output = next();
+        else if (arg == "--weights") {
+            if (!applyWeights(next()))
+                return 1;
+        } else if (arg == "--seed")
+            setRandomSeed(std::strtoull(next(), nullptr, 10));
+        else if (arg == "--threads")
+            threads = std::strtoul(next(), nullptr, 10);
+        else if (arg == "--counters")
+            perf::setEnabled(true);
+        else if (arg == "--trace")
+            tracePath = next();
+        else if (arg == "--render-allocations")
+            renderAllocations = true;
+        else if (arg == "--islands")
+            localIslands = std::strtoul(next(), nullptr, 10);
+        else if (arg == "--base-port")
+            basePort = (uint16_t) std::strtoul(next(), nullptr, 10);
+        else if (arg == "--island") {
+            islandConfig.id = std::strtoul(next(), nullptr, 10);
+            island = true;
+        } else if (arg == "--addresses")
+            islandConfig.addresses = splitList(next());
+        else if (arg == "--topology") {
+            std::string name = next();
+            if (name == "ring")
+                islandConfig.topology = Topology::RING;
+            else if (name == "full")
+                islandConfig.topology = Topology::FULL;
+            else {
+                BLT_ERROR("Unknown topology %s", name.c_str());
+                return 1;
+            }
+        } else if (arg == "--interval")
+            islandConfig.migrationInterval = std::strtoul(next(), nullptr, 10);
+        else if (arg == "--migrants")
+            islandConfig.migrants = std::strtoul(next(), nullptr, 10);
+        else {
+            usage();
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+    
+    if (config.treeHeight < 1 || config.treeHeight > MAX_HEIGHT) {
+        BLT_ERROR("Tree height must be between 1 and %d", MAX_HEIGHT);
+        return 1;
+    }
+    
+    if (renderAllocations) {
+        if (threads > 0)
+            RenderPool::setSharedThreads(threads);
+        reportRenderAllocations(config.treeHeight);
+        return 0;
+    }
+    
+    if (localIslands > 0) {
+        // every island is a child process talking to the others over localhost, as if they were separate machines
+        islandConfig.addresses.clear();
+        for (size_t i = 0; i < localIslands; i++)
+            islandConfig.addresses.push_back("127.0.0.1:" + std::to_string(basePort + i));
+        if (threads == 0)
+            threads = std::max<size_t>(1, std::thread::hardware_concurrency() / localIslands);
+        
+        std::vector<pid_t> children;
+        for (size_t i = 0; i < localIslands; i++) {
+            auto pid = fork();
+            if (pid < 0) {
+                BLT_ERROR("Failed to fork island %zu", i);
+                break;
+            }
+            if (pid == 0) {
+                // nothing has touched the render pool yet, so the child starts its own
+                islandConfig.id = i;
+                island = true;
+                children.clear();
+                break;
+            }
+            children.push_back(pid);
+        }
+        if (!island) {
+            int failures = 0;
+            for (auto pid : children) {
+                int status;
+                waitpid(pid, &status, 0);
+                if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                    failures++;
+            }
+            BLT_INFO("%zu islands finished, %d failed", children.size(), failures);
+            return failures == 0 ? 0 : 1;
+        }
+    }
+    
+    if (threads > 0)
+        RenderPool::setSharedThreads(threads);
+    
+    std::unique_ptr<Island> migration;
+    std::string prefix;
+    if (island) {
+        prefix = "island " + std::to_string(islandConfig.id) + " ";
+        // islands share the run's seed but must not evolve identical populations
+        setRandomSeed(getRandomSeed() + islandConfig.id);
+        migration = std::make_unique<Island>(islandConfig);
+        if (!migration->start())
+            return 1;
+        // every island writes its own image
+        if (!output.empty())
+            output = std::to_string(islandConfig.id) + "_" + output;
+    }
+    
+    // migrations arrive whenever the network delivers them, so only runs without islands replay exactly
+    BLT_INFO("%sseed %llu", prefix.c_str(), (unsigned long long) getRandomSeed());
+    
+    if (!tracePath.empty()) {
+        trace::setThreadName("main");
+        trace::start();
+        // every island records its own trace
+        if (island)
+            tracePath = std::to_string(islandConfig.id) + "_" + tracePath;
+    }
+    
+    Population population(config);
+    
+    auto report = [&prefix](const GenerationStats& stats) {
+        BLT_INFO("%sgeneration %zu: best %f, mean %f, %zu evaluations in %.3fs (%.2f evaluations/s)", prefix.c_str(), stats.generation,
+                 stats.best, stats.mean, stats.evaluations, stats.seconds,
+                 stats.seconds > 0 ? (double) stats.evaluations / stats.seconds : 0.0);
+    };
+    
+    auto first = population.initialize();
+    report(first);
+    
+    double seconds = 0;
+    size_t evaluations = 0;
+    auto allocationsBefore = heapAllocations();
+    for (size_t i = 0; i < generations; i++) {
+        if (migration)
+            migration->immigrate(population);
+        auto stats = population.step();
+        report(stats);
+        if (migration)
+            migration->emigrate(population);
+        seconds += stats.seconds;
+        evaluations += stats.evaluations;
+    }
+    
+    if (seconds > 0) {
+        BLT_INFO("%s%zu generations in %.3fs: %.3f generations/s, %.2f evaluations/s", prefix.c_str(), generations, seconds,
+                 (double) generations / seconds, (double) evaluations / seconds);
+    }
+    if (migration)
+        BLT_INFO("%ssent %zu migrants, received %zu", prefix.c_str(), migration->getSent(), migration->getReceived());
+    // joins the listener and frees the migrants still waiting in the inbox, which would otherwise count as leaks
+    migration.reset();
+    auto allocations = heapAllocations() - allocationsBefore;
+    BLT_INFO("%s%zu heap allocations (%.0f per generation), arena %.1f kb in %zu blocks, rss %zu kb, peak %zu kb", prefix.c_str(), allocations,
+             generations > 0 ? (double) allocations / (double) generations : 0.0, (double) population.getArena().reservedBytes() / 1024,
+             population.getArena().reservedBlocks(), residentKB(), peakResidentKB());
+    
+    if (!output.empty()) {
+        std::vector<unsigned char> pixels(WIDTH * HEIGHT * CHANNELS);
+        population.best()->processImage(pixels.data());
+        writePPM(output, pixels.data());
+        BLT_INFO("%sWrote the best tree to %s", prefix.c_str(), output.c_str());
+    }
+    
+    {
+        std::stringstream lines(memory::summary());
+        std::string line;
+        while (std::getline(lines, line))
+            BLT_INFO("%s%s", prefix.c_str(), line.c_str());
+        // between generations the population owns every tree, any other live node or node array has leaked
+        size_t owned = 0;
+        for (auto* member : population.getMembers())
+            owned += member->nodeCount();
+        auto live = memory::stats(memory::Tag::GENETIC_NODES).live();
+        if (live != owned)
+            BLT_WARN("%s%lu genetic nodes are live but the population only holds %zu, %ld leaked", prefix.c_str(), (unsigned long) live, owned,
+                     (long) live - (long) owned);
+        // one array per tree
+        auto trees = population.getMembers().size();
+        auto arrays = memory::stats(memory::Tag::GENETIC_NODE_ARRAYS).live();
+        if (arrays != trees)
+            BLT_WARN("%s%lu node arrays are live but the population only holds %zu trees, %ld leaked", prefix.c_str(), (unsigned long) arrays, trees,
+                     (long) arrays - (long) trees);
+    }
+    
+    if (perf::enabled()) {
+        if (!perf::available())
+            BLT_WARN("%sHardware counters unavailable, %s. Only wall clock time was measured", prefix.c_str(), perf::unavailableReason().c_str());
+        std::stringstream lines(perf::summary());
+        std::string line;
+        while (std::getline(lines, line))
+            BLT_INFO("%s%s", prefix.c_str(), line.c_str());
+    }
+    
+    if (!tracePath.empty()) {
+        trace::stop();
+        if (trace::write(tracePath))
+            BLT_INFO("%sWrote the trace to %s (%zu events dropped)", prefix.c_str(), tracePath.c_str(), trace::dropped());
+        else
+            BLT_ERROR("%sCouldn't write the trace to %s", prefix.c_str(), tracePath.c_str());
+    }
+    return 0;
+}
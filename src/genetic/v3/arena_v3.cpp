@@ -0,0 +1,57 @@
+//
+// Created by brett on 7/28/23.
+//
+#include <genetic/v3/arena_v3.h>
+
+namespace parks::genetic {
+    
+    static thread_local GenerationArena* currentArena = nullptr;
+    
+    void* GenerationArena::CountingResource::do_allocate(size_t size, size_t alignment) {
+        blocks++;
+        bytes += size;
+        return std::pmr::new_delete_resource()->allocate(size, alignment);
+    }
+    
+    void GenerationArena::CountingResource::do_deallocate(void* p, size_t size, size_t alignment) {
+        blocks--;
+        bytes -= size;
+        std::pmr::new_delete_resource()->deallocate(p, size, alignment);
+    }
+    
+    void* GenerationArena::allocate(memory::Tag tag, size_t size, size_t alignment) {
+        memory::allocated(tag, size);
+        live[(size_t) tag].count++;
+        live[(size_t) tag].bytes += size;
+        return resource.allocate(size, alignment);
+    }
+    
+    void GenerationArena::deallocate(memory::Tag tag, void* p, size_t size, size_t alignment) {
+        memory::freed(tag, size);
+        live[(size_t) tag].count--;
+        live[(size_t) tag].bytes -= size;
+        resource.deallocate(p, size, alignment);
+    }
+    
+    void GenerationArena::release() {
+        for (size_t tag = 0; tag < memory::TAG_COUNT; tag++) {
+            if (live[tag].count > 0)
+                memory::freed((memory::Tag) tag, live[tag].bytes, live[tag].count);
+            live[tag] = {};
+        }
+        resource.release();
+    }
+    
+    GenerationArena* treeArena() {
+        return currentArena;
+    }
+    
+    ArenaScope::ArenaScope(GenerationArena& arena): previous(currentArena) {
+        currentArena = &arena;
+    }
+    
+    ArenaScope::~ArenaScope() {
+        currentArena = previous;
+    }
+    
+}
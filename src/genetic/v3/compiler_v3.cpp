@@ -0,0 +1,302 @@
+//
+// Created by brett on 7/24/23.
+//
+#include <genetic/v3/compiler_v3.h>
+#include <algorithm>
+
+namespace parks::genetic {
+
+    // only noise builds its result from a single value, every other operator produces a full color
+    static inline bool producesScalar(FunctionID op) {
+        return op == FunctionID::NOISE;
+    }
+    
+    Operand CompiledTree::addConstant(Color c) {
+        constants.push_back(c);
+        return {OperandType::CONSTANT, (unsigned int) (constants.size() - 1)};
+    }
+
+    Operand CompiledTree::fold(FunctionID op, Operand left, Operand right, const ParameterSet& set) {
+        foldedNodes++;
+        // x and y are never read for invariant operands
+        return addConstant(callFunction(op, {ARGS_BOTH, fetch(left, 0, 0, nullptr), fetch(right, 0, 0, nullptr)}, set));
+    }
+    
+    Operand CompiledTree::addInstruction(FunctionID op, Operand left, Operand right, const ParameterSet& set, unsigned int node) {
+        parameters.push_back(set);
+        instructions.push_back({op, left, right, (unsigned int) (parameters.size() - 1), node});
+        return {OperandType::SLOT, (unsigned int) (instructions.size() - 1)};
+    }
+
+    // bit set of the pixel coordinates an instruction reads, directly or through its arguments
+    constexpr unsigned char DEPENDS_X = 1;
+    constexpr unsigned char DEPENDS_Y = 2;
+    
+    Operand CompiledTree::extract(unsigned int index, bool swapAxes, CompiledTree& into, std::vector<char>& extracted) const {
+        const auto& ins = instructions[index];
+        extracted[index] = true;
+        auto copy = [&](Operand operand) -> Operand {
+            switch (operand.type) {
+                case OperandType::SLOT:
+                    return extract(operand.index, swapAxes, into, extracted);
+                case OperandType::CONSTANT:
+                    return into.addConstant(constants[operand.index]);
+                case OperandType::Y:
+                    return swapAxes ? Operand{OperandType::X} : operand;
+                default:
+                    return operand;
+            }
+        };
+        // left then right keeps the copy in postfix order
+        auto left = copy(ins.left);
+        auto right = copy(ins.right);
+        return into.addInstruction(ins.op, left, right, parameters[ins.params], ins.node);
+    }
+    
+    void CompiledTree::separate() {
+        auto count = instructions.size();
+        std::vector<unsigned char> depends(count);
+        auto dependence = [&depends](Operand operand) -> unsigned char {
+            switch (operand.type) {
+                case OperandType::X:
+                    return DEPENDS_X;
+                case OperandType::Y:
+                    return DEPENDS_Y;
+                case OperandType::SLOT:
+                    return depends[operand.index];
+                default:
+                    return 0;
+            }
+        };
+        for (size_t i = 0; i < count; i++)
+            depends[i] = dependence(instructions[i].left) | dependence(instructions[i].right);
+        
+        // a subtree is split off at the point where its consumer starts depending on the other axis as well
+        std::vector<char> roots(count, false);
+        auto markRoot = [&](Operand operand, unsigned char consumer) {
+            if (operand.type == OperandType::SLOT && depends[operand.index] != consumer)
+                roots[operand.index] = true;
+        };
+        for (size_t i = 0; i < count; i++) {
+            markRoot(instructions[i].left, depends[i]);
+            markRoot(instructions[i].right, depends[i]);
+        }
+        markRoot(result, DEPENDS_X | DEPENDS_Y);
+        
+        std::vector<Operand> mapped(count);
+        std::vector<char> extracted(count, false);
+        for (unsigned int i = 0; i < count; i++) {
+            if (!roots[i])
+                continue;
+            bool row = depends[i] == DEPENDS_Y;
+            CompiledTree axis;
+            axis.result = extract(i, row, axis, extracted);
+            auto& programs = row ? rows : columns;
+            programs.push_back(std::move(axis));
+            mapped[i] = {row ? OperandType::ROW : OperandType::COLUMN, (unsigned int) (programs.size() - 1)};
+        }
+        if (columns.empty() && rows.empty())
+            return;
+        
+        auto remap = [&mapped](Operand operand) -> Operand {
+            return operand.type == OperandType::SLOT ? mapped[operand.index] : operand;
+        };
+        std::vector<Instruction> kept;
+        for (unsigned int i = 0; i < count; i++) {
+            if (extracted[i])
+                continue;
+            auto ins = instructions[i];
+            ins.left = remap(ins.left);
+            ins.right = remap(ins.right);
+            kept.push_back(ins);
+            mapped[i] = {OperandType::SLOT, (unsigned int) (kept.size() - 1)};
+        }
+        instructions = std::move(kept);
+        result = remap(result);
+    }
+    
+    size_t CompiledTree::scratchSize() const {
+        size_t axisSlots = 0;
+        for (const auto& axis : columns)
+            axisSlots = std::max(axisSlots, axis.scratchSize());
+        for (const auto& axis : rows)
+            axisSlots = std::max(axisSlots, axis.scratchSize());
+        return instructions.size() + columns.size() + rows.size() + axisSlots;
+    }
+    
+    size_t CompiledTree::axisInstructionCount() const {
+        size_t count = 0;
+        for (const auto& axis : columns)
+            count += axis.slotCount();
+        for (const auto& axis : rows)
+            count += axis.slotCount();
+        return count;
+    }
+
+    Color CompiledTree::execute(double x, double y, Color* slots) const {
+        // subprogram results sit right after our slots, their own scratch space after that
+        auto axisSlots = slots + instructions.size();
+        auto axisScratch = axisSlots + columns.size() + rows.size();
+        for (size_t i = 0; i < columns.size(); i++)
+            axisSlots[i] = columns[i].execute(x, 0, axisScratch);
+        for (size_t i = 0; i < rows.size(); i++)
+            axisSlots[columns.size() + i] = rows[i].execute(y, 0, axisScratch);
+        for (size_t i = 0; i < instructions.size(); i++) {
+            const auto& ins = instructions[i];
+            slots[i] = callFunction(
+                    ins.op, {ARGS_BOTH, fetch(ins.left, x, y, slots), fetch(ins.right, x, y, slots)},
+                    parameters[ins.params]
+            );
+        }
+        return fetch(result, x, y, slots);
+    }
+
+    Color CompiledTree::executeInstruction(size_t index, Color left, Color right) const {
+        const auto& ins = instructions[index];
+        return callFunction(ins.op, {ARGS_BOTH, left, right}, parameters[ins.params]);
+    }
+    
+    template<typename T>
+    BasicAxisTables<T> CompiledTree::buildTables(unsigned int width, unsigned int height, OperatorProfile* profile) const {
+        auto build = [profile](const CompiledTree& axis, unsigned int size) {
+            std::vector<BasicColorBatch<T>> table((size + BATCH_SIZE - 1) / BATCH_SIZE);
+            BasicBatchState<T> state;
+            axis.prepare(state);
+            // lane i of batch b sees x = (b * BATCH_SIZE + i) / size, the same value the pixel pass computes
+            for (unsigned int i = 0; i < table.size(); i++)
+                table[i] = axis.executeBatch(i * BATCH_SIZE, 0, size, 1, state);
+#ifdef PARKSNREC_OP_PROFILE
+            if (profile != nullptr)
+                profile->add(axis, state.profile);
+#else
+            (void) profile;
+#endif
+            return table;
+        };
+        BasicAxisTables<T> tables;
+        for (const auto& axis : columns)
+            tables.columns.push_back(build(axis, width));
+        for (const auto& axis : rows)
+            tables.rows.push_back(build(axis, height));
+        return tables;
+    }
+    
+    template<typename T>
+    void CompiledTree::prepare(BasicBatchState<T>& state, const BasicAxisTables<T>* tables, const std::vector<NoiseBinding>* noise) const {
+        state.tables = tables;
+        state.noise = noise;
+        state.rows.resize(rows.size());
+        state.rowsValid = false;
+        state.slots.resize(instructions.size());
+        state.constants.resize(constants.size());
+        for (size_t i = 0; i < constants.size(); i++)
+            state.constants[i].fill(constants[i]);
+        state.x.fill(Color(0));
+        state.y.fill(Color(0));
+        state.zero.fill(Color(0));
+#ifdef PARKSNREC_OP_PROFILE
+        state.profile.assign(instructions.size(), {});
+#endif
+    }
+    
+    template<typename T>
+    const BasicColorBatch<T>& CompiledTree::executeBatch(unsigned int x, unsigned int y, unsigned int width, unsigned int height, BasicBatchState<T>& state) const {
+        for (unsigned int i = 0; i < BATCH_SIZE; i++) {
+            state.x.r[i] = (T) ((double) (x + i) / width);
+            state.y.r[i] = (T) ((double) y / height);
+        }
+        state.column = x / BATCH_SIZE;
+        if (!rows.empty() && (!state.rowsValid || state.row != y)) {
+            for (size_t i = 0; i < rows.size(); i++)
+                state.rows[i].fill(state.tables->rows[i][y / BATCH_SIZE].get(y % BATCH_SIZE));
+            state.row = y;
+            state.rowsValid = true;
+        }
+        for (size_t i = 0; i < instructions.size(); i++) {
+            const auto& ins = instructions[i];
+            const auto& left = fetch(ins.left, state);
+            const auto& right = fetch(ins.right, state);
+            auto& out = state.slots[i];
+#ifdef PARKSNREC_OP_PROFILE
+            auto start = cycleCount();
+#endif
+            switch (ins.op) {
+                case FunctionID::ADD:
+                    addBatch(left, right, out);
+                    break;
+                case FunctionID::SUBTRACT:
+                    subtractBatch(left, right, out);
+                    break;
+                case FunctionID::MULTIPLY:
+                    multiplyBatch(left, right, out);
+                    break;
+                case FunctionID::DIVIDE:
+                    divideBatch(left, right, out);
+                    break;
+                case FunctionID::MOD:
+                    modBatch(left, right, out);
+                    break;
+                case FunctionID::MIN:
+                    minBatch(left, right, out);
+                    break;
+                case FunctionID::MAX:
+                    maxBatch(left, right, out);
+                    break;
+                case FunctionID::ROUND:
+                    roundBatch(left, out);
+                    break;
+                case FunctionID::ABS:
+                    absBatch(left, out);
+                    break;
+                case FunctionID::NOISE:
+                case FunctionID::COLOR_NOISE: {
+                    auto binding = state.noise != nullptr ? (*state.noise)[i] : NoiseBinding{};
+                    if (binding.read != nullptr) {
+                        binding.read->load(x, y, out);
+                        break;
+                    }
+                    if (ins.op == FunctionID::NOISE)
+                        noiseBatch(left, right, parameters[ins.params], out);
+                    else
+                        colorNoiseBatch(left, right, parameters[ins.params], out);
+                    if (binding.write != nullptr)
+                        binding.write->store(x, y, out);
+                    break;
+                }
+                default:
+                    // transcendental functions have no batch kernel and are run one lane at a time
+                    for (unsigned int lane = 0; lane < BATCH_SIZE; lane++)
+                        out.set(lane, callFunction(ins.op, {ARGS_BOTH, left.get(lane), right.get(lane)}, parameters[ins.params]));
+                    break;
+            }
+#ifdef PARKSNREC_OP_PROFILE
+            state.profile[i].calls += BATCH_SIZE;
+            state.profile[i].cycles += cycleCount() - start;
+#endif
+        }
+        return fetch(result, state);
+    }
+    
+    template AxisTables CompiledTree::buildTables<double>(unsigned int width, unsigned int height, OperatorProfile* profile) const;
+    template FloatAxisTables CompiledTree::buildTables<float>(unsigned int width, unsigned int height, OperatorProfile* profile) const;
+    template void CompiledTree::prepare(BatchState& state, const AxisTables* tables, const std::vector<NoiseBinding>* noise) const;
+    template void CompiledTree::prepare(FloatBatchState& state, const FloatAxisTables* tables, const std::vector<NoiseBinding>* noise) const;
+    template const ColorBatch& CompiledTree::executeBatch(unsigned int x, unsigned int y, unsigned int width, unsigned int height, BatchState& state) const;
+    template const FloatColorBatch& CompiledTree::executeBatch(unsigned int x, unsigned int y, unsigned int width, unsigned int height, FloatBatchState& state) const;
+    
+    bool CompiledTree::resultIsBW() const {
+        switch (result.type) {
+            case OperandType::CONSTANT:
+                return constants[result.index].bw;
+            case OperandType::SLOT:
+                return producesScalar(instructions[result.index].op);
+            case OperandType::COLUMN:
+                return columns[result.index].resultIsBW();
+            case OperandType::ROW:
+                return rows[result.index].resultIsBW();
+            default:
+                return true;
+        }
+    }
+    
+}
@@ -0,0 +1,315 @@
+//
+// Created by brett on 7/28/23.
+//
+#include <genetic/v3/editor_v3.h>
+#include "imgui.h"
+#include <algorithm>
+
+namespace parks::genetic {
+    
+    static inline int pow(int b, int e){
+        auto o = 1;
+        for (int i = 0; i < e; i++)
+            o *= b;
+        return o;
+    }
+    
+    // column user ids of the profile tables
+    enum ProfileColumn : ImGuiID {
+        PROFILE_NODE, PROFILE_FUNCTION, PROFILE_CALLS, PROFILE_CYCLES, PROFILE_PER_CALL, PROFILE_PERCENT
+    };
+    
+    struct ProfileRow {
+        unsigned int node;
+        FunctionID op;
+        OperatorCost cost;
+    };
+    
+    static double profileKey(const ProfileRow& row, ImGuiID column) {
+        switch (column) {
+            case PROFILE_NODE:
+                return row.node;
+            case PROFILE_FUNCTION:
+                return (double) row.op;
+            case PROFILE_CALLS:
+                return (double) row.cost.calls;
+            case PROFILE_PER_CALL:
+                return row.cost.calls == 0 ? 0 : (double) row.cost.cycles / (double) row.cost.calls;
+            default:
+                return (double) row.cost.cycles;
+        }
+    }
+    
+    static void profileTable(const char* id, std::vector<ProfileRow>& rows, bool byNode, uint64_t totalCycles) {
+        auto flags = ImGuiTableFlags_Sortable | ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders | ImGuiTableFlags_ScrollY |
+                     ImGuiTableFlags_SizingFixedFit;
+        if (!ImGui::BeginTable(id, byNode ? 6 : 5, flags, {0, 200}))
+            return;
+        ImGui::TableSetupScrollFreeze(0, 1);
+        if (byNode)
+            ImGui::TableSetupColumn("Node", 0, 0, PROFILE_NODE);
+        ImGui::TableSetupColumn("Function", 0, 0, PROFILE_FUNCTION);
+        ImGui::TableSetupColumn("Calls", ImGuiTableColumnFlags_PreferSortDescending, 0, PROFILE_CALLS);
+        ImGui::TableSetupColumn("Cycles", ImGuiTableColumnFlags_DefaultSort | ImGuiTableColumnFlags_PreferSortDescending, 0, PROFILE_CYCLES);
+        ImGui::TableSetupColumn("Cycles / call", ImGuiTableColumnFlags_PreferSortDescending, 0, PROFILE_PER_CALL);
+        ImGui::TableSetupColumn("%", ImGuiTableColumnFlags_PreferSortDescending, 0, PROFILE_PERCENT);
+        ImGui::TableHeadersRow();
+        
+        // the rows are rebuilt every frame so they are sorted every frame rather than only when the specs change
+        if (auto specs = ImGui::TableGetSortSpecs(); specs != nullptr && specs->SpecsCount > 0) {
+            auto spec = specs->Specs[0];
+            std::stable_sort(rows.begin(), rows.end(), [&spec](const ProfileRow& a, const ProfileRow& b) {
+                if (spec.SortDirection == ImGuiSortDirection_Descending)
+                    return profileKey(a, spec.ColumnUserID) > profileKey(b, spec.ColumnUserID);
+                return profileKey(a, spec.ColumnUserID) < profileKey(b, spec.ColumnUserID);
+            });
+        }
+        
+        auto total = (double) std::max<uint64_t>(totalCycles, 1);
+        for (const auto& row : rows) {
+            ImGui::TableNextRow();
+            if (byNode) {
+                ImGui::TableNextColumn();
+                ImGui::Text("%u", row.node);
+            }
+            ImGui::TableNextColumn();
+            ImGui::TextUnformatted(functions[row.op].name);
+            ImGui::TableNextColumn();
+            ImGui::Text("%lu", (unsigned long) row.cost.calls);
+            ImGui::TableNextColumn();
+            ImGui::Text("%lu", (unsigned long) row.cost.cycles);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.1f", profileKey(row, PROFILE_PER_CALL));
+            ImGui::TableNextColumn();
+            ImGui::Text("%.1f", 100.0 * (double) row.cost.cycles / total);
+        }
+        ImGui::EndTable();
+    }
+    
+    void Program::drawProfile() {
+        if (!isRendering() && !profileValid) {
+            profile = OperatorProfile::last();
+            profileValid = true;
+        }
+        if (profile.empty()) {
+            ImGui::Text("No profile yet, run the program with the interpreter");
+            return;
+        }
+        ImGui::Text("%ux%u render, %lu cycles in operators", profile.width, profile.height, (unsigned long) profile.totalCycles());
+        
+        std::vector<ProfileRow> rows;
+        for (size_t i = 0; i < FUNCTION_COUNT; i++) {
+            if (profile.functions[i].calls != 0)
+                rows.push_back({0, (FunctionID) i, profile.functions[i]});
+        }
+        profileTable("ProfileFunctions", rows, false, profile.totalCycles());
+        
+        rows.clear();
+        for (const auto& [index, node] : profile.nodes)
+            rows.push_back({index, node.op, node.cost});
+        profileTable("ProfileNodes", rows, true, profile.totalCycles());
+        
+        ImGui::InputText("##ProfilePath", profilePath, sizeof(profilePath));
+        ImGui::SameLine();
+        if (ImGui::Button("Export CSV"))
+            profileStatus = profile.writeCsv(profilePath) ? std::string("Wrote ") + profilePath : std::string("Couldn't write ") + profilePath;
+        if (!profileStatus.empty())
+            ImGui::Text("%s", profileStatus.c_str());
+    }
+    
+    void Program::run() {
+        if (ImGui::Button("Run Program")){
+            if (tree != nullptr) {
+                startRender();
+                regenTreeDisplay();
+            } else {
+                ImGui::Text("Tree is currently null!");
+            }
+        }
+        if (ImGui::Button("Regen Program And Run")) {
+            delete last_tree;
+            last_tree = tree;
+            tree = new GeneticTree(7);
+            regenTreeDisplay();
+            
+            startRender();
+        }
+        if (ImGui::Button("Crossover")){
+            if (tree != nullptr && saved_tree != nullptr)
+                tree->crossover(saved_tree);
+        }
+        if (ImGui::Button("Mutate")){
+            tree->mutate();
+        }
+        if (ImGui::Button("Save")){
+            delete saved_tree;
+            saved_tree = tree;
+            tree = nullptr;
+        }
+        if (ImGui::Button("Revert")){
+            delete tree;
+            tree = saved_tree;
+            saved_tree = nullptr;
+        }
+        if (ImGui::Button("Revert To Last")){
+            delete tree;
+            tree = last_tree;
+            last_tree = nullptr;
+        }
+        if (JitTree::supported()) {
+            ImGui::Checkbox("Use JIT", &useJit);
+            ImGui::SameLine();
+            if (ImGui::Button("Compare JIT") && tree != nullptr) {
+                jitMismatches = tree->compareBackends();
+                jitCompared = true;
+            }
+            if (jitCompared)
+                ImGui::Text("JIT / interpreter mismatched pixels: %ld", jitMismatches);
+        } else
+            ImGui::Text("JIT unavailable on this machine");
+        ImGui::Checkbox("Single precision", &useFloat);
+        ImGui::SameLine();
+        if (ImGui::Button("Compare precision") && tree != nullptr) {
+            precisionReport = tree->comparePrecision();
+            precisionCompared = true;
+        }
+        if (precisionCompared) {
+            ImGui::Text("Float / double: %ld pixels differ, %ld beyond +-%d (max %d) %s", precisionReport.differentPixels,
+                        precisionReport.outsideTolerance, FLOAT_CHANNEL_TOLERANCE, precisionReport.maxDifference,
+                        precisionReport.withinTolerance() ? "within tolerance" : "OUTSIDE TOLERANCE");
+        }
+        if (ImGui::Button("Benchmark noise")) {
+            noiseBenchmark = benchmarkNoise(1 << 18);
+            noiseBenchmarked = true;
+        }
+        if (noiseBenchmarked) {
+            ImGui::Text("Turbulence: stb %.1f ns/point, batched %.1f ns/point (%zu mismatches, max error %g)",
+                        noiseBenchmark.stbNanosPerPoint, noiseBenchmark.batchNanosPerPoint, noiseBenchmark.mismatches,
+                        noiseBenchmark.maxError);
+        }
+        if (ImGui::Button("Screen random generation")) {
+            std::vector<GeneticTree*> generation;
+            for (int i = 0; i < 32; i++)
+                generation.push_back(new GeneticTree(7));
+            std::vector<double> fitness;
+            screeningReport = screenCandidates(generation, fitness, {}, true);
+            screened = true;
+            for (auto* candidate : generation)
+                delete candidate;
+        }
+        if (screened) {
+            ImGui::Text("Screening: %zu candidates, %zu rendered at full resolution", screeningReport.candidates,
+                        screeningReport.survivors.empty() ? screeningReport.candidates : screeningReport.survivors.back());
+            for (size_t i = 0; i < screeningReport.correlation.size(); i++)
+                ImGui::Text("    stage %zu: %zu survivors, correlation with full resolution %.3f", i, screeningReport.survivors[i],
+                            screeningReport.correlation[i]);
+            ImGui::Text("    %.3fs screened vs %.3fs at full resolution, %.3fs saved", screeningReport.screenedSeconds,
+                        screeningReport.fullSeconds, screeningReport.savedSeconds());
+        }
+        auto& noiseCache = NoiseCache::get();
+        ImGui::Text("Noise cache: %zu hits, %zu misses, %zu fields (%.1f / %.1f mb)", noiseCache.getHits(), noiseCache.getMisses(),
+                    noiseCache.size(), (double) noiseCache.bytes() / (1024 * 1024), (double) noiseCache.getBudget() / (1024 * 1024));
+        ImGui::SameLine();
+        if (ImGui::Button("Clear"))
+            noiseCache.clear();
+        renderProgress = RenderPool::get().progress();
+        if (ImGui::CollapsingHeader("Progress")) {
+            ImGui::Text("Render Progress: ");
+            ImGui::ProgressBar(getRenderProgress());
+        }
+        ImGui::Text("Tree %p, Saved %p, Last %p", tree, saved_tree, last_tree);
+        if (ImGui::CollapsingHeader("Operator Profile")) {
+            if (operatorProfilingEnabled())
+                drawProfile();
+            else
+                ImGui::Text("Operator profiling is compiled out, configure with -DENABLE_OP_PROFILE=ON to enable it");
+        }
+        if (tree != nullptr) {
+            auto program = tree->getCompiled();
+            ImGui::Text("Instructions per pixel: %zu (%u invariant operators hoisted)", program->slotCount(), program->getFoldedCount());
+            ImGui::Text("Instructions per row / column: %zu (%zu x-only, %zu y-only subtrees)", program->axisInstructionCount(),
+                        program->getColumns().size(), program->getRows().size());
+        }
+        if (isRendering()) {
+            ImGui::Text("Eval: rendering on %zu threads", RenderPool::get().threadCount());
+        } else {
+            // only changes when a render finishes
+            if (!fitnessValid) {
+                if (fitnessFused)
+                    evaluatePostMetrics(pixels, scores);
+                else
+                    GeneticTree::evaluate(pixels, scores);
+                fitnessValid = true;
+            }
+            for (size_t i = 0; i < scores.metrics.size(); i++)
+                ImGui::Text("Eval %s: %f", fitnessMetric(scores.metrics[i]).name.c_str(), scores.values[i]);
+        }
+    }
+    
+    void Program::startRender() {
+        tree->beginProcessImage(pixels, useJit ? RenderBackend::JIT : RenderBackend::INTERPRETER, useFloat ? Precision::FLOAT : Precision::DOUBLE, &scores);
+        fitnessValid = false;
+        fitnessFused = true;
+        profileValid = false;
+    }
+    
+    void Program::regenTreeDisplay() {
+        treeNodes = {};
+        for (int i = 0; i < tree->getSize(); i++){
+            auto node = tree->node(i);
+            if (node == nullptr)
+                continue;
+            auto height = GeneticTree::height(i);
+            ImNode_t n;
+            
+            n.height = height;
+            n.id = node->op;
+            n.index = i;
+            n.selected = false;
+            n.pos = {(float)i * 100, 0};
+            n.inputs[0] = {"In", 1};
+            n.outputs[0] = {"Left", 1};
+            n.outputs[1] = {"Right", 1};
+            
+            treeNodes.push_back(n);
+        }
+    }
+    
+    void Program::draw() {
+        static ImNodes::Ez::Context* context = ImNodes::Ez::CreateContext();
+        IM_UNUSED(context);
+        
+        if (ImGui::Begin("ImNodes", nullptr, ImGuiWindowFlags_NoScrollbar | ImGuiWindowFlags_NoScrollWithMouse))
+        {
+            ImNodes::Ez::BeginCanvas();
+            
+            for (ImNode_t& node : treeNodes)
+            {
+                if (ImNodes::Ez::BeginNode(&node, ("H: " + std::to_string(node.height) + " | I: " + std::to_string(node.index) + " : " + functions[node.id].name).c_str(), &node.pos, &node.selected))
+                {
+                    if(functions[node.id].allowsArgument())
+                        ImGui::Text("Left Tree: %d", GeneticTree::left(node.index));
+                    if (functions[node.id].bothArgument() || functions[node.id].dontCareArgument())
+                        ImGui::Text("Right Tree: %d", GeneticTree::right(node.index));
+                    //ImNodes::Ez::InputSlots(node.inputs, 1);
+                    //ImNodes::Ez::OutputSlots(node.outputs, 2);
+                    ImNodes::Ez::EndNode();
+                }
+//                auto p = GeneticTree::parent(node.index);
+//                auto parent = tree->node(p);
+//                if (p >= 0 && parent != nullptr) {
+//                    //BLT_TRACE("Parent i: %d, Parent %d for input node %d", p, parent, node.index);
+//                    if (GeneticTree::left(p) == node.index)
+//                        ImNodes::Connection(&node, "In", &parent, "Left");
+//                    else
+//                        ImNodes::Connection(&node, "In", &parent, "Right");
+//                }
+            }
+            //ImNodes::Connection(&nodes[2], "In", &nodes[0], "Out");
+            
+            ImNodes::Ez::EndCanvas();
+        }
+        ImGui::End();
+    }
+    
+}
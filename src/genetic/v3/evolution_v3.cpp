@@ -0,0 +1,173 @@
+//
+// Created by brett on 7/28/23.
+//
+#include <genetic/v3/evolution_v3.h>
+#include <parks/trace.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <optional>
+
+namespace parks::genetic {
+    
+    // member indices, fittest first
+    static std::vector<size_t> ranking(const std::vector<double>& fitness) {
+        std::vector<size_t> order(fitness.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&fitness](size_t a, size_t b) {
+            return fitness[a] > fitness[b];
+        });
+        return order;
+    }
+    
+    Population::Population(EvolutionConfig config): config(std::move(config)) {
+        this->config.populationSize = std::max<size_t>(1, this->config.populationSize);
+        this->config.tournamentSize = std::max<size_t>(1, this->config.tournamentSize);
+        this->config.eliteCount = std::min(this->config.eliteCount, this->config.populationSize);
+    }
+    
+    void Population::retire() {
+        trace::Scope scope("retire generation", "evolution");
+        auto& arena = arenas[currentArena];
+        for (auto* member : members) {
+            // migrants and anything else made outside the arena still own their nodes
+            if (member->getArena() == &arena)
+                member->abandonNodes();
+            delete member;
+        }
+        members.clear();
+        arena.release();
+    }
+    
+    size_t Population::evaluate() {
+        trace::Scope scope("evaluate population", "evolution");
+        if (config.screen) {
+            auto report = screenCandidates(members, fitness, config.screening);
+            return report.survivors.empty() ? members.size() : report.survivors.back();
+        }
+        
+        std::vector<unsigned char> pixels(WIDTH * HEIGHT * CHANNELS);
+        fitness.resize(members.size());
+        for (size_t i = 0; i < members.size(); i++) {
+            auto scores = config.screening.metrics;
+            members[i]->processImage(pixels.data(), RenderBackend::INTERPRETER, Precision::DOUBLE, &scores);
+            auto value = scores.combined();
+            fitness[i] = std::isnan(value) ? -std::numeric_limits<double>::infinity() : value;
+        }
+        return members.size();
+    }
+    
+    GeneticTree* Population::select() {
+        size_t winner = randomInt(0, (int) members.size());
+        for (size_t i = 1; i < config.tournamentSize; i++) {
+            size_t challenger = randomInt(0, (int) members.size());
+            if (fitness[challenger] > fitness[winner])
+                winner = challenger;
+        }
+        return members[winner];
+    }
+    
+    GenerationStats Population::stats(size_t evaluations, double seconds) const {
+        GenerationStats stats;
+        stats.generation = generation;
+        stats.evaluations = evaluations;
+        stats.seconds = seconds;
+        stats.best = -std::numeric_limits<double>::infinity();
+        size_t scored = 0;
+        for (auto value : fitness) {
+            if (!std::isfinite(value))
+                continue;
+            stats.best = std::max(stats.best, value);
+            stats.mean += value;
+            scored++;
+        }
+        if (scored > 0)
+            stats.mean /= (double) scored;
+        return stats;
+    }
+    
+    GenerationStats Population::initialize() {
+        auto start = std::chrono::steady_clock::now();
+        retire();
+        {
+            std::optional<ArenaScope> scope;
+            if (config.arena)
+                scope.emplace(arenas[currentArena]);
+            for (size_t i = 0; i < config.populationSize; i++)
+                members.push_back(new GeneticTree(config.treeHeight));
+        }
+        generation = 0;
+        auto evaluations = evaluate();
+        auto end = std::chrono::steady_clock::now();
+        return stats(evaluations, std::chrono::duration<double>(end - start).count());
+    }
+    
+    GenerationStats Population::step() {
+        trace::Scope scope("generation", "evolution", (int64_t) generation + 1);
+        auto start = std::chrono::steady_clock::now();
+        if (members.empty())
+            initialize();
+        
+        auto order = ranking(fitness);
+        
+        // survivors are copied into the next arena, so the whole of the current one can be dropped afterwards
+        auto nextArena = currentArena ^ 1;
+        std::vector<GeneticTree*> next;
+        next.reserve(config.populationSize);
+        {
+            std::optional<ArenaScope> scope;
+            if (config.arena)
+                scope.emplace(arenas[nextArena]);
+            for (size_t i = 0; i < config.eliteCount; i++)
+                next.push_back(members[order[i]]->copy());
+            while (next.size() < config.populationSize)
+                next.push_back(GeneticTree::breed(select(), select()));
+        }
+        
+        retire();
+        members = std::move(next);
+        currentArena = nextArena;
+        generation++;
+        
+        auto evaluations = evaluate();
+        auto end = std::chrono::steady_clock::now();
+        return stats(evaluations, std::chrono::duration<double>(end - start).count());
+    }
+    
+    std::vector<std::pair<GeneticTree*, double>> Population::fittest(size_t n) const {
+        auto order = ranking(fitness);
+        std::vector<std::pair<GeneticTree*, double>> trees;
+        for (size_t i = 0; i < std::min(n, order.size()); i++)
+            trees.emplace_back(members[order[i]]->copy(), fitness[order[i]]);
+        return trees;
+    }
+    
+    void Population::replaceWorst(const std::vector<std::pair<GeneticTree*, double>>& trees) {
+        auto order = ranking(fitness);
+        size_t replaced = 0;
+        for (const auto& [tree, value] : trees) {
+            if (replaced == order.size()) {
+                delete tree;
+                continue;
+            }
+            auto index = order[order.size() - 1 - replaced++];
+            delete members[index];
+            members[index] = tree;
+            fitness[index] = value;
+        }
+    }
+    
+    GeneticTree* Population::best() const {
+        if (members.empty())
+            return nullptr;
+        auto it = std::max_element(fitness.begin(), fitness.end());
+        return members[it - fitness.begin()];
+    }
+    
+    Population::~Population() {
+        retire();
+    }
+    
+}
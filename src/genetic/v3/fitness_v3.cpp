@@ -0,0 +1,372 @@
+//
+// Created by brett on 7/28/23.
+//
+#include <genetic/v3/fitness_v3.h>
+#include <genetic/v3/render_pool.h>
+#include <parks/trace.h>
+#include <parks/perf_counters.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#ifdef __AVX2__
+    #include <immintrin.h>
+#endif
+
+namespace parks::genetic {
+    
+    // adds one to counts[i] wherever a[i] == b[i]
+    static inline void countEqual(const uint32_t* a, const uint32_t* b, int n, int32_t* counts) {
+        int i = 0;
+#ifdef __AVX2__
+        for (; i + 8 <= n; i += 8) {
+            auto va = _mm256_loadu_si256((const __m256i*) (a + i));
+            auto vb = _mm256_loadu_si256((const __m256i*) (b + i));
+            auto c = _mm256_loadu_si256((const __m256i*) (counts + i));
+            // equal lanes are -1
+            _mm256_storeu_si256((__m256i*) (counts + i), _mm256_sub_epi32(c, _mm256_cmpeq_epi32(va, vb)));
+        }
+#endif
+        for (; i < n; i++)
+            counts[i] += a[i] == b[i];
+    }
+    
+    // adds one to counts[i] wherever a[i] == value
+    static inline void countEqual(const uint32_t* a, uint32_t value, int n, int32_t* counts) {
+        int i = 0;
+#ifdef __AVX2__
+        auto vb = _mm256_set1_epi32((int) value);
+        for (; i + 8 <= n; i += 8) {
+            auto va = _mm256_loadu_si256((const __m256i*) (a + i));
+            auto c = _mm256_loadu_si256((const __m256i*) (counts + i));
+            _mm256_storeu_si256((__m256i*) (counts + i), _mm256_sub_epi32(c, _mm256_cmpeq_epi32(va, vb)));
+        }
+#endif
+        for (; i < n; i++)
+            counts[i] += a[i] == value;
+    }
+    
+    // number of offsets in [-radius, radius] which keep v inside [0, size)
+    static inline int validOffsets(int v, int radius, int size) {
+        return std::min(v + radius, size - 1) - std::max(v - radius, 0) + 1;
+    }
+    
+    static inline double ratio(int same, int count) {
+        if (count == 0)
+            return 0;
+        return (double) same / (double) count;
+    }
+    
+    // counts the matching neighbours of every pixel in rows [firstRow, firstRow + rows), similar ones into the first
+    // plane and around ones into the second. keys must hold those rows, the AROUND_RADIUS rows either side and the
+    // patch at the top
+    static void similarityBand(const uint32_t* keys, unsigned int imageWidth, unsigned int imageHeight, unsigned int firstRow, unsigned int rows,
+                               uint8_t* counts) {
+        const int width = (int) imageWidth;
+        const int height = (int) imageHeight;
+        auto* similar = counts;
+        auto* around = counts + (size_t) width * height;
+        std::vector<int32_t> similarCounts(width);
+        std::vector<int32_t> aroundCounts(width);
+        
+        for (int y = (int) firstRow; y < (int) (firstRow + rows); y++) {
+            std::fill(similarCounts.begin(), similarCounts.end(), 0);
+            std::fill(aroundCounts.begin(), aroundCounts.end(), 0);
+            const auto* row = &keys[y * width];
+            
+            for (int dy = -AROUND_RADIUS; dy <= AROUND_RADIUS; dy++) {
+                int ny = y + dy;
+                if (ny < 0 || ny >= height)
+                    continue;
+                const auto* neighbours = &keys[ny * width];
+                for (int dx = -AROUND_RADIUS; dx <= AROUND_RADIUS; dx++) {
+                    // pixels whose neighbour at dx is inside the image
+                    int begin = std::max(0, -dx);
+                    int end = std::min(width, width - dx);
+                    
+                    if (dx != 0 || dy != 0)
+                        countEqual(row + begin, neighbours + begin + dx, end - begin, aroundCounts.data() + begin);
+                    
+                    // similarity compares the neighbour against the pixel at the same offset in the fixed patch
+                    // around (SIMILARITY_RADIUS + 1, SIMILARITY_RADIUS + 1)
+                    if (std::abs(dx) <= SIMILARITY_RADIUS && std::abs(dy) <= SIMILARITY_RADIUS) {
+                        auto patch = keys[(SIMILARITY_RADIUS + 1 + dy) * width + SIMILARITY_RADIUS + 1 + dx];
+                        countEqual(neighbours + begin + dx, patch, end - begin, similarCounts.data() + begin);
+                    }
+                }
+            }
+            
+            for (int x = 0; x < width; x++) {
+                similar[y * width + x] = (uint8_t) similarCounts[x];
+                around[y * width + x] = (uint8_t) aroundCounts[x];
+            }
+        }
+    }
+    
+    static double similaritySum(const unsigned char* pixels, const uint8_t* counts, unsigned int imageWidth, unsigned int imageHeight) {
+        const int width = (int) imageWidth;
+        const int height = (int) imageHeight;
+        const auto* similar = counts;
+        const auto* around = counts + (size_t) width * height;
+        
+        // same order of operations as the reference so the sum comes out bit for bit identical
+        double val = 0;
+        for (int i = 0; i < width; i++) {
+            for (int j = 0; j < height; j++) {
+                auto key = j * width + i;
+                auto pos = key * CHANNELS;
+                
+                auto r = pixels[pos];
+                auto g = pixels[pos + 1];
+                auto b = pixels[pos + 2];
+                
+                int similarCount = validOffsets(i, SIMILARITY_RADIUS, width) * validOffsets(j, SIMILARITY_RADIUS, height);
+                int aroundCount = validOffsets(i, AROUND_RADIUS, width) * validOffsets(j, AROUND_RADIUS, height) - 1;
+                
+                val -= ratio(similar[key], similarCount);
+                val -= ratio(around[key], aroundCount);
+                
+                val += (r / 255.0 + g / 255.0 + b / 255.0) / (imageWidth * imageHeight * CHANNELS);
+            }
+        }
+        return val;
+    }
+    
+    double evaluateFitness(const unsigned char* pixels, unsigned int width, unsigned int height) {
+        trace::Scope scope("evaluateFitness", "fitness");
+        FitnessScores scores{MetricID::SIMILARITY};
+        scores.values.assign(1, std::numeric_limits<double>::quiet_NaN());
+        // whole rows as tiles, so each task packs one band and counts whichever bands it completes
+        FitnessReduction reduction(scores, pixels, width, height, width);
+        auto bands = (height + FITNESS_BAND_HEIGHT - 1) / FITNESS_BAND_HEIGHT;
+        
+        auto& pool = RenderPool::get();
+        pool.dispatch(bands, [&](size_t task, size_t) {
+            trace::Scope bandScope("fitness band", "fitness", (int64_t) task);
+            perf::Scope counters(perf::Phase::FITNESS);
+            auto y = (unsigned int) task * FITNESS_BAND_HEIGHT;
+            reduction.accumulate(task, 0, y, width, std::min(FITNESS_BAND_HEIGHT, height - y));
+        });
+        pool.wait();
+        
+        reduction.finish(scores);
+        return scores.values[0];
+    }
+    
+    // calls func(r, g, b) for every pixel in the rectangle
+    template<typename F>
+    static inline void forEachPixel(const unsigned char* tile, unsigned int width, unsigned int height, size_t stride, F func) {
+        for (unsigned int j = 0; j < height; j++) {
+            const auto* p = tile + j * stride * CHANNELS;
+            for (unsigned int i = 0; i < width; i++, p += CHANNELS)
+                func(p[0], p[1], p[2]);
+        }
+    }
+    
+    static void sumTotals(MetricTotals& into, const MetricTotals& tile) {
+        for (size_t i = 0; i < std::size(into.v); i++)
+            into.v[i] += tile.v[i];
+        into.pixels += tile.pixels;
+    }
+    
+    // v[0] holds the sum of every channel
+    static void accumulateBrightness(const unsigned char* tile, unsigned int width, unsigned int height, size_t stride, MetricTotals& totals) {
+        long sum = 0;
+        forEachPixel(tile, width, height, stride, [&](int r, int g, int b) {
+            sum += r + g + b;
+        });
+        totals.v[0] += (double) sum;
+    }
+    
+    static double finishBrightness(const MetricTotals& totals) {
+        return totals.v[0] / (255.0 * (double) totals.pixels * CHANNELS);
+    }
+    
+    // v[0] is the sum of luma, v[1] the sum of squared luma. luma is kept in 0-255 * 1000 so the sums stay integers
+    static void accumulateContrast(const unsigned char* tile, unsigned int width, unsigned int height, size_t stride, MetricTotals& totals) {
+        long sum = 0, squares = 0;
+        forEachPixel(tile, width, height, stride, [&](int r, int g, int b) {
+            long luma = 299 * r + 587 * g + 114 * b;
+            sum += luma;
+            squares += luma * luma;
+        });
+        totals.v[0] += (double) sum;
+        totals.v[1] += (double) squares;
+    }
+    
+    // standard deviation of the luma in 0-1
+    static double finishContrast(const MetricTotals& totals) {
+        auto pixels = (double) totals.pixels;
+        auto mean = totals.v[0] / pixels;
+        auto variance = std::max(0.0, totals.v[1] / pixels - mean * mean);
+        return std::sqrt(variance) / (255.0 * 1000.0);
+    }
+    
+    // Hasler and Suesstrunk's colourfulness over the opponent channels rg = r - g and yb = (r + g) / 2 - b, kept doubled
+    // so they're integers: v[0] and v[1] sum 2rg and 2yb, v[2] and v[3] their squares
+    static void accumulateColorfulness(const unsigned char* tile, unsigned int width, unsigned int height, size_t stride, MetricTotals& totals) {
+        long rgSum = 0, ybSum = 0, rgSquares = 0, ybSquares = 0;
+        forEachPixel(tile, width, height, stride, [&](int r, int g, int b) {
+            long rg = 2 * (r - g);
+            long yb = r + g - 2 * b;
+            rgSum += rg;
+            ybSum += yb;
+            rgSquares += rg * rg;
+            ybSquares += yb * yb;
+        });
+        totals.v[0] += (double) rgSum;
+        totals.v[1] += (double) ybSum;
+        totals.v[2] += (double) rgSquares;
+        totals.v[3] += (double) ybSquares;
+    }
+    
+    static double finishColorfulness(const MetricTotals& totals) {
+        auto pixels = (double) totals.pixels;
+        auto rgMean = totals.v[0] / pixels;
+        auto ybMean = totals.v[1] / pixels;
+        auto rgVariance = std::max(0.0, totals.v[2] / pixels - rgMean * rgMean);
+        auto ybVariance = std::max(0.0, totals.v[3] / pixels - ybMean * ybMean);
+        auto deviation = std::sqrt(rgVariance + ybVariance);
+        auto mean = std::sqrt(rgMean * rgMean + ybMean * ybMean);
+        // undo the doubling and scale into 0-1
+        return (deviation + 0.3 * mean) / (2 * 255.0);
+    }
+    
+    // indexed by MetricID
+    static const FitnessMetric metrics[METRIC_COUNT] = {
+            // the patch is rows 1 to 2 * SIMILARITY_RADIUS + 1, the counts are one plane of similar and one of around
+            {"Similarity", AROUND_RADIUS, 2 * SIMILARITY_RADIUS + 2, 2, similarityBand, similaritySum},
+            {"Brightness", accumulateBrightness, sumTotals, finishBrightness},
+            {"Contrast", accumulateContrast, sumTotals, finishContrast},
+            {"Colorfulness", accumulateColorfulness, sumTotals, finishColorfulness},
+    };
+    
+    const FitnessMetric& fitnessMetric(MetricID id) {
+        return metrics[(int) id];
+    }
+    
+    double FitnessScores::combined() const {
+        double total = 0;
+        for (size_t i = 0; i < metrics.size() && i < values.size(); i++)
+            total += values[i] * (i < weights.size() ? weights[i] : 1.0);
+        return total;
+    }
+    
+    double FitnessScores::get(MetricID id) const {
+        for (size_t i = 0; i < metrics.size() && i < values.size(); i++) {
+            if (metrics[i] == id)
+                return values[i];
+        }
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    
+    FitnessReduction::FitnessReduction(const FitnessScores& scores, const unsigned char* pixels, unsigned int width, unsigned int height,
+                                       unsigned int tileWidth): pixels(pixels), width(width), height(height) {
+        unsigned int halo = 0, top = 0;
+        for (auto id : scores.metrics) {
+            const auto& metric = fitnessMetric(id);
+            if (metric.fused())
+                fused.push_back(id);
+            else if (metric.banded()) {
+                banded.push_back(id);
+                halo = std::max(halo, metric.halo());
+                top = std::max(top, metric.anchorRows());
+            }
+        }
+        tilesX = (width + tileWidth - 1) / tileWidth;
+        bands = (height + FITNESS_BAND_HEIGHT - 1) / FITNESS_BAND_HEIGHT;
+        totals.resize(fused.size() * tilesX * bands);
+        if (banded.empty())
+            return;
+        
+        keys.resize((size_t) width * height);
+        size_t planes = 0;
+        for (auto id : banded) {
+            countOffsets.push_back(planes * width * height);
+            planes += fitnessMetric(id).planes();
+        }
+        counts.resize(planes * width * height);
+        haloBands = (halo + FITNESS_BAND_HEIGHT - 1) / FITNESS_BAND_HEIGHT;
+        anchorBands = std::min(bands, (top + FITNESS_BAND_HEIGHT - 1) / FITNESS_BAND_HEIGHT);
+        pending = std::make_unique<std::atomic<unsigned int>[]>(bands);
+        for (unsigned int band = 0; band < bands; band++) {
+            unsigned int dependencies = 0;
+            for (unsigned int other = 0; other < bands; other++) {
+                auto distance = band > other ? band - other : other - band;
+                dependencies += distance <= haloBands || other < anchorBands;
+            }
+            pending[band] = dependencies * tilesX;
+        }
+    }
+    
+    void FitnessReduction::accumulate(size_t tile, unsigned int x, unsigned int y, unsigned int tileWidth, unsigned int tileHeight) {
+        const auto* start = pixels + ((size_t) y * width + x) * CHANNELS;
+        for (size_t i = 0; i < fused.size(); i++) {
+            auto& tileTotals = totals[tile * fused.size() + i];
+            fitnessMetric(fused[i]).accumulate(start, tileWidth, tileHeight, width, tileTotals);
+            tileTotals.pixels += (size_t) tileWidth * tileHeight;
+        }
+        if (banded.empty())
+            return;
+        
+        for (unsigned int j = y; j < y + tileHeight; j++) {
+            const auto* p = pixels + ((size_t) j * width + x) * CHANNELS;
+            auto* key = &keys[(size_t) j * width + x];
+            for (unsigned int i = 0; i < tileWidth; i++, p += CHANNELS)
+                key[i] = p[0] | (p[1] << 8) | (p[2] << 16);
+        }
+        
+        // every band depends on the anchor bands, the rest only on the bands in their halo
+        auto band = y / FITNESS_BAND_HEIGHT;
+        unsigned int first = 0, last = bands - 1;
+        if (band >= anchorBands) {
+            first = band - std::min(band, haloBands);
+            last = std::min(bands - 1, band + haloBands);
+        }
+        for (auto dependent = first; dependent <= last; dependent++) {
+            // the acquire sees the keys every other tile of the band's halo wrote before its release
+            if (pending[dependent].fetch_sub(1, std::memory_order_acq_rel) == 1)
+                countBand(dependent);
+        }
+    }
+    
+    void FitnessReduction::countBand(unsigned int band) {
+        trace::Scope scope("count band", "fitness", band);
+        auto y = band * FITNESS_BAND_HEIGHT;
+        auto rows = std::min(FITNESS_BAND_HEIGHT, height - y);
+        // every band writes only its own rows of the planes, the pool's wait publishes them to finish()
+        for (size_t i = 0; i < banded.size(); i++)
+            fitnessMetric(banded[i]).countBand(keys.data(), width, height, y, rows, counts.data() + countOffsets[i]);
+    }
+    
+    void FitnessReduction::finish(FitnessScores& scores) const {
+        auto write = [&scores](MetricID id, double value) {
+            for (size_t m = 0; m < scores.metrics.size(); m++) {
+                if (scores.metrics[m] == id)
+                    scores.values[m] = value;
+            }
+        };
+        auto tiles = (size_t) tilesX * bands;
+        for (size_t i = 0; i < fused.size(); i++) {
+            const auto& metric = fitnessMetric(fused[i]);
+            MetricTotals merged;
+            for (size_t tile = 0; tile < tiles; tile++)
+                metric.merge(merged, totals[tile * fused.size() + i]);
+            write(fused[i], metric.finish(merged));
+        }
+        for (size_t i = 0; i < banded.size(); i++)
+            write(banded[i], fitnessMetric(banded[i]).sum(pixels, counts.data() + countOffsets[i], width, height));
+    }
+    
+    void evaluatePostMetrics(const unsigned char* pixels, FitnessScores& scores, unsigned int width, unsigned int height) {
+        trace::Scope scope("evaluatePostMetrics", "fitness");
+        scores.values.resize(scores.metrics.size(), std::numeric_limits<double>::quiet_NaN());
+        for (size_t i = 0; i < scores.metrics.size(); i++) {
+            const auto& metric = fitnessMetric(scores.metrics[i]);
+            if (!metric.fused() && !metric.banded())
+                scores.values[i] = metric.evaluate(pixels, width, height);
+        }
+    }
+    
+}
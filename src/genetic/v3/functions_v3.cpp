@@ -2,65 +2,247 @@
 // Created by brett on 7/17/23.
 //
 #include <genetic/v3/functions_v3.h>
+#include <genetic/v3/noise_v3.h>
 #include <stb/stb_perlin.h>
 
+#ifdef __AVX2__
+    #include <immintrin.h>
+#endif
+
 namespace parks::genetic {
     
+    // same clamping as the three argument Color constructor
     template<typename T>
-    inline Color applyFunc(T op, Color left, Color right) {
-        return Color(op(left.r, right.r), op(left.g, right.g), op(left.b, right.b));
+    static inline T normalizeChannel(T v) {
+        if (v < 0)
+            v = std::abs(v);
+        if (v > 1)
+            v = v - std::trunc(v);
+        return v;
     }
+
+#ifdef __AVX2__
+    // the intrinsics used by the batch operators for one element type, so each operator is only written once
+    template<typename T>
+    struct Simd;
     
-    Color add(OperatorArguments args, const ParameterSet& params) {
-        return applyFunc(std::plus(), args.left, args.right);
-    }
+    template<>
+    struct Simd<double> {
+        typedef __m256d vec;
+        static constexpr unsigned int width = 4;
+        static inline vec load(const double* p) { return _mm256_load_pd(p); }
+        static inline void store(double* p, vec v) { _mm256_store_pd(p, v); }
+        static inline vec set(double v) { return _mm256_set1_pd(v); }
+        static inline vec add(vec l, vec r) { return _mm256_add_pd(l, r); }
+        static inline vec sub(vec l, vec r) { return _mm256_sub_pd(l, r); }
+        static inline vec mul(vec l, vec r) { return _mm256_mul_pd(l, r); }
+        static inline vec div(vec l, vec r) { return _mm256_div_pd(l, r); }
+        static inline vec min(vec l, vec r) { return _mm256_min_pd(l, r); }
+        static inline vec max(vec l, vec r) { return _mm256_max_pd(l, r); }
+        static inline vec bitAnd(vec l, vec r) { return _mm256_and_pd(l, r); }
+        static inline vec bitAndNot(vec l, vec r) { return _mm256_andnot_pd(l, r); }
+        static inline vec bitOr(vec l, vec r) { return _mm256_or_pd(l, r); }
+        static inline vec less(vec l, vec r) { return _mm256_cmp_pd(l, r, _CMP_LT_OQ); }
+        static inline vec lessEqual(vec l, vec r) { return _mm256_cmp_pd(l, r, _CMP_LE_OQ); }
+        static inline vec blend(vec a, vec b, vec mask) { return _mm256_blendv_pd(a, b, mask); }
+        static inline vec truncate(vec v) { return _mm256_round_pd(v, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC); }
+        // round trip through int32, cvttpd2dq produces the same out of range value as the scalar (int) cast
+        static inline vec truncateInt(vec v) { return _mm256_cvtepi32_pd(_mm256_cvttpd_epi32(v)); }
+    };
     
-    Color subtract(OperatorArguments args, const ParameterSet& params) {
-        return applyFunc(std::minus(), args.left, args.right);;
+    template<>
+    struct Simd<float> {
+        typedef __m256 vec;
+        static constexpr unsigned int width = 8;
+        static inline vec load(const float* p) { return _mm256_load_ps(p); }
+        static inline void store(float* p, vec v) { _mm256_store_ps(p, v); }
+        static inline vec set(float v) { return _mm256_set1_ps(v); }
+        static inline vec add(vec l, vec r) { return _mm256_add_ps(l, r); }
+        static inline vec sub(vec l, vec r) { return _mm256_sub_ps(l, r); }
+        static inline vec mul(vec l, vec r) { return _mm256_mul_ps(l, r); }
+        static inline vec div(vec l, vec r) { return _mm256_div_ps(l, r); }
+        static inline vec min(vec l, vec r) { return _mm256_min_ps(l, r); }
+        static inline vec max(vec l, vec r) { return _mm256_max_ps(l, r); }
+        static inline vec bitAnd(vec l, vec r) { return _mm256_and_ps(l, r); }
+        static inline vec bitAndNot(vec l, vec r) { return _mm256_andnot_ps(l, r); }
+        static inline vec bitOr(vec l, vec r) { return _mm256_or_ps(l, r); }
+        static inline vec less(vec l, vec r) { return _mm256_cmp_ps(l, r, _CMP_LT_OQ); }
+        static inline vec lessEqual(vec l, vec r) { return _mm256_cmp_ps(l, r, _CMP_LE_OQ); }
+        static inline vec blend(vec a, vec b, vec mask) { return _mm256_blendv_ps(a, b, mask); }
+        static inline vec truncate(vec v) { return _mm256_round_ps(v, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC); }
+        static inline vec truncateInt(vec v) { return _mm256_cvtepi32_ps(_mm256_cvttps_epi32(v)); }
+    };
+    
+    template<typename T>
+    static inline typename Simd<T>::vec normalizeChannel(typename Simd<T>::vec v) {
+        typedef Simd<T> S;
+        const auto sign = S::set(-0.0);
+        v = S::blend(v, S::bitAndNot(sign, v), S::less(v, S::set(0)));
+        auto frac = S::sub(v, S::truncate(v));
+        return S::blend(v, frac, S::less(S::set(1), v));
     }
+#endif
+    
+    // each batch operator provides a scalar version and, when built with AVX2, a vector version which must agree bit for bit
+    template<typename T>
+    struct AddOp {
+        inline T operator()(T l, T r) const { return l + r; }
+#ifdef __AVX2__
+        typedef Simd<T> S;
+        inline typename S::vec operator()(typename S::vec l, typename S::vec r) const { return S::add(l, r); }
+#endif
+    };
     
-    Color multiply(OperatorArguments args, const ParameterSet& params) {
-        return applyFunc(std::multiplies(), args.left, args.right);
+    template<typename T>
+    struct SubtractOp {
+        inline T operator()(T l, T r) const { return l - r; }
+#ifdef __AVX2__
+        typedef Simd<T> S;
+        inline typename S::vec operator()(typename S::vec l, typename S::vec r) const { return S::sub(l, r); }
+#endif
+    };
+    
+    template<typename T>
+    struct MultiplyOp {
+        inline T operator()(T l, T r) const { return l * r; }
+#ifdef __AVX2__
+        typedef Simd<T> S;
+        inline typename S::vec operator()(typename S::vec l, typename S::vec r) const { return S::mul(l, r); }
+#endif
+    };
+    
+    template<typename T>
+    struct DivideOp {
+        inline T operator()(T l, T r) const { return l / r; }
+#ifdef __AVX2__
+        typedef Simd<T> S;
+        inline typename S::vec operator()(typename S::vec l, typename S::vec r) const { return S::div(l, r); }
+#endif
+    };
+    
+    template<typename T>
+    struct ModOp {
+        // fast_fmod, written out so the float version stays in single precision
+        inline T operator()(T l, T r) const {
+            T reciprocal = T(1) / r;
+            return l - r * (T) (int) (l * reciprocal);
+        }
+#ifdef __AVX2__
+        typedef Simd<T> S;
+        inline typename S::vec operator()(typename S::vec l, typename S::vec r) const {
+            auto quotient = S::truncateInt(S::mul(l, S::div(S::set(1), r)));
+            return S::sub(l, S::mul(r, quotient));
+        }
+#endif
+    };
+    
+    template<typename T>
+    struct MinOp {
+        inline T operator()(T l, T r) const { return std::min(l, r); }
+#ifdef __AVX2__
+        typedef Simd<T> S;
+        // minpd returns the second operand on NaN / equality, which is what std::min(l, r) does when given (r, l)
+        inline typename S::vec operator()(typename S::vec l, typename S::vec r) const { return S::min(r, l); }
+#endif
+    };
+    
+    template<typename T>
+    struct MaxOp {
+        inline T operator()(T l, T r) const { return std::max(l, r); }
+#ifdef __AVX2__
+        typedef Simd<T> S;
+        inline typename S::vec operator()(typename S::vec l, typename S::vec r) const { return S::max(r, l); }
+#endif
+    };
+    
+    template<typename T>
+    struct RoundOp {
+        inline T operator()(T l, T) const { return std::round(l); }
+#ifdef __AVX2__
+        typedef Simd<T> S;
+        // round half away from zero, roundpd only offers banker's rounding
+        inline typename S::vec operator()(typename S::vec l, typename S::vec) const {
+            const auto sign = S::set(-0.0);
+            auto truncated = S::truncate(l);
+            auto diff = S::bitAndNot(sign, S::sub(l, truncated));
+            auto roundAway = S::lessEqual(S::set(0.5), diff);
+            auto step = S::bitOr(S::bitAnd(l, sign), S::set(1));
+            return S::blend(truncated, S::add(truncated, step), roundAway);
+        }
+#endif
+    };
+    
+    template<typename T>
+    struct AbsOp {
+        inline T operator()(T l, T) const { return std::abs(l); }
+#ifdef __AVX2__
+        typedef Simd<T> S;
+        inline typename S::vec operator()(typename S::vec l, typename S::vec) const { return S::bitAndNot(S::set(-0.0), l); }
+#endif
+    };
+    
+    template<typename T, typename Op>
+    static inline void applyChannel(Op op, const T* left, const T* right, T* out) {
+#ifdef __AVX2__
+        typedef Simd<T> S;
+        for (unsigned int i = 0; i < BATCH_SIZE; i += S::width)
+            S::store(out + i, normalizeChannel<T>(op(S::load(left + i), S::load(right + i))));
+#else
+        for (unsigned int i = 0; i < BATCH_SIZE; i++)
+            out[i] = normalizeChannel(op(left[i], right[i]));
+#endif
     }
     
-    Color divide(OperatorArguments args, const ParameterSet& params) {
-        return applyFunc(std::divides(), args.left, args.right);
+    template<typename T, typename Op>
+    static inline void applyBatch(Op op, const BasicColorBatch<T>& left, const BasicColorBatch<T>& right, BasicColorBatch<T>& out) {
+        applyChannel(op, left.r, right.r, out.r);
+        applyChannel(op, left.g, right.g, out.g);
+        applyChannel(op, left.b, right.b, out.b);
     }
     
-    Color mod(OperatorArguments args, const ParameterSet& params) {
-        return applyFunc(floatMod(), args.left, args.right);
+    template<typename T>
+    void addBatch(const BasicColorBatch<T>& left, const BasicColorBatch<T>& right, BasicColorBatch<T>& out) {
+        applyBatch(AddOp<T>(), left, right, out);
     }
     
-    Color round(OperatorArguments args, const ParameterSet& params) {
-        return Color(std::round(args.left.r), std::round(args.left.g), std::round(args.left.b));
+    template<typename T>
+    void subtractBatch(const BasicColorBatch<T>& left, const BasicColorBatch<T>& right, BasicColorBatch<T>& out) {
+        applyBatch(SubtractOp<T>(), left, right, out);
     }
     
-    Color min(OperatorArguments args, const ParameterSet& params) {
-        return Color(std::min(args.left.r, args.right.r), std::min(args.left.g, args.right.g), std::min(args.left.b, args.right.b));
+    template<typename T>
+    void multiplyBatch(const BasicColorBatch<T>& left, const BasicColorBatch<T>& right, BasicColorBatch<T>& out) {
+        applyBatch(MultiplyOp<T>(), left, right, out);
     }
     
-    Color max(OperatorArguments args, const ParameterSet& params) {
-        return Color(std::max(args.left.r, args.right.r), std::max(args.left.g, args.right.g), std::max(args.left.b, args.right.b));
+    template<typename T>
+    void divideBatch(const BasicColorBatch<T>& left, const BasicColorBatch<T>& right, BasicColorBatch<T>& out) {
+        applyBatch(DivideOp<T>(), left, right, out);
     }
     
-    Color abs(OperatorArguments args, const ParameterSet& params) {
-        return Color(std::abs(args.left.r), std::abs(args.left.g), std::abs(args.left.b));
+    template<typename T>
+    void modBatch(const BasicColorBatch<T>& left, const BasicColorBatch<T>& right, BasicColorBatch<T>& out) {
+        applyBatch(ModOp<T>(), left, right, out);
     }
     
-    Color log(OperatorArguments args, const ParameterSet& params) {
-        return Color(std::log(args.left.r), std::log(args.left.g), std::log(args.left.b));
+    template<typename T>
+    void minBatch(const BasicColorBatch<T>& left, const BasicColorBatch<T>& right, BasicColorBatch<T>& out) {
+        applyBatch(MinOp<T>(), left, right, out);
     }
     
-    Color sin(OperatorArguments args, const ParameterSet& params) {
-        return Color(std::sin(args.left.r), std::sin(args.left.g), std::sin(args.left.b));
+    template<typename T>
+    void maxBatch(const BasicColorBatch<T>& left, const BasicColorBatch<T>& right, BasicColorBatch<T>& out) {
+        applyBatch(MaxOp<T>(), left, right, out);
     }
     
-    Color cos(OperatorArguments args, const ParameterSet& params) {
-        return Color(std::cos(args.left.r), std::cos(args.left.g), std::cos(args.left.b));
+    template<typename T>
+    void roundBatch(const BasicColorBatch<T>& left, BasicColorBatch<T>& out) {
+        applyBatch(RoundOp<T>(), left, left, out);
     }
     
-    Color atan(OperatorArguments args, const ParameterSet& params) {
-        return Color(std::atan(args.left.r), std::atan(args.left.g), std::atan(args.left.b));
+    template<typename T>
+    void absBatch(const BasicColorBatch<T>& left, BasicColorBatch<T>& out) {
+        applyBatch(AbsOp<T>(), left, left, out);
     }
     
     const float lacunarity = 6;
@@ -86,28 +268,176 @@ namespace parks::genetic {
         return Color(r, g, b);
     }
     
-    Color randScalar(OperatorArguments args, const ParameterSet& params) {
-        return params[0];
+    static_assert(BATCH_SIZE % NOISE_LANES == 0, "noise is evaluated in whole groups of NOISE_LANES");
+    
+    template<typename T>
+    void noiseBatch(const BasicColorBatch<T>& left, const BasicColorBatch<T>& right, const ParameterSet& params, BasicColorBatch<T>& out) {
+        float noiseLacunarity = (float)params[0].r * lacunarity;
+        float noiseGain = (float)params[1].r * gain;
+        int noiseOctaves = (int)std::max(2.0, params[2].r * octaves);
+        
+        float x[NOISE_LANES], y[NOISE_LANES], z[NOISE_LANES], n[NOISE_LANES];
+        std::fill(z, z + NOISE_LANES, (float) 0.52342);
+        for (unsigned int i = 0; i < BATCH_SIZE; i += NOISE_LANES) {
+            for (unsigned int k = 0; k < NOISE_LANES; k++) {
+                x[k] = (float)left.r[i + k] * (float)params[3].r * scale;
+                y[k] = (float)right.r[i + k] * (float)params[3].r * scale;
+            }
+            turbulenceNoise(x, y, z, noiseLacunarity, noiseGain, noiseOctaves, n);
+            // single value colors aren't normalized
+            for (unsigned int k = 0; k < NOISE_LANES; k++) {
+                out.r[i + k] = (T) n[k];
+                out.g[i + k] = 0;
+                out.b[i + k] = 0;
+            }
+        }
     }
     
-    Color randColor(OperatorArguments args, const ParameterSet& params) {
-        return params[0];
+    template<typename T>
+    void colorNoiseBatch(const BasicColorBatch<T>& left, const BasicColorBatch<T>& right, const ParameterSet& params, BasicColorBatch<T>& out) {
+        float noiseLacunarity = (float)params[0].r * lacunarity;
+        float noiseGain = (float)params[1].r * gain;
+        int noiseOctaves = (int)std::max(2.0, params[2].r * octaves);
+        
+        // the constant coordinates of the three channels
+        float z[NOISE_LANES], gy[NOISE_LANES], bx[NOISE_LANES];
+        std::fill(z, z + NOISE_LANES, (float) 0.52342);
+        std::fill(gy, gy + NOISE_LANES, (float) 0.21045);
+        std::fill(bx, bx + NOISE_LANES, (float) 0.78423);
+        
+        float x[NOISE_LANES], y[NOISE_LANES], r[NOISE_LANES], g[NOISE_LANES], b[NOISE_LANES];
+        for (unsigned int i = 0; i < BATCH_SIZE; i += NOISE_LANES) {
+            for (unsigned int k = 0; k < NOISE_LANES; k++) {
+                x[k] = (float)left.r[i + k] * (float)params[3].r * scale;
+                y[k] = (float)right.r[i + k] * (float)params[4].r * scale;
+            }
+            turbulenceNoise(x, y, z, noiseLacunarity, noiseGain, noiseOctaves, r);
+            turbulenceNoise(x, gy, y, noiseLacunarity, noiseGain, noiseOctaves, g);
+            turbulenceNoise(bx, y, x, noiseLacunarity, noiseGain, noiseOctaves, b);
+            for (unsigned int k = 0; k < NOISE_LANES; k++) {
+                out.r[i + k] = (T) normalizeChannel((double) r[k]);
+                out.g[i + k] = (T) normalizeChannel((double) g[k]);
+                out.b[i + k] = (T) normalizeChannel((double) b[k]);
+            }
+        }
     }
     
-    FunctionStorage::FunctionStorage(
-            std::initializer_list<std::pair<FunctionID, Function*>>&& init
-    ) {
-        size_t max_value = init.size();
-        for (const auto& v : init){
-            int enumID = (int)v.first;
-            max_value = std::max(max_value, (size_t)enumID);
+    #define PARKS_INSTANTIATE_BATCH(T) \
+        template void addBatch(const BasicColorBatch<T>&, const BasicColorBatch<T>&, BasicColorBatch<T>&); \
+        template void subtractBatch(const BasicColorBatch<T>&, const BasicColorBatch<T>&, BasicColorBatch<T>&); \
+        template void multiplyBatch(const BasicColorBatch<T>&, const BasicColorBatch<T>&, BasicColorBatch<T>&); \
+        template void divideBatch(const BasicColorBatch<T>&, const BasicColorBatch<T>&, BasicColorBatch<T>&); \
+        template void modBatch(const BasicColorBatch<T>&, const BasicColorBatch<T>&, BasicColorBatch<T>&); \
+        template void minBatch(const BasicColorBatch<T>&, const BasicColorBatch<T>&, BasicColorBatch<T>&); \
+        template void maxBatch(const BasicColorBatch<T>&, const BasicColorBatch<T>&, BasicColorBatch<T>&); \
+        template void roundBatch(const BasicColorBatch<T>&, BasicColorBatch<T>&); \
+        template void absBatch(const BasicColorBatch<T>&, BasicColorBatch<T>&); \
+        template void noiseBatch(const BasicColorBatch<T>&, const BasicColorBatch<T>&, const ParameterSet&, BasicColorBatch<T>&); \
+        template void colorNoiseBatch(const BasicColorBatch<T>&, const BasicColorBatch<T>&, const ParameterSet&, BasicColorBatch<T>&);
+    
+    PARKS_INSTANTIATE_BATCH(double)
+    PARKS_INSTANTIATE_BATCH(float)
+    #undef PARKS_INSTANTIATE_BATCH
+    
+    AliasTable::AliasTable(const std::vector<std::pair<FunctionID, double>>& weights) {
+        double total = 0;
+        for (const auto& w : weights) {
+            if (w.second > 0) {
+                values.push_back(w.first);
+                total += w.second;
+            }
         }
-        functions = new Function*[max_value];
+        if (values.empty())
+            return;
         
-        for (auto& v : init){
-            functions[(int)v.first] = v.second;
-            functionsInStorage.insert(v.first);
+        // scale so the average column holds exactly 1, then top up every short column from a tall one (Vose)
+        std::vector<double> scaled;
+        for (const auto& w : weights) {
+            if (w.second > 0)
+                scaled.push_back(w.second * (double) values.size() / total);
+        }
+        keep.resize(values.size(), 1);
+        alias.resize(values.size());
+        std::vector<unsigned int> small, large;
+        for (unsigned int i = 0; i < values.size(); i++) {
+            alias[i] = i;
+            (scaled[i] < 1 ? small : large).push_back(i);
+        }
+        while (!small.empty() && !large.empty()) {
+            auto s = small.back();
+            small.pop_back();
+            auto l = large.back();
+            keep[s] = scaled[s];
+            alias[s] = l;
+            scaled[l] = (scaled[l] + scaled[s]) - 1;
+            if (scaled[l] < 1) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+        // whatever is left over is 1 up to rounding
+    }
+    
+    FunctionStorage::FunctionStorage() {
+        for (const auto& func : FUNCTION_TABLE)
+            registered.push_back(func.id);
+        weights.resize(FUNCTION_COUNT, 1);
+        buildTables();
+    }
+    
+    void FunctionStorage::buildTables() {
+        std::vector<std::pair<FunctionID, double>> all;
+        for (auto id : registered)
+            all.emplace_back(id, weights[(int) id]);
+        table = AliasTable(all);
+        
+        // mirrors what GeneticTree::generateRandomTree() is allowed to put below a node
+        childTables.clear();
+        childTables.resize(FUNCTION_COUNT * 2);
+        for (auto parent : registered) {
+            auto& func = FUNCTION_TABLE[(size_t) parent];
+            if (!func.allowsArgument())
+                continue;
+            std::vector<std::pair<FunctionID, double>> allowed;
+            if (func.allowedFuncs())
+                allowed = all;
+            else {
+                if (func.allowedColors())
+                    allowed.emplace_back(FunctionID::RAND_COLOR, weights[(int) FunctionID::RAND_COLOR]);
+                if (func.allowedScalars())
+                    allowed.emplace_back(FunctionID::RAND_SCALAR, weights[(int) FunctionID::RAND_SCALAR]);
+            }
+            childTables[(size_t) parent * 2 + (size_t) ChildSlot::LEFT] = AliasTable(allowed);
+            // single argument functions are only given the left child
+            if (!func.singleArgument())
+                childTables[(size_t) parent * 2 + (size_t) ChildSlot::RIGHT] = AliasTable(allowed);
+        }
+    }
+    
+    bool FunctionStorage::setWeight(FunctionID id, double weight) {
+        if (weight < 0 || (size_t) id >= FUNCTION_COUNT) {
+            BLT_WARN("Invalid weight %f for function %d", weight, (int) id);
+            return false;
+        }
+        auto old = weights[(int) id];
+        weights[(int) id] = weight;
+        buildTables();
+        if (table.empty()) {
+            BLT_WARN("Every function would have a weight of zero, keeping %s at %f", FUNCTION_TABLE[(size_t) id].name, old);
+            weights[(int) id] = old;
+            buildTables();
+            return false;
+        }
+        return true;
+    }
+    
+    bool FunctionStorage::find(const std::string& name, FunctionID& id) const {
+        for (auto registeredID : registered) {
+            if (name == FUNCTION_TABLE[(size_t) registeredID].name) {
+                id = registeredID;
+                return true;
+            }
         }
-        size = max_value;
+        return false;
     }
 }
\ No newline at end of file
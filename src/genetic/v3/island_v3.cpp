@@ -0,0 +1,260 @@
+//
+// Created by brett on 7/28/23.
+//
+#include <genetic/v3/island_v3.h>
+#include <blt/std/logging.h>
+#include <chrono>
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+namespace parks::genetic {
+    
+    // "PNRI", the start of every migration message
+    constexpr uint32_t MIGRATION_MAGIC = 0x49524E50;
+    // a destination which has never answered is retried this many times, it may still be starting up
+    constexpr int CONNECT_ATTEMPTS = 50;
+    constexpr auto CONNECT_RETRY_DELAY = std::chrono::milliseconds(100);
+    
+    bool splitAddress(const std::string& address, std::string& host, uint16_t& port) {
+        auto colon = address.rfind(':');
+        if (colon == std::string::npos || colon + 1 == address.size())
+            return false;
+        host = address.substr(0, colon);
+        auto value = std::strtoul(address.c_str() + colon + 1, nullptr, 10);
+        if (value == 0 || value > 65535)
+            return false;
+        port = (uint16_t) value;
+        return true;
+    }
+    
+    Island::Island(IslandConfig config): config(std::move(config)) {
+        reached.resize(this->config.addresses.size(), false);
+        gone.resize(this->config.addresses.size(), false);
+    }
+    
+    bool Island::start() {
+        std::string host;
+        uint16_t port;
+        if (config.id >= config.addresses.size() || !splitAddress(config.addresses[config.id], host, port)) {
+            BLT_ERROR("Island %zu has no valid address to listen on", config.id);
+            return false;
+        }
+        
+        listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+        if (listenSocket < 0)
+            return false;
+        int yes = 1;
+        setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_ANY);
+        address.sin_port = htons(port);
+        if (bind(listenSocket, (sockaddr*) &address, sizeof(address)) != 0 || ::listen(listenSocket, 16) != 0) {
+            BLT_ERROR("Island %zu failed to listen on port %d: %s", config.id, port, std::strerror(errno));
+            close(listenSocket);
+            listenSocket = -1;
+            return false;
+        }
+        
+        running = true;
+        listener = std::thread([this]() { listenLoop(); });
+        return true;
+    }
+    
+    void Island::listenLoop() {
+        pollfd fd{listenSocket, POLLIN, 0};
+        while (running) {
+            // wake up regularly to notice when we're shut down
+            if (poll(&fd, 1, 100) <= 0)
+                continue;
+            int connection = accept(listenSocket, nullptr, nullptr);
+            if (connection < 0)
+                continue;
+            receive(connection);
+            close(connection);
+        }
+    }
+    
+    void Island::receive(int connection) {
+        // a stalled sender must not hold up the listener forever
+        timeval timeout{5, 0};
+        setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        
+        std::vector<unsigned char> data;
+        unsigned char buffer[4096];
+        while (true) {
+            auto count = recv(connection, buffer, sizeof(buffer), 0);
+            if (count < 0)
+                return;
+            if (count == 0)
+                break;
+            data.insert(data.end(), buffer, buffer + count);
+        }
+        
+        size_t offset = 0;
+        uint32_t magic, source, count;
+        auto readU32 = [&](uint32_t& value) {
+            if (offset + sizeof(value) > data.size())
+                return false;
+            std::memcpy(&value, &data[offset], sizeof(value));
+            offset += sizeof(value);
+            return true;
+        };
+        if (!readU32(magic) || magic != MIGRATION_MAGIC || !readU32(source) || !readU32(count)) {
+            BLT_WARN("Island %zu received a malformed migration message", config.id);
+            return;
+        }
+        
+        std::vector<std::pair<GeneticTree*, double>> migrants;
+        for (uint32_t i = 0; i < count; i++) {
+            double fitness;
+            if (offset + sizeof(fitness) > data.size())
+                break;
+            std::memcpy(&fitness, &data[offset], sizeof(fitness));
+            offset += sizeof(fitness);
+            auto* tree = GeneticTree::deserialize(data, offset);
+            if (tree == nullptr)
+                break;
+            migrants.emplace_back(tree, fitness);
+        }
+        if (migrants.size() != count)
+            BLT_WARN("Island %zu only decoded %zu of %u migrants from island %u", config.id, migrants.size(), count, source);
+        
+        received += migrants.size();
+        std::scoped_lock<std::mutex> lock(inboxMutex);
+        inbox.insert(inbox.end(), migrants.begin(), migrants.end());
+    }
+    
+    std::vector<size_t> Island::destinations() const {
+        std::vector<size_t> result;
+        auto islands = config.addresses.size();
+        if (islands < 2)
+            return result;
+        switch (config.topology) {
+            case Topology::RING:
+                result.push_back((config.id + 1) % islands);
+                break;
+            case Topology::FULL:
+                for (size_t i = 0; i < islands; i++) {
+                    if (i != config.id)
+                        result.push_back(i);
+                }
+                break;
+        }
+        return result;
+    }
+    
+    static int connectTo(const std::string& host, uint16_t port) {
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* addresses = nullptr;
+        if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0)
+            return -1;
+        int connection = -1;
+        for (auto* address = addresses; address != nullptr; address = address->ai_next) {
+            connection = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+            if (connection < 0)
+                continue;
+            if (connect(connection, address->ai_addr, address->ai_addrlen) == 0)
+                break;
+            close(connection);
+            connection = -1;
+        }
+        freeaddrinfo(addresses);
+        return connection;
+    }
+    
+    bool Island::send(size_t destination, const std::vector<unsigned char>& message) {
+        if (gone[destination])
+            return false;
+        std::string host;
+        uint16_t port;
+        if (!splitAddress(config.addresses[destination], host, port))
+            return false;
+        
+        int connection = -1;
+        auto attempts = reached[destination] ? 1 : CONNECT_ATTEMPTS;
+        for (int i = 0; i < attempts && connection < 0; i++) {
+            connection = connectTo(host, port);
+            if (connection < 0 && i + 1 < attempts)
+                std::this_thread::sleep_for(CONNECT_RETRY_DELAY);
+        }
+        if (connection < 0) {
+            // islands which have finished stop listening, don't keep waiting on them
+            BLT_WARN("Island %zu can't reach island %zu at %s, no longer sending to it", config.id, destination,
+                     config.addresses[destination].c_str());
+            gone[destination] = true;
+            return false;
+        }
+        reached[destination] = true;
+        
+        size_t written = 0;
+        while (written < message.size()) {
+            auto count = ::send(connection, message.data() + written, message.size() - written, MSG_NOSIGNAL);
+            if (count <= 0)
+                break;
+            written += count;
+        }
+        close(connection);
+        return written == message.size();
+    }
+    
+    void Island::emigrate(const Population& population) {
+        if (config.migrationInterval == 0 || population.getGeneration() % config.migrationInterval != 0)
+            return;
+        auto targets = destinations();
+        if (targets.empty())
+            return;
+        
+        auto migrants = population.fittest(config.migrants);
+        std::vector<unsigned char> message;
+        auto writeU32 = [&message](uint32_t value) {
+            auto pos = message.size();
+            message.resize(pos + sizeof(value));
+            std::memcpy(&message[pos], &value, sizeof(value));
+        };
+        writeU32(MIGRATION_MAGIC);
+        writeU32((uint32_t) config.id);
+        writeU32((uint32_t) migrants.size());
+        for (const auto& [tree, fitness] : migrants) {
+            auto pos = message.size();
+            message.resize(pos + sizeof(fitness));
+            std::memcpy(&message[pos], &fitness, sizeof(fitness));
+            tree->serialize(message);
+            delete tree;
+        }
+        
+        for (auto destination : targets) {
+            if (send(destination, message))
+                sent += migrants.size();
+        }
+    }
+    
+    size_t Island::immigrate(Population& population) {
+        std::vector<std::pair<GeneticTree*, double>> arrived;
+        {
+            std::scoped_lock<std::mutex> lock(inboxMutex);
+            arrived.swap(inbox);
+        }
+        population.replaceWorst(arrived);
+        return arrived.size();
+    }
+    
+    Island::~Island() {
+        running = false;
+        if (listener.joinable())
+            listener.join();
+        if (listenSocket >= 0)
+            close(listenSocket);
+        for (auto& [tree, fitness] : inbox)
+            delete tree;
+    }
+    
+}
@@ -0,0 +1,439 @@
+//
+// Created by brett on 7/26/23.
+//
+#include <genetic/v3/jit_v3.h>
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__linux__)
+    #include <sys/mman.h>
+    #define PARKS_JIT_AVAILABLE
+#endif
+
+namespace parks::genetic {
+
+    // layout of the constant table, each entry is one JitRegister
+    constexpr unsigned int CONST_ZERO = 0;
+    // abs mask in the low half, sign mask in the high half
+    constexpr unsigned int CONST_MASKS = 1;
+    // 1.0 in the low half, 0.5 in the high half
+    constexpr unsigned int CONST_ONE_HALF = 2;
+    constexpr unsigned int CONST_FIRST = 3;
+
+    static inline JitRegister toRegister(Color c) {
+        return {{c.r, c.g, c.b, 0}};
+    }
+
+    static inline Color toColor(const JitRegister& r) {
+        // built by hand, the three argument constructor would normalize the values
+        Color c{0};
+        c.r = r.v[0];
+        c.g = r.v[1];
+        c.b = r.v[2];
+        return c;
+    }
+
+    // register file entry holding a non constant operand: x, y, the instruction outputs then the column and row inputs
+    static inline size_t inputRegister(Operand operand, const CompiledTree& program) {
+        switch (operand.type) {
+            case OperandType::X:
+                return 0;
+            case OperandType::Y:
+                return 1;
+            case OperandType::COLUMN:
+                return 2 + program.slotCount() + operand.index;
+            case OperandType::ROW:
+                return 2 + program.slotCount() + program.getColumns().size() + operand.index;
+            default:
+                return 2 + operand.index;
+        }
+    }
+
+    static inline const JitRegister& operandRegister(Operand operand, const CompiledTree& program, const JitRegister* registers, const JitRegister* constants) {
+        switch (operand.type) {
+            case OperandType::CONSTANT:
+                return constants[CONST_FIRST + operand.index];
+            case OperandType::ZERO:
+                return constants[CONST_ZERO];
+            default:
+                return registers[inputRegister(operand, program)];
+        }
+    }
+
+    // called from jitted code for every operator which isn't emitted inline
+    static void callout(const CompiledTree* program, unsigned int index, JitRegister* registers, const JitRegister* constants) {
+        const auto& ins = program->getInstructions()[index];
+        auto left = toColor(operandRegister(ins.left, *program, registers, constants));
+        auto right = toColor(operandRegister(ins.right, *program, registers, constants));
+        registers[2 + index] = toRegister(program->executeInstruction(index, left, right));
+    }
+
+#ifdef PARKS_JIT_AVAILABLE
+    namespace {
+
+        enum XMM : uint8_t {
+            XMM0, XMM1, XMM2, XMM3, XMM4, XMM5, XMM6, XMM7
+        };
+
+        // general purpose registers holding the table pointers, both can be used as a base without a SIB byte
+        enum Base : uint8_t {
+            REGISTERS = 3, // rbx
+            CONSTANTS = 5 // rbp
+        };
+
+        struct Address {
+            Base base;
+            int32_t disp;
+        };
+
+        // SSE opcodes (all 66 0F xx unless noted)
+        constexpr uint8_t MOVUPD_LOAD = 0x10;
+        constexpr uint8_t MOVAPD = 0x28;
+        constexpr uint8_t ANDPD = 0x54;
+        constexpr uint8_t ANDNPD = 0x55;
+        constexpr uint8_t ORPD = 0x56;
+        constexpr uint8_t ADDPD = 0x58;
+        constexpr uint8_t MULPD = 0x59;
+        constexpr uint8_t SUBPD = 0x5C;
+        constexpr uint8_t MINPD = 0x5D;
+        constexpr uint8_t DIVPD = 0x5E;
+        constexpr uint8_t MAXPD = 0x5F;
+        constexpr uint8_t CMPPD = 0xC2;
+        constexpr uint8_t CVTTPD2DQ = 0xE6;
+
+        constexpr uint8_t CMP_LT = 1;
+        constexpr uint8_t CMP_LE = 2;
+        // round toward zero, suppress precision exceptions
+        constexpr uint8_t ROUND_TRUNCATE = 0x0B;
+
+        class Assembler {
+            private:
+                std::vector<uint8_t> code;
+
+                inline void emit(std::initializer_list<uint8_t> bytes) {
+                    code.insert(code.end(), bytes);
+                }
+
+                inline void emit32(uint32_t v) {
+                    for (int i = 0; i < 4; i++)
+                        code.push_back((v >> (i * 8)) & 0xFF);
+                }
+
+                inline void emit64(uint64_t v) {
+                    for (int i = 0; i < 8; i++)
+                        code.push_back((v >> (i * 8)) & 0xFF);
+                }
+
+                inline void modrm(XMM reg, XMM rm) {
+                    code.push_back(0xC0 | (reg << 3) | rm);
+                }
+
+                inline void modrm(XMM reg, Address rm) {
+                    code.push_back(0x80 | (reg << 3) | rm.base);
+                    emit32((uint32_t) rm.disp);
+                }
+            public:
+                template<typename T>
+                inline void op(uint8_t opcode, XMM dst, T src) {
+                    emit({0x66, 0x0F, opcode});
+                    modrm(dst, src);
+                }
+
+                inline void load(XMM dst, Address src) {
+                    op(MOVUPD_LOAD, dst, src);
+                }
+
+                inline void store(Address dst, XMM src) {
+                    emit({0x66, 0x0F, 0x11});
+                    modrm(src, dst);
+                }
+
+                inline void move(XMM dst, XMM src) {
+                    op(MOVAPD, dst, src);
+                }
+
+                template<typename T>
+                inline void compare(XMM dst, T src, uint8_t predicate) {
+                    op(CMPPD, dst, src);
+                    code.push_back(predicate);
+                }
+
+                inline void truncate(XMM dst, XMM src) {
+                    // roundpd (SSE4.1)
+                    emit({0x66, 0x0F, 0x3A, 0x09});
+                    modrm(dst, src);
+                    code.push_back(ROUND_TRUNCATE);
+                }
+
+                inline void intToDouble(XMM dst, XMM src) {
+                    // cvtdq2pd
+                    emit({0xF3, 0x0F, 0xE6});
+                    modrm(dst, src);
+                }
+
+                inline void prologue() {
+                    // push rbx; push rbp; push r12, leaves the stack 16 byte aligned for callouts
+                    emit({0x53, 0x55, 0x41, 0x54});
+                    // mov rbx, rdi; mov rbp, rsi; mov r12, rdx
+                    emit({0x48, 0x89, 0xFB, 0x48, 0x89, 0xF5, 0x49, 0x89, 0xD4});
+                }
+
+                inline void epilogue() {
+                    // pop r12; pop rbp; pop rbx; ret
+                    emit({0x41, 0x5C, 0x5D, 0x5B, 0xC3});
+                }
+
+                inline void call(void* func, uint32_t index) {
+                    // callout(program = r12, index, registers = rbx, constants = rbp)
+                    emit({0x4C, 0x89, 0xE7});
+                    code.push_back(0xBE);
+                    emit32(index);
+                    emit({0x48, 0x89, 0xDA, 0x48, 0x89, 0xE9});
+                    // mov rax, func; call rax
+                    emit({0x48, 0xB8});
+                    emit64((uint64_t) func);
+                    emit({0xFF, 0xD0});
+                }
+
+                [[nodiscard]] inline const std::vector<uint8_t>& bytes() const {
+                    return code;
+                }
+        };
+
+        inline Address registerAddress(unsigned int index, bool high) {
+            return {REGISTERS, (int32_t) (index * sizeof(JitRegister) + (high ? 16 : 0))};
+        }
+
+        inline Address constantAddress(unsigned int index, bool high) {
+            return {CONSTANTS, (int32_t) (index * sizeof(JitRegister) + (high ? 16 : 0))};
+        }
+
+        inline Address operandAddress(Operand operand, const CompiledTree& program, bool high) {
+            switch (operand.type) {
+                case OperandType::CONSTANT:
+                    return constantAddress(CONST_FIRST + operand.index, high);
+                case OperandType::ZERO:
+                    return constantAddress(CONST_ZERO, high);
+                default:
+                    return registerAddress(inputRegister(operand, program), high);
+            }
+        }
+
+        const Address ZERO = constantAddress(CONST_ZERO, false);
+        const Address ABS_MASK = constantAddress(CONST_MASKS, false);
+        const Address SIGN_MASK = constantAddress(CONST_MASKS, true);
+        const Address ONE = constantAddress(CONST_ONE_HALF, false);
+        const Address HALF = constantAddress(CONST_ONE_HALF, true);
+
+        // the clamping done by the three argument Color constructor, uses xmm4-7
+        void emitNormalize(Assembler& a, XMM v) {
+            // v = v < 0 ? |v| : v
+            a.move(XMM4, v);
+            a.compare(XMM4, ZERO, CMP_LT);
+            a.move(XMM5, v);
+            a.op(ANDPD, XMM5, ABS_MASK);
+            a.op(ANDPD, XMM5, XMM4);
+            a.op(ANDNPD, XMM4, v);
+            a.op(ORPD, XMM4, XMM5);
+            // v = v > 1 ? v - trunc(v) : v
+            a.load(XMM5, ONE);
+            a.compare(XMM5, XMM4, CMP_LT);
+            a.truncate(XMM6, XMM4);
+            a.move(XMM7, XMM4);
+            a.op(SUBPD, XMM7, XMM6);
+            a.op(ANDPD, XMM7, XMM5);
+            a.op(ANDNPD, XMM5, XMM4);
+            a.op(ORPD, XMM5, XMM7);
+            a.move(v, XMM5);
+        }
+
+        // std::round, half away from zero. uses xmm4-7
+        void emitRound(Assembler& a, XMM v) {
+            a.truncate(XMM4, v);
+            a.move(XMM5, v);
+            a.op(SUBPD, XMM5, XMM4);
+            a.op(ANDPD, XMM5, ABS_MASK);
+            a.load(XMM6, HALF);
+            a.compare(XMM6, XMM5, CMP_LE);
+            a.move(XMM7, v);
+            a.op(ANDPD, XMM7, SIGN_MASK);
+            a.op(ORPD, XMM7, ONE);
+            a.op(ADDPD, XMM7, XMM4);
+            a.op(ANDPD, XMM7, XMM6);
+            a.op(ANDNPD, XMM6, XMM4);
+            a.op(ORPD, XMM6, XMM7);
+            a.move(v, XMM6);
+        }
+
+        // fast_fmod, v = v - div * (int) (v * (1 / div)). uses xmm4
+        void emitMod(Assembler& a, XMM v, XMM div) {
+            a.load(XMM4, ONE);
+            a.op(DIVPD, XMM4, div);
+            a.op(MULPD, XMM4, v);
+            a.op(CVTTPD2DQ, XMM4, XMM4);
+            a.intToDouble(XMM4, XMM4);
+            a.op(MULPD, XMM4, div);
+            a.op(SUBPD, v, XMM4);
+        }
+
+        bool emitInline(Assembler& a, const CompiledTree& program, const Instruction& ins, unsigned int index) {
+            uint8_t opcode = 0;
+            bool swapped = false;
+            bool unary = false;
+            switch (ins.op) {
+                case FunctionID::ADD:
+                    opcode = ADDPD;
+                    break;
+                case FunctionID::SUBTRACT:
+                    opcode = SUBPD;
+                    break;
+                case FunctionID::MULTIPLY:
+                    opcode = MULPD;
+                    break;
+                case FunctionID::DIVIDE:
+                    opcode = DIVPD;
+                    break;
+                case FunctionID::MIN:
+                    // minpd / maxpd return the second operand on NaN or equality, std::min(l, r) keeps l
+                    opcode = MINPD;
+                    swapped = true;
+                    break;
+                case FunctionID::MAX:
+                    opcode = MAXPD;
+                    swapped = true;
+                    break;
+                case FunctionID::MOD:
+                case FunctionID::ROUND:
+                case FunctionID::ABS:
+                    unary = ins.op != FunctionID::MOD;
+                    break;
+                default:
+                    return false;
+            }
+
+            auto first = swapped ? ins.right : ins.left;
+            auto second = swapped ? ins.left : ins.right;
+            a.load(XMM0, operandAddress(first, program, false));
+            a.load(XMM1, operandAddress(first, program, true));
+            if (!unary) {
+                a.load(XMM2, operandAddress(second, program, false));
+                a.load(XMM3, operandAddress(second, program, true));
+            }
+
+            switch (ins.op) {
+                case FunctionID::MOD:
+                    emitMod(a, XMM0, XMM2);
+                    emitMod(a, XMM1, XMM3);
+                    break;
+                case FunctionID::ROUND:
+                    emitRound(a, XMM0);
+                    emitRound(a, XMM1);
+                    break;
+                case FunctionID::ABS:
+                    a.op(ANDPD, XMM0, ABS_MASK);
+                    a.op(ANDPD, XMM1, ABS_MASK);
+                    break;
+                default:
+                    a.op(opcode, XMM0, XMM2);
+                    a.op(opcode, XMM1, XMM3);
+                    break;
+            }
+
+            emitNormalize(a, XMM0);
+            emitNormalize(a, XMM1);
+            a.store(registerAddress(2 + index, false), XMM0);
+            a.store(registerAddress(2 + index, true), XMM1);
+            return true;
+        }
+
+    }
+#endif
+
+    JitTree::JitTree(std::shared_ptr<const CompiledTree> p): program(std::move(p)), bw(program->resultIsBW()) {
+        uint64_t absMask = 0x7FFFFFFFFFFFFFFF;
+        uint64_t signMask = 0x8000000000000000;
+        JitRegister masks{};
+        std::memcpy(&masks.v[0], &absMask, sizeof(double));
+        std::memcpy(&masks.v[1], &absMask, sizeof(double));
+        std::memcpy(&masks.v[2], &signMask, sizeof(double));
+        std::memcpy(&masks.v[3], &signMask, sizeof(double));
+
+        constants.push_back({{0, 0, 0, 0}});
+        constants.push_back(masks);
+        constants.push_back({{1, 1, 0.5, 0.5}});
+        for (const auto& c : program->getConstants())
+            constants.push_back(toRegister(c));
+
+#ifdef PARKS_JIT_AVAILABLE
+        if (!supported())
+            return;
+
+        Assembler a;
+        a.prologue();
+        const auto& instructions = program->getInstructions();
+        for (size_t i = 0; i < instructions.size(); i++) {
+            if (!emitInline(a, *program, instructions[i], i))
+                a.call((void*) &callout, i);
+        }
+        a.epilogue();
+
+        const auto& bytes = a.bytes();
+        auto page = mmap(nullptr, bytes.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (page == MAP_FAILED) {
+            BLT_WARN("Unable to map memory for jitted tree, falling back to the interpreter");
+            return;
+        }
+        std::memcpy(page, bytes.data(), bytes.size());
+        if (mprotect(page, bytes.size(), PROT_READ | PROT_EXEC) != 0) {
+            BLT_WARN("Unable to make jitted tree executable, falling back to the interpreter");
+            munmap(page, bytes.size());
+            return;
+        }
+        codePage = page;
+        codeSize = bytes.size();
+        code = (decltype(code)) page;
+#endif
+    }
+
+    bool JitTree::supported() {
+#ifdef PARKS_JIT_AVAILABLE
+        return __builtin_cpu_supports("sse4.1");
+#else
+        return false;
+#endif
+    }
+
+    void JitTree::prepare(JitState& state, const AxisTables* tables) const {
+        auto axes = program->getColumns().size() + program->getRows().size();
+        state.registers.assign(2 + program->slotCount() + axes, {{0, 0, 0, 0}});
+        state.tables = tables;
+    }
+
+    void JitTree::executeBatch(unsigned int x, unsigned int y, unsigned int width, unsigned int height, JitState& state, ColorBatch& out) const {
+        auto columnBase = 2 + program->slotCount();
+        auto rowBase = columnBase + program->getColumns().size();
+        auto column = x / BATCH_SIZE;
+        for (size_t k = 0; k < program->getRows().size(); k++)
+            state.registers[rowBase + k] = toRegister(state.tables->rows[k][y / BATCH_SIZE].get(y % BATCH_SIZE));
+        state.registers[1].v[0] = (double) y / height;
+        const auto& result = fetch(program->getResult(), state);
+        for (unsigned int i = 0; i < BATCH_SIZE; i++) {
+            state.registers[0].v[0] = (double) (x + i) / width;
+            for (size_t k = 0; k < program->getColumns().size(); k++) {
+                const auto& table = state.tables->columns[k][column];
+                state.registers[columnBase + k] = {{table.r[i], table.g[i], table.b[i], 0}};
+            }
+            code(state.registers.data(), constants.data(), program.get());
+            out.r[i] = result.v[0];
+            out.g[i] = result.v[1];
+            out.b[i] = result.v[2];
+        }
+    }
+
+    JitTree::~JitTree() {
+#ifdef PARKS_JIT_AVAILABLE
+        if (codePage != nullptr)
+            munmap(codePage, codeSize);
+#endif
+    }
+
+}
@@ -0,0 +1,358 @@
+//
+// Created by brett on 7/28/23.
+//
+#include <genetic/v3/linear_v3.h>
+#include <algorithm>
+
+namespace parks::genetic {
+
+    LinearTree LinearTree::random(int maxDepth) {
+        LinearTree tree;
+        if (maxDepth > 0)
+            tree.generate(maxDepth);
+        return tree;
+    }
+
+    void LinearTree::generate(int maxDepth) {
+        // depths of the nodes still to be generated, the back is next. right children are pushed before left ones so
+        // a left subtree is laid out completely before its sibling starts, which is prefix order
+        std::vector<int> pending{0};
+        while (!pending.empty()) {
+            auto depth = pending.back();
+            pending.pop_back();
+
+            auto op = functions.select();
+            auto& func = functions[op];
+            auto set = func.generateRandomParameters();
+
+            nodes.push_back({op, 0, (uint8_t) set.size(), (uint32_t) parameters.size(), 1});
+            for (size_t i = 0; i < set.size(); i++)
+                parameters.push_back(set[(int) i]);
+
+            // the values GeneticTree::generateRandomTree() generates below functions which don't take subtrees are
+            // never evaluated, so they are left out here
+            if (!func.allowsArgument() || depth + 1 >= maxDepth || !func.allowedFuncs())
+                continue;
+            // GeneticTree gives functions which don't care both children, its chance(80) always passes. Here each
+            // child is kept with a probability of 0.8 so the shapes are more varied
+            uint8_t children = 0;
+            if (func.singleArgument() || func.bothArgument() || (func.dontCareArgument() && chance(0.8)))
+                children |= LINEAR_LEFT;
+            if (func.bothArgument() || (func.dontCareArgument() && chance(0.8)))
+                children |= LINEAR_RIGHT;
+            nodes.back().children = children;
+            if (children & LINEAR_RIGHT)
+                pending.push_back(depth + 1);
+            if (children & LINEAR_LEFT)
+                pending.push_back(depth + 1);
+        }
+
+        // every child follows its parent, so walking backwards sizes the children first
+        for (auto i = (uint32_t) nodes.size(); i-- > 0;) {
+            auto l = left(i);
+            nodes[i].size = 1 + (l >= 0 ? nodes[l].size : 0);
+            auto r = right(i);
+            nodes[i].size += r >= 0 ? nodes[r].size : 0;
+        }
+    }
+
+    LinearTree LinearTree::fromTree(GeneticTree& tree) {
+        LinearTree linear;
+        if (tree.node(0) != nullptr)
+            linear.appendFromTree(tree, 0);
+        return linear;
+    }
+
+    void LinearTree::appendFromTree(GeneticTree& tree, int pos) {
+        auto node = tree.node(pos);
+        auto& func = functions[node->op];
+
+        auto index = (uint32_t) nodes.size();
+        nodes.push_back({node->op, 0, (uint8_t) node->set.size(), (uint32_t) parameters.size(), 1});
+        for (size_t i = 0; i < node->set.size(); i++)
+            parameters.push_back(node->set[(int) i]);
+
+        // children only matter to functions which take subtrees, anything else below a node is never evaluated
+        uint8_t children = 0;
+        if (func.allowsArgument() && func.allowedFuncs()) {
+            if (tree.leftNode(pos) != nullptr) {
+                appendFromTree(tree, GeneticTree::left(pos));
+                children |= LINEAR_LEFT;
+            }
+            if (tree.rightNode(pos) != nullptr) {
+                appendFromTree(tree, GeneticTree::right(pos));
+                children |= LINEAR_RIGHT;
+            }
+        }
+        nodes[index].children = children;
+        nodes[index].size = (uint32_t) nodes.size() - index;
+    }
+
+    GeneticTree* LinearTree::toTree() const {
+        if (nodes.empty())
+            return nullptr;
+
+        // heap position of every node, the root's left child is at 2 and its right at 3
+        std::vector<int64_t> positions(nodes.size());
+        int64_t largest = 0;
+        positions[0] = 0;
+        for (uint32_t i = 0; i < nodes.size(); i++) {
+            auto l = left(i);
+            auto r = right(i);
+            if (l >= 0)
+                positions[l] = GeneticTree::left((int) positions[i]);
+            if (r >= 0)
+                positions[r] = GeneticTree::right((int) positions[i]);
+            largest = std::max(largest, std::max(l >= 0 ? positions[l] : 0, r >= 0 ? positions[r] : 0));
+            if (largest > (int64_t(1) << MAX_HEIGHT))
+                return nullptr;
+        }
+
+        int maxHeight = 0;
+        int64_t heapSize = 2;
+        while (heapSize <= largest) {
+            maxHeight++;
+            heapSize = (int64_t(1) << maxHeight) + 1;
+        }
+
+        auto heap = GeneticTree::allocateNodes(heapSize);
+        for (uint32_t i = 0; i < nodes.size(); i++)
+            heap[positions[i]] = new GeneticNode(nodes[i].op, (unsigned int) positions[i], parameterSet(i));
+
+        auto tree = new GeneticTree(heap, (int) heapSize);
+        tree->max_height = maxHeight;
+        return tree;
+    }
+
+    std::vector<int> LinearTree::heights(uint32_t node) const {
+        // every child follows its parent, so walking the span backwards meets the children first
+        std::vector<int> heights(nodes[node].size);
+        for (auto i = node + nodes[node].size; i-- > node;) {
+            auto l = left(i);
+            auto r = right(i);
+            heights[i - node] = 1 + std::max(l >= 0 ? heights[l - node] : 0, r >= 0 ? heights[r - node] : 0);
+        }
+        return heights;
+    }
+
+    int LinearTree::height(uint32_t node) const {
+        return heights(node)[0];
+    }
+
+    std::vector<uint32_t> LinearTree::postorder(uint32_t node) const {
+        // node, right, left preorder is postorder backwards
+        std::vector<uint32_t> order;
+        order.reserve(nodes[node].size);
+        std::vector<uint32_t> stack{node};
+        while (!stack.empty()) {
+            auto current = stack.back();
+            stack.pop_back();
+            order.push_back(current);
+            auto l = left(current);
+            auto r = right(current);
+            if (l >= 0)
+                stack.push_back((uint32_t) l);
+            if (r >= 0)
+                stack.push_back((uint32_t) r);
+        }
+        std::reverse(order.begin(), order.end());
+        return order;
+    }
+
+    ParameterSet LinearTree::parameterSet(uint32_t node) const {
+        ParameterSet set;
+        for (uint32_t i = 0; i < nodes[node].parameterCount; i++)
+            set.add(parameters[nodes[node].parameterIndex + i]);
+        return set;
+    }
+
+    LinearTree LinearTree::subtree(uint32_t node) const {
+        LinearTree tree;
+        auto end = node + nodes[node].size;
+        auto parameterBegin = nodes[node].parameterIndex;
+        auto parameterEnd = end < nodes.size() ? nodes[end].parameterIndex : (uint32_t) parameters.size();
+
+        tree.nodes.assign(nodes.begin() + node, nodes.begin() + end);
+        tree.parameters.assign(parameters.begin() + parameterBegin, parameters.begin() + parameterEnd);
+        for (auto& n : tree.nodes)
+            n.parameterIndex -= parameterBegin;
+        return tree;
+    }
+
+    void LinearTree::replaceSubtree(uint32_t node, const LinearTree& replacement) {
+        // a node can't be removed without changing its parent's arity
+        if (replacement.nodes.empty())
+            return;
+        auto oldSize = nodes[node].size;
+        auto end = node + oldSize;
+        auto parameterBegin = nodes[node].parameterIndex;
+        auto parameterEnd = end < nodes.size() ? nodes[end].parameterIndex : (uint32_t) parameters.size();
+
+        // every node whose span contains node, found by walking down from the root
+        std::vector<uint32_t> ancestors;
+        uint32_t current = 0;
+        while (current != node) {
+            ancestors.push_back(current);
+            auto r = right(current);
+            current = (r >= 0 && node >= r) ? (uint32_t) r : current + 1;
+        }
+
+        auto nodeDelta = (int64_t) replacement.nodes.size() - oldSize;
+        auto parameterDelta = (int64_t) replacement.parameters.size() - (parameterEnd - parameterBegin);
+
+        parameters.erase(parameters.begin() + parameterBegin, parameters.begin() + parameterEnd);
+        parameters.insert(parameters.begin() + parameterBegin, replacement.parameters.begin(), replacement.parameters.end());
+        nodes.erase(nodes.begin() + node, nodes.begin() + end);
+        nodes.insert(nodes.begin() + node, replacement.nodes.begin(), replacement.nodes.end());
+
+        auto replacedEnd = node + replacement.nodes.size();
+        for (size_t i = node; i < replacedEnd; i++)
+            nodes[i].parameterIndex += parameterBegin;
+        for (size_t i = replacedEnd; i < nodes.size(); i++)
+            nodes[i].parameterIndex = (uint32_t) (nodes[i].parameterIndex + parameterDelta);
+        for (auto ancestor : ancestors)
+            nodes[ancestor].size = (uint32_t) (nodes[ancestor].size + nodeDelta);
+    }
+
+    void LinearTree::crossover(LinearTree& other) {
+        if (nodes.empty() || other.nodes.empty())
+            return;
+        // swapping the roots would just swap the trees
+        auto pick = [](const LinearTree& tree) -> uint32_t {
+            if (tree.nodes.size() == 1)
+                return 0;
+            return (uint32_t) randomInt(1, (int) tree.nodes.size());
+        };
+        auto ours = pick(*this);
+        auto theirs = pick(other);
+
+        auto ourSubtree = subtree(ours);
+        replaceSubtree(ours, other.subtree(theirs));
+        other.replaceSubtree(theirs, ourSubtree);
+    }
+
+    void LinearTree::mutate() {
+        if (nodes.empty())
+            return;
+        // heights by position before anything is replaced. original follows i, replacing a subtree shifts every
+        // node after it but none of their heights change since their ancestors were already visited
+        auto heights = this->heights(0);
+        for (uint32_t i = 0, original = 0; i < nodes.size();) {
+            int nodeHeight = heights[original];
+            double factor = 1.0 / nodeHeight;
+            if (chance(nodeMutationChance * factor)) {
+                auto oldSize = nodes[i].size;
+                // a new random subtree about as deep as the one it replaces
+                replaceSubtree(i, random(nodeHeight));
+                i += nodes[i].size;
+                original += oldSize;
+                continue;
+            }
+            auto& node = nodes[i];
+            if (node.op == FunctionID::RAND_SCALAR && chance(scalarMutationChance * factor))
+                parameters[node.parameterIndex] = RandomScalar::get(parameters[node.parameterIndex]);
+            if (node.op == FunctionID::RAND_COLOR && chance(colorMutationChance * factor))
+                parameters[node.parameterIndex] = RandomColor::get(parameters[node.parameterIndex]);
+            i++;
+            original++;
+        }
+    }
+
+    Color LinearTree::execute(double x, double y) const {
+        // children are evaluated before their parent, the right child's result is on top of its sibling's
+        std::vector<Color> results;
+        for (auto node : postorder(0)) {
+            auto l = left(node);
+            auto r = right(node);
+            Color rightC = r >= 0 ? results.back() : Color{0};
+            if (r >= 0)
+                results.pop_back();
+            Color leftC = l >= 0 ? results.back() : Color{0};
+            if (l >= 0)
+                results.pop_back();
+            results.push_back(execute_node(x, y, node, l >= 0, r >= 0, leftC, rightC));
+        }
+        return results.back();
+    }
+
+    Color LinearTree::execute_node(double x, double y, uint32_t node, bool hasLeft, bool hasRight, Color leftC, Color rightC) const {
+        auto& func = functions[nodes[node].op];
+        auto set = parameterSet(node);
+
+        if (func.disallowsArgument())
+            return callFunction(nodes[node].op, {ARGS_NONE, Color{0}, Color{0}}, set);
+
+        if (func.allowedFuncs()) {
+            if (!hasLeft && func.allowedVariables())
+                leftC = Color(x);
+            if (!hasRight && func.allowedVariables())
+                rightC = Color(y);
+        } else {
+            if (func.allowedVariables()) {
+                leftC = Color(x);
+                rightC = Color(y);
+            } else {
+                BLT_WARN("Function called (%s) from node (%d) without any args!", func.name, (int) node);
+            }
+        }
+        return callFunction(nodes[node].op, {ARGS_BOTH, leftC, rightC}, set);
+    }
+
+    CompiledTree LinearTree::compile() const {
+        CompiledTree program;
+        // postorder emits the instructions in the same order as GeneticTree::compile_internal()'s recursion
+        std::vector<Operand> operands;
+        for (auto node : postorder(0)) {
+            auto l = left(node);
+            auto r = right(node);
+            Operand rightO = r >= 0 ? operands.back() : Operand{};
+            if (r >= 0)
+                operands.pop_back();
+            Operand leftO = l >= 0 ? operands.back() : Operand{};
+            if (l >= 0)
+                operands.pop_back();
+            operands.push_back(compile_node(node, l >= 0, r >= 0, leftO, rightO, program));
+        }
+        program.result = operands.back();
+        program.separate();
+        return program;
+    }
+
+    Operand LinearTree::compile_node(uint32_t node, bool hasLeft, bool hasRight, Operand leftO, Operand rightO, CompiledTree& program) const {
+        auto op = nodes[node].op;
+        auto& func = functions[op];
+        auto set = parameterSet(node);
+
+        if (func.disallowsArgument())
+            return program.addConstant(callFunction(op, {ARGS_NONE, Color{0}, Color{0}}, set));
+
+        // mirrors GeneticTree::compile_internal()
+        if (func.allowedFuncs()) {
+            if (!hasLeft && func.allowedVariables())
+                leftO = {OperandType::X};
+            if (!hasRight && func.allowedVariables())
+                rightO = {OperandType::Y};
+        } else {
+            if (func.allowedVariables()) {
+                leftO = {OperandType::X};
+                rightO = {OperandType::Y};
+            } else {
+                BLT_WARN("Function compiled (%s) from node (%d) without any args!", func.name, (int) node);
+            }
+        }
+        if (func.singleArgument())
+            rightO = {OperandType::ZERO};
+
+        if (program.isInvariant(leftO) && program.isInvariant(rightO))
+            return program.fold(op, leftO, rightO, set);
+        return program.addInstruction(op, leftO, rightO, set, node);
+    }
+
+    void LinearTree::processImage(unsigned char* pixels, FitnessScores* scores) const {
+        renderProgram(std::make_shared<const CompiledTree>(compile()), nullptr, pixels, WIDTH, HEIGHT, Precision::DOUBLE, scores);
+        RenderPool::get().wait();
+        if (scores != nullptr)
+            evaluatePostMetrics(pixels, *scores);
+    }
+
+}
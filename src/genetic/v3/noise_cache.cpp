@@ -0,0 +1,128 @@
+//
+// Created by brett on 7/27/23.
+//
+#include <genetic/v3/noise_cache.h>
+#include <cstring>
+#include <functional>
+
+namespace parks::genetic {
+    
+    bool NoiseKey::operator==(const NoiseKey& other) const {
+        return op == other.op && std::memcmp(params, other.params, sizeof(params)) == 0 && left == other.left &&
+               right == other.right && width == other.width && height == other.height;
+    }
+    
+    size_t NoiseKeyHash::operator()(const NoiseKey& key) const {
+        // boost style hash_combine over the bit patterns
+        size_t seed = std::hash<int>()((int) key.op);
+        auto combine = [&seed](size_t v) {
+            seed ^= v + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2);
+        };
+        for (double param : key.params) {
+            uint64_t bits;
+            std::memcpy(&bits, &param, sizeof(bits));
+            combine(std::hash<uint64_t>()(bits));
+        }
+        combine(((size_t) key.left << 8) | (size_t) key.right);
+        combine(((size_t) key.width << 32) | key.height);
+        return seed;
+    }
+    
+    bool NoiseCache::cacheable(const Instruction& ins) {
+        return (ins.op == FunctionID::NOISE || ins.op == FunctionID::COLOR_NOISE) && ins.left.type == OperandType::X &&
+               ins.right.type == OperandType::Y;
+    }
+    
+    BoundNoise NoiseCache::bind(const CompiledTree& program, unsigned int width, unsigned int height) {
+        const auto& instructions = program.getInstructions();
+        BoundNoise bound;
+        bound.bindings.resize(instructions.size());
+        
+        std::scoped_lock<std::mutex> lock(mutex);
+        for (size_t i = 0; i < instructions.size(); i++) {
+            const auto& ins = instructions[i];
+            if (!cacheable(ins))
+                continue;
+            
+            NoiseKey key{ins.op, {}, ins.left.type, ins.right.type, width, height};
+            const auto& params = program.getParameters(i);
+            for (size_t p = 0; p < std::size(key.params); p++)
+                key.params[p] = p < params.size() ? params[p].r : 0;
+            
+            auto found = index.find(key);
+            if (found != index.end()) {
+                entries.splice(entries.begin(), entries, found->second);
+                bound.bindings[i].read = found->second->second.get();
+                bound.reading.push_back(found->second->second);
+                hits++;
+                continue;
+            }
+            misses++;
+            
+            // the same noise can appear twice in one tree, the second copy is computed without touching the field
+            bool alreadyPending = false;
+            for (const auto& pending : bound.pending)
+                alreadyPending |= pending.first == key;
+            if (alreadyPending)
+                continue;
+            
+            auto field = std::make_shared<NoiseField>(width, height, ins.op == FunctionID::COLOR_NOISE);
+            bound.bindings[i].write = field.get();
+            bound.pending.emplace_back(key, std::move(field));
+        }
+        return bound;
+    }
+    
+    void NoiseCache::evict() {
+        while (usedBytes > budget && !entries.empty()) {
+            auto& last = entries.back();
+            usedBytes -= last.second->bytes();
+            index.erase(last.first);
+            entries.pop_back();
+        }
+    }
+    
+    void NoiseCache::insert(BoundNoise& render) {
+        std::scoped_lock<std::mutex> lock(mutex);
+        for (auto& field : render.pending) {
+            if (index.find(field.first) != index.end())
+                continue;
+            usedBytes += field.second->bytes();
+            entries.emplace_front(field.first, std::move(field.second));
+            index[field.first] = entries.begin();
+        }
+        render.pending.clear();
+        evict();
+    }
+    
+    void NoiseCache::clear() {
+        std::scoped_lock<std::mutex> lock(mutex);
+        entries.clear();
+        index.clear();
+        usedBytes = 0;
+        hits = 0;
+        misses = 0;
+    }
+    
+    void NoiseCache::setBudget(size_t bytes) {
+        std::scoped_lock<std::mutex> lock(mutex);
+        budget = bytes;
+        evict();
+    }
+    
+    size_t NoiseCache::size() {
+        std::scoped_lock<std::mutex> lock(mutex);
+        return entries.size();
+    }
+    
+    size_t NoiseCache::bytes() {
+        std::scoped_lock<std::mutex> lock(mutex);
+        return usedBytes;
+    }
+    
+    NoiseCache& NoiseCache::get() {
+        static NoiseCache cache;
+        return cache;
+    }
+    
+}
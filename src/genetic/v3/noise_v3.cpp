@@ -0,0 +1,191 @@
+//
+// Created by brett on 7/27/23.
+//
+#include <genetic/v3/noise_v3.h>
+#include <stb/stb_perlin.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#ifdef __AVX2__
+    #include <immintrin.h>
+#endif
+
+namespace parks::genetic {
+
+#ifdef __AVX2__
+    // stb's byte tables widened to 32 bits so they can be gathered
+    struct NoiseTables {
+        int randtab[512];
+        int gradIndex[512];
+
+        NoiseTables() {
+            auto rand = stb_perlin_randtab();
+            auto grad = stb_perlin_randtab_grad_idx();
+            for (int i = 0; i < 512; i++) {
+                randtab[i] = rand[i];
+                gradIndex[i] = grad[i];
+            }
+        }
+    };
+
+    // the gradient basis from stb__perlin_grad, split per axis
+    static const float BASIS_X[12] = {1, -1, 1, -1, 1, -1, 1, -1, 0, 0, 0, 0};
+    static const float BASIS_Y[12] = {1, 1, -1, -1, 0, 0, 0, 0, 1, -1, 1, -1};
+    static const float BASIS_Z[12] = {0, 0, 0, 0, 1, 1, -1, -1, 1, 1, -1, -1};
+
+    static inline __m256i fastFloor(__m256 a) {
+        auto truncated = _mm256_cvttps_epi32(a);
+        // the comparison mask is -1 where a is below its truncation
+        auto below = _mm256_castps_si256(_mm256_cmp_ps(a, _mm256_cvtepi32_ps(truncated), _CMP_LT_OQ));
+        return _mm256_add_epi32(truncated, below);
+    }
+
+    // (((a*6-15)*a + 10) * a * a * a), keeping stb's evaluation order
+    static inline __m256 ease(__m256 a) {
+        auto r = _mm256_sub_ps(_mm256_mul_ps(a, _mm256_set1_ps(6)), _mm256_set1_ps(15));
+        r = _mm256_add_ps(_mm256_mul_ps(r, a), _mm256_set1_ps(10));
+        r = _mm256_mul_ps(r, a);
+        r = _mm256_mul_ps(r, a);
+        return _mm256_mul_ps(r, a);
+    }
+
+    static inline __m256 lerp(__m256 a, __m256 b, __m256 t) {
+        return _mm256_add_ps(a, _mm256_mul_ps(_mm256_sub_ps(b, a), t));
+    }
+
+    static inline __m256i lookup(const int* table, __m256i index) {
+        return _mm256_i32gather_epi32(table, index, 4);
+    }
+
+    static inline __m256 grad(__m256i index, __m256 x, __m256 y, __m256 z) {
+        auto gx = _mm256_mul_ps(_mm256_i32gather_ps(BASIS_X, index, 4), x);
+        auto gy = _mm256_mul_ps(_mm256_i32gather_ps(BASIS_Y, index, 4), y);
+        auto gz = _mm256_mul_ps(_mm256_i32gather_ps(BASIS_Z, index, 4), z);
+        return _mm256_add_ps(_mm256_add_ps(gx, gy), gz);
+    }
+
+    // stb_perlin_noise3_internal without wrapping
+    static inline __m256 noise(const NoiseTables& tables, __m256 x, __m256 y, __m256 z, unsigned char seed) {
+        const auto mask = _mm256_set1_epi32(255);
+        const auto one = _mm256_set1_epi32(1);
+        const auto oneF = _mm256_set1_ps(1);
+
+        auto px = fastFloor(x);
+        auto py = fastFloor(y);
+        auto pz = fastFloor(z);
+        auto x0 = _mm256_and_si256(px, mask);
+        auto x1 = _mm256_and_si256(_mm256_add_epi32(px, one), mask);
+        auto y0 = _mm256_and_si256(py, mask);
+        auto y1 = _mm256_and_si256(_mm256_add_epi32(py, one), mask);
+        auto z0 = _mm256_and_si256(pz, mask);
+        auto z1 = _mm256_and_si256(_mm256_add_epi32(pz, one), mask);
+
+        x = _mm256_sub_ps(x, _mm256_cvtepi32_ps(px));
+        y = _mm256_sub_ps(y, _mm256_cvtepi32_ps(py));
+        z = _mm256_sub_ps(z, _mm256_cvtepi32_ps(pz));
+        auto u = ease(x);
+        auto v = ease(y);
+        auto w = ease(z);
+        auto x1f = _mm256_sub_ps(x, oneF);
+        auto y1f = _mm256_sub_ps(y, oneF);
+        auto z1f = _mm256_sub_ps(z, oneF);
+
+        auto s = _mm256_set1_epi32(seed);
+        auto r0 = lookup(tables.randtab, _mm256_add_epi32(x0, s));
+        auto r1 = lookup(tables.randtab, _mm256_add_epi32(x1, s));
+
+        auto r00 = lookup(tables.randtab, _mm256_add_epi32(r0, y0));
+        auto r01 = lookup(tables.randtab, _mm256_add_epi32(r0, y1));
+        auto r10 = lookup(tables.randtab, _mm256_add_epi32(r1, y0));
+        auto r11 = lookup(tables.randtab, _mm256_add_epi32(r1, y1));
+
+        auto n000 = grad(lookup(tables.gradIndex, _mm256_add_epi32(r00, z0)), x, y, z);
+        auto n001 = grad(lookup(tables.gradIndex, _mm256_add_epi32(r00, z1)), x, y, z1f);
+        auto n010 = grad(lookup(tables.gradIndex, _mm256_add_epi32(r01, z0)), x, y1f, z);
+        auto n011 = grad(lookup(tables.gradIndex, _mm256_add_epi32(r01, z1)), x, y1f, z1f);
+        auto n100 = grad(lookup(tables.gradIndex, _mm256_add_epi32(r10, z0)), x1f, y, z);
+        auto n101 = grad(lookup(tables.gradIndex, _mm256_add_epi32(r10, z1)), x1f, y, z1f);
+        auto n110 = grad(lookup(tables.gradIndex, _mm256_add_epi32(r11, z0)), x1f, y1f, z);
+        auto n111 = grad(lookup(tables.gradIndex, _mm256_add_epi32(r11, z1)), x1f, y1f, z1f);
+
+        auto n00 = lerp(n000, n001, w);
+        auto n01 = lerp(n010, n011, w);
+        auto n10 = lerp(n100, n101, w);
+        auto n11 = lerp(n110, n111, w);
+
+        auto n0 = lerp(n00, n01, v);
+        auto n1 = lerp(n10, n11, v);
+
+        return lerp(n0, n1, u);
+    }
+#endif
+
+    void turbulenceNoise(const float* x, const float* y, const float* z, float lacunarity, float gain, int octaves, float* out) {
+#ifdef __AVX2__
+        static const NoiseTables tables;
+        const auto absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+
+        auto px = _mm256_loadu_ps(x);
+        auto py = _mm256_loadu_ps(y);
+        auto pz = _mm256_loadu_ps(z);
+        float frequency = 1.0f;
+        float amplitude = 1.0f;
+        auto sum = _mm256_setzero_ps();
+        for (int i = 0; i < octaves; i++) {
+            auto f = _mm256_set1_ps(frequency);
+            auto r = noise(tables, _mm256_mul_ps(px, f), _mm256_mul_ps(py, f), _mm256_mul_ps(pz, f), (unsigned char) i);
+            r = _mm256_mul_ps(r, _mm256_set1_ps(amplitude));
+            sum = _mm256_add_ps(sum, _mm256_and_ps(r, absMask));
+            frequency *= lacunarity;
+            amplitude *= gain;
+        }
+        _mm256_storeu_ps(out, sum);
+#else
+        for (unsigned int i = 0; i < NOISE_LANES; i++)
+            out[i] = stb_perlin_turbulence_noise3(x[i], y[i], z[i], lacunarity, gain, octaves);
+#endif
+    }
+
+    NoiseBenchmark benchmarkNoise(size_t points) {
+        points = std::max<size_t>(NOISE_LANES, points / NOISE_LANES * NOISE_LANES);
+        // the same ranges the noise operators see, coordinates are scaled by up to 128
+        std::mt19937 rng(1);
+        std::uniform_real_distribution<float> coordinate(0, 128);
+        std::uniform_real_distribution<float> unit(0, 1);
+        std::vector<float> x(points), y(points), z(points);
+        for (size_t i = 0; i < points; i++) {
+            x[i] = coordinate(rng);
+            y[i] = coordinate(rng);
+            z[i] = unit(rng);
+        }
+        float lacunarity = unit(rng) * 6;
+        float gain = unit(rng) * 2;
+        int octaves = 8;
+
+        std::vector<float> stb(points), batched(points);
+
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < points; i++)
+            stb[i] = stb_perlin_turbulence_noise3(x[i], y[i], z[i], lacunarity, gain, octaves);
+        auto middle = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < points; i += NOISE_LANES)
+            turbulenceNoise(&x[i], &y[i], &z[i], lacunarity, gain, octaves, &batched[i]);
+        auto end = std::chrono::steady_clock::now();
+
+        NoiseBenchmark result;
+        result.points = points;
+        result.stbNanosPerPoint = (double) std::chrono::duration_cast<std::chrono::nanoseconds>(middle - start).count() / (double) points;
+        result.batchNanosPerPoint = (double) std::chrono::duration_cast<std::chrono::nanoseconds>(end - middle).count() / (double) points;
+        for (size_t i = 0; i < points; i++) {
+            if (stb[i] != batched[i]) {
+                result.mismatches++;
+                result.maxError = std::max(result.maxError, std::abs(stb[i] - batched[i]));
+            }
+        }
+        return result;
+    }
+
+}
@@ -0,0 +1,65 @@
+//
+// Created by brett on 7/28/23.
+//
+#include <genetic/v3/profile_v3.h>
+#include <genetic/v3/compiler_v3.h>
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+
+namespace parks::genetic {
+
+    static std::mutex lastMutex;
+    static OperatorProfile lastProfile;
+
+    void OperatorProfile::add(const CompiledTree& program, const std::vector<OperatorCost>& costs) {
+        const auto& instructions = program.getInstructions();
+        for (size_t i = 0; i < instructions.size() && i < costs.size(); i++) {
+            const auto& ins = instructions[i];
+            functions[(size_t) ins.op] += costs[i];
+            auto& node = nodes.try_emplace(ins.node, NodeCost{ins.op, {}}).first->second;
+            node.cost += costs[i];
+        }
+    }
+
+    uint64_t OperatorProfile::totalCycles() const {
+        uint64_t total = 0;
+        for (const auto& cost : functions)
+            total += cost.cycles;
+        return total;
+    }
+
+    void OperatorProfile::writeCsv(std::ostream& out) const {
+        out << "kind,node,function,calls,cycles,cycles_per_call,percent\n";
+        auto total = (double) std::max<uint64_t>(totalCycles(), 1);
+        auto line = [&](const char* kind, const std::string& node, FunctionID op, const OperatorCost& cost) {
+            out << kind << ',' << node << ",\"" << FUNCTION_TABLE[(size_t) op].name << "\"," << cost.calls << ',' << cost.cycles << ','
+                << (cost.calls == 0 ? 0.0 : (double) cost.cycles / (double) cost.calls) << ',' << 100.0 * (double) cost.cycles / total << '\n';
+        };
+        for (const auto& [index, node] : nodes)
+            line("node", std::to_string(index), node.op, node.cost);
+        for (size_t i = 0; i < FUNCTION_COUNT; i++) {
+            if (functions[i].calls != 0)
+                line("function", "", (FunctionID) i, functions[i]);
+        }
+    }
+
+    bool OperatorProfile::writeCsv(const std::string& path) const {
+        std::ofstream out(path);
+        if (!out)
+            return false;
+        writeCsv(out);
+        return (bool) out;
+    }
+
+    void OperatorProfile::publish(OperatorProfile profile) {
+        std::scoped_lock<std::mutex> lock(lastMutex);
+        lastProfile = std::move(profile);
+    }
+
+    OperatorProfile OperatorProfile::last() {
+        std::scoped_lock<std::mutex> lock(lastMutex);
+        return lastProfile;
+    }
+
+}
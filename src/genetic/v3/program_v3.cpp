@@ -2,154 +2,334 @@
 // Created by brett on 7/18/23.
 //
 #include <genetic/v3/program_v3.h>
-#include "imgui.h"
+#include <parks/trace.h>
+#include <parks/perf_counters.h>
+#include <parks/memory.h>
+#include <deque>
 #include <queue>
 #include <utility>
+#include <cstring>
+#include <limits>
+#include <new>
 
 namespace parks::genetic {
     
-    static inline int pow(int b, int e){
-        auto o = 1;
-        for (int i = 0; i < e; i++)
-            o *= b;
-        return o;
+    struct RenderJob {
+        std::shared_ptr<const CompiledTree> program;
+        std::shared_ptr<const JitTree> jit;
+        bool singlePrecision = false;
+        AxisTables tables;
+        FloatAxisTables floatTables;
+        BoundNoise noise;
+        unsigned int width = WIDTH, height = HEIGHT;
+        unsigned int tilesX = 0;
+        std::atomic<size_t> remainingTiles{0};
+        FitnessScores* scores = nullptr;
+        FitnessReduction fitness;
+        bool bw = false;
+        unsigned char* pixels = nullptr;
+        // indexed by worker, each worker only touches its own entry
+        std::vector<BatchState> states;
+        std::vector<FloatBatchState> floatStates;
+        std::vector<JitState> jitStates;
+        std::vector<ColorBatch> jitOutputs;
+        std::vector<char> prepared;
+#ifdef PARKSNREC_OP_PROFILE
+        // axis subprogram costs, the workers' costs are added once every tile is done
+        OperatorProfile profile;
+#endif
+    };
+    
+    std::shared_ptr<const CompiledTree> GeneticTree::getCompiled() {
+        if (compiledCache == nullptr)
+            compiledCache = std::make_shared<const CompiledTree>(compile());
+        return compiledCache;
     }
     
-    void Program::run() {
-        if (ImGui::Button("Run Program")){
-            if (tree != nullptr) {
-                tree->processImage(pixels);
-                regenTreeDisplay();
-            } else {
-                ImGui::Text("Tree is currently null!");
-            }
-        }
-        if (ImGui::Button("Regen Program And Run")) {
-            delete last_tree;
-            last_tree = tree;
-            tree = new GeneticTree(7);
-            regenTreeDisplay();
-            
-            tree->processImage(pixels);
-        }
-        if (ImGui::Button("Crossover")){
-            if (tree != nullptr && saved_tree != nullptr)
-                tree->crossover(saved_tree);
-        }
-        if (ImGui::Button("Mutate")){
-            tree->mutate();
-        }
-        if (ImGui::Button("Save")){
-            delete saved_tree;
-            saved_tree = tree;
-            tree = nullptr;
-        }
-        if (ImGui::Button("Revert")){
-            delete tree;
-            tree = saved_tree;
-            saved_tree = nullptr;
+    std::shared_ptr<const JitTree> GeneticTree::getJit() {
+        if (jitCache == nullptr && JitTree::supported()) {
+            auto jit = std::make_shared<const JitTree>(getCompiled());
+            if (jit->valid())
+                jitCache = jit;
         }
-        if (ImGui::Button("Revert To Last")){
-            delete tree;
-            tree = last_tree;
-            last_tree = nullptr;
-        }
-        if (ImGui::CollapsingHeader("Progress")) {
-            ImGui::Text("Render Progress: ");
-            ImGui::ProgressBar(getRenderProgress());
-        }
-        ImGui::Text("Tree %p, Saved %p, Last %p", tree, saved_tree, last_tree);
-        ImGui::Text("Eval %f", GeneticTree::evaluate(pixels));
+        return jitCache;
     }
     
-    void Program::regenTreeDisplay() {
-        treeNodes = {};
-        for (int i = 0; i < tree->getSize(); i++){
-            auto node = tree->node(i);
-            if (node == nullptr)
-                continue;
-            auto height = GeneticTree::height(i);
-            ImNode_t n;
-            
-            n.height = height;
-            n.id = node->op;
-            n.index = i;
-            n.selected = false;
-            n.pos = {(float)i * 100, 0};
-            n.inputs[0] = {"In", 1};
-            n.outputs[0] = {"Left", 1};
-            n.outputs[1] = {"Right", 1};
-            
-            treeNodes.push_back(n);
-        }
+    void GeneticTree::processImage(unsigned char* pixels, RenderBackend backend, Precision precision, FitnessScores* scores) {
+        beginProcessImage(pixels, backend, precision, scores);
+        RenderPool::get().wait();
+        if (scores != nullptr)
+            evaluatePostMetrics(pixels, *scores);
+    }
+    
+    void GeneticTree::processImage(unsigned char* pixels, unsigned int width, unsigned int height, FitnessScores* scores) {
+        beginRender(pixels, width, height, RenderBackend::INTERPRETER, Precision::DOUBLE, scores);
+        RenderPool::get().wait();
+        if (scores != nullptr)
+            evaluatePostMetrics(pixels, *scores, width, height);
     }
     
-    void Program::draw() {
-        static ImNodes::Ez::Context* context = ImNodes::Ez::CreateContext();
-        IM_UNUSED(context);
+    static inline unsigned int tilesAcross(unsigned int width) {
+        return (width + TILE_WIDTH - 1) / TILE_WIDTH;
+    }
+    
+    static inline unsigned int tilesDown(unsigned int height) {
+        return (height + TILE_HEIGHT - 1) / TILE_HEIGHT;
+    }
+    
+    void GeneticTree::beginProcessImage(unsigned char* pixels, RenderBackend backend, Precision precision, FitnessScores* scores) {
+        beginRender(pixels, WIDTH, HEIGHT, backend, precision, scores);
+    }
+    
+    void GeneticTree::beginRender(unsigned char* pixels, unsigned int width, unsigned int height, RenderBackend backend, Precision precision,
+                                  FitnessScores* scores) {
+        renderProgram(getCompiled(), backend == RenderBackend::JIT ? getJit() : nullptr, pixels, width, height, precision, scores);
+    }
+    
+    void renderProgram(std::shared_ptr<const CompiledTree> program, std::shared_ptr<const JitTree> jit, unsigned char* pixels, unsigned int width,
+                       unsigned int height, Precision precision, FitnessScores* scores) {
+        trace::Scope scope("render setup", "render");
+        auto& pool = RenderPool::get();
         
-        if (ImGui::Begin("ImNodes", nullptr, ImGuiWindowFlags_NoScrollbar | ImGuiWindowFlags_NoScrollWithMouse))
+        if (scores != nullptr) {
+            // a previous render may still be writing into these scores
+            pool.wait();
+            scores->values.assign(scores->metrics.size(), std::numeric_limits<double>::quiet_NaN());
+        }
+        
+        auto job = std::make_shared<RenderJob>();
+        job->program = std::move(program);
+        if (jit != nullptr) {
+            job->jit = std::move(jit);
+            job->jitStates.resize(pool.threadCount());
+            job->jitOutputs.resize(pool.threadCount());
+        }
+        // the jit only generates double precision code
+        job->singlePrecision = job->jit == nullptr && precision == Precision::FLOAT;
+#ifdef PARKSNREC_OP_PROFILE
+        // the jit has no per operator hooks, profiling only its axis tables would be misleading
+        auto profile = job->jit == nullptr ? &job->profile : nullptr;
+#else
+        OperatorProfile* profile = nullptr;
+#endif
         {
-            ImNodes::Ez::BeginCanvas();
+            perf::Scope counters(perf::Phase::RENDER);
+            if (job->singlePrecision) {
+                job->floatTables = job->program->buildTables<float>(width, height, profile);
+                job->floatStates.resize(pool.threadCount());
+            } else {
+                job->tables = job->program->buildTables(width, height, profile);
+                job->states.resize(pool.threadCount());
+            }
+        }
+        // the jit evaluates noise through callouts which have no way to read a cached field
+        if (job->jit == nullptr)
+            job->noise = NoiseCache::get().bind(*job->program, width, height);
+        job->bw = job->program->resultIsBW();
+        job->pixels = pixels;
+        job->width = width;
+        job->height = height;
+        job->tilesX = tilesAcross(width);
+        auto tiles = job->tilesX * tilesDown(height);
+        job->prepared.resize(pool.threadCount(), false);
+        if (scores != nullptr) {
+            job->scores = scores;
+            job->fitness = FitnessReduction(*scores, pixels, width, height, TILE_WIDTH);
+        }
+        
+        job->remainingTiles = tiles;
+        
+        pool.dispatch(tiles, [job](size_t task, size_t worker) -> void {
+            trace::Scope scope("tile", "render", (int64_t) task);
+            if (!job->prepared[worker]) {
+                if (job->jit)
+                    job->jit->prepare(job->jitStates[worker], &job->tables);
+                else if (job->singlePrecision)
+                    job->program->prepare(job->floatStates[worker], &job->floatTables, &job->noise.bindings);
+                else
+                    job->program->prepare(job->states[worker], &job->tables, &job->noise.bindings);
+                job->prepared[worker] = true;
+            }
+            
+            auto width = job->width;
+            auto height = job->height;
+            auto tileX = (unsigned int) (task % job->tilesX) * TILE_WIDTH;
+            auto tileY = (unsigned int) (task / job->tilesX) * TILE_HEIGHT;
+            auto tileWidth = std::min(TILE_WIDTH, width - tileX);
+            auto tileHeight = std::min(TILE_HEIGHT, height - tileY);
+            
+            // writes the visible lanes of a batch of either precision starting at pixel (i, j)
+            auto store = [&job](const auto& out, unsigned int i, unsigned int j) {
+                auto count = std::min(BATCH_SIZE, job->width - i);
+                for (unsigned int lane = 0; lane < count; lane++) {
+                    auto pos = (size_t) (i + lane) * CHANNELS + (size_t) j * job->width * CHANNELS;
+                    
+                    auto r = (unsigned char) (out.r[lane] * 255);
+                    auto g = (unsigned char) (out.g[lane] * 255);
+                    auto b = (unsigned char) (out.b[lane] * 255);
+                    
+                    if (job->bw)
+                        g = b = r;
+                    
+                    job->pixels[pos] = r;
+                    job->pixels[pos + 1] = g;
+                    job->pixels[pos + 2] = b;
+                }
+            };
             
-            for (ImNode_t& node : treeNodes)
             {
-                if (ImNodes::Ez::BeginNode(&node, ("H: " + std::to_string(node.height) + " | I: " + std::to_string(node.index) + " : " + functions[node.id].name).c_str(), &node.pos, &node.selected))
-                {
-                    if(functions[node.id].allowsArgument())
-                        ImGui::Text("Left Tree: %d", GeneticTree::left(node.index));
-                    if (functions[node.id].bothArgument() || functions[node.id].dontCareArgument())
-                        ImGui::Text("Right Tree: %d", GeneticTree::right(node.index));
-                    //ImNodes::Ez::InputSlots(node.inputs, 1);
-                    //ImNodes::Ez::OutputSlots(node.outputs, 2);
-                    ImNodes::Ez::EndNode();
+                perf::Scope counters(perf::Phase::RENDER);
+                for (unsigned int j = tileY; j < tileY + tileHeight; j++) {
+                    for (unsigned int i = tileX; i < tileX + tileWidth; i += BATCH_SIZE) {
+                        if (job->jit) {
+                            job->jit->executeBatch(i, j, width, height, job->jitStates[worker], job->jitOutputs[worker]);
+                            store(job->jitOutputs[worker], i, j);
+                        } else if (job->singlePrecision)
+                            store(job->program->executeBatch(i, j, width, height, job->floatStates[worker]), i, j);
+                        else
+                            store(job->program->executeBatch(i, j, width, height, job->states[worker]), i, j);
+                    }
                 }
-//                auto p = GeneticTree::parent(node.index);
-//                auto parent = tree->node(p);
-//                if (p >= 0 && parent != nullptr) {
-//                    //BLT_TRACE("Parent i: %d, Parent %d for input node %d", p, parent, node.index);
-//                    if (GeneticTree::left(p) == node.index)
-//                        ImNodes::Connection(&node, "In", &parent, "Left");
-//                    else
-//                        ImNodes::Connection(&node, "In", &parent, "Right");
-//                }
             }
-            //ImNodes::Connection(&nodes[2], "In", &nodes[0], "Out");
             
-            ImNodes::Ez::EndCanvas();
+            // reduce the tile while its pixels are still in cache, counting any band of the similarity it completes
+            if (!job->fitness.empty()) {
+                trace::Scope fitnessScope("fitness tile", "fitness", (int64_t) task);
+                perf::Scope counters(perf::Phase::FITNESS);
+                job->fitness.accumulate(task, tileX, tileY, tileWidth, tileHeight);
+            }
+            
+            // the last tile sees every other tile's writes, so any noise fields this render filled are now complete
+            if (job->remainingTiles.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                if (!job->noise.pending.empty())
+                    NoiseCache::get().insert(job->noise);
+                if (job->scores != nullptr)
+                    job->fitness.finish(*job->scores);
+#ifdef PARKSNREC_OP_PROFILE
+                if (job->jit == nullptr) {
+                    for (const auto& state : job->states)
+                        job->profile.add(*job->program, state.profile);
+                    for (const auto& state : job->floatStates)
+                        job->profile.add(*job->program, state.profile);
+                    job->profile.width = width;
+                    job->profile.height = height;
+                    OperatorProfile::publish(std::move(job->profile));
+                }
+#endif
+            }
+        });
+    }
+    
+    void GeneticTree::evaluate(const unsigned char* pixels, FitnessScores& scores, unsigned int width, unsigned int height) {
+        scores.values.assign(scores.metrics.size(), std::numeric_limits<double>::quiet_NaN());
+        auto tilesX = tilesAcross(width);
+        auto tiles = tilesX * tilesDown(height);
+        FitnessReduction fitness(scores, pixels, width, height, TILE_WIDTH);
+        if (!fitness.empty()) {
+            for (size_t tile = 0; tile < tiles; tile++) {
+                auto tileX = (unsigned int) (tile % tilesX) * TILE_WIDTH;
+                auto tileY = (unsigned int) (tile / tilesX) * TILE_HEIGHT;
+                fitness.accumulate(tile, tileX, tileY, std::min(TILE_WIDTH, width - tileX), std::min(TILE_HEIGHT, height - tileY));
+            }
+            fitness.finish(scores);
         }
-        ImGui::End();
+        evaluatePostMetrics(pixels, scores, width, height);
     }
     
-    void GeneticTree::processImage(unsigned char* pixels) {
-        for (unsigned int i = 0; i < WIDTH; i++) {
-            for (unsigned int j = 0; j < HEIGHT; j++){
-                auto pos = getPixelPosition(i, j);
-                
-                //auto out = functions[FunctionID::COLOR_NOISE].call({ARGS_BOTH, Color((double)i / WIDTH), Color((double)j / HEIGHT)}, set);
-                
-                auto out = execute((double)i / WIDTH, (double)j / HEIGHT);
-                
-                auto r = (unsigned char)(out.r * 255);
-                auto g = (unsigned char) (out.g * 255);
-                auto b = (unsigned char) (out.b * 255);
-                
-                if (out.bw)
-                    g = b = r;
-                
-                pixels[pos] = r;
-                pixels[pos + 1] = g;
-                pixels[pos + 2] = b;
+    PrecisionReport GeneticTree::comparePrecision() {
+        // images are large, keep them off the stack
+        std::vector<unsigned char> doubleImage(WIDTH * HEIGHT * CHANNELS);
+        std::vector<unsigned char> floatImage(WIDTH * HEIGHT * CHANNELS);
+        processImage(doubleImage.data(), RenderBackend::INTERPRETER, Precision::DOUBLE);
+        processImage(floatImage.data(), RenderBackend::INTERPRETER, Precision::FLOAT);
+        
+        PrecisionReport report;
+        for (size_t pos = 0; pos < doubleImage.size(); pos += CHANNELS) {
+            int difference = 0;
+            for (size_t c = 0; c < CHANNELS; c++)
+                difference = std::max(difference, std::abs((int) doubleImage[pos + c] - (int) floatImage[pos + c]));
+            report.maxDifference = std::max(report.maxDifference, difference);
+            if (difference != 0)
+                report.differentPixels++;
+            if (difference > FLOAT_CHANNEL_TOLERANCE)
+                report.outsideTolerance++;
+        }
+        return report;
+    }
+    
+    long GeneticTree::compareBackends() {
+        auto program = getCompiled();
+        auto jit = getJit();
+        if (jit == nullptr)
+            return -1;
+        
+        auto same = [](double a, double b) -> bool {
+            return (std::isnan(a) && std::isnan(b)) || std::memcmp(&a, &b, sizeof(double)) == 0;
+        };
+        
+        BatchState state;
+        JitState jitState;
+        ColorBatch jitOut{};
+        auto tables = program->buildTables(WIDTH, HEIGHT);
+        program->prepare(state, &tables);
+        jit->prepare(jitState, &tables);
+        
+        long mismatches = 0;
+        for (unsigned int j = 0; j < HEIGHT; j++) {
+            for (unsigned int i = 0; i < WIDTH; i += BATCH_SIZE) {
+                const auto& out = program->executeBatch(i, j, WIDTH, HEIGHT, state);
+                jit->executeBatch(i, j, WIDTH, HEIGHT, jitState, jitOut);
+                for (unsigned int lane = 0; lane < std::min(BATCH_SIZE, WIDTH - i); lane++) {
+                    if (!same(out.r[lane], jitOut.r[lane]) || !same(out.g[lane], jitOut.g[lane]) || !same(out.b[lane], jitOut.b[lane]))
+                        mismatches++;
+                }
             }
         }
+        return mismatches;
+    }
+    
+    // the traversal queues of the tree operations, taken from the tree arena when there is one
+    typedef std::queue<int, std::pmr::deque<int>> NodeQueue;
+    
+    static inline NodeQueue nodeQueue() {
+        return NodeQueue(std::pmr::deque<int>(treeResource()));
     }
     
     GeneticNode::GeneticNode(FunctionID op, unsigned int pos, ParameterSet  set):
             op(op), pos(pos), set(std::move(set)) {}
     
+    void* GeneticNode::operator new(size_t size) {
+        if (auto* arena = treeArena())
+            return arena->allocate(memory::Tag::GENETIC_NODES, size, alignof(GeneticNode));
+        memory::allocated(memory::Tag::GENETIC_NODES, size);
+        return ::operator new(size);
+    }
+    
+    // returns a node's memory to the arena it came from, or the heap
+    static inline void freeNode(GenerationArena* arena, void* p, size_t size) {
+        if (arena != nullptr)
+            arena->deallocate(memory::Tag::GENETIC_NODES, p, size, alignof(GeneticNode));
+        else {
+            memory::freed(memory::Tag::GENETIC_NODES, size);
+            ::operator delete(p);
+        }
+    }
+    
+    void GeneticNode::operator delete(GeneticNode* node, std::destroying_delete_t) {
+        // the arena is recorded by the constructor, which runs on the same thread straight after operator new
+        auto* arena = node->arena;
+        node->~GeneticNode();
+        freeNode(arena, node, sizeof(GeneticNode));
+    }
+    
+    void GeneticNode::operator delete(void* p, size_t size) {
+        // the constructor never ran, but new picked the arena on this thread moments ago
+        freeNode(treeArena(), p, size);
+    }
+    
     void GeneticTree::generateRandomTree(int n) {
-        std::queue<int> nodesToProcess;
-        std::queue<int> nonFuncNodesToProcess;
+        auto nodesToProcess = nodeQueue();
+        auto nonFuncNodesToProcess = nodeQueue();
         nodesToProcess.push(n);
         while (!nodesToProcess.empty()){
             int node = nodesToProcess.front();
@@ -194,18 +374,12 @@ namespace parks::genetic {
             if (parentNode == nullptr)
                 continue;
             
-            auto& parentFunc = functions[parentNode->op];
-            
-            std::vector<FunctionID> allowedFuncs;
-            if (parentFunc.allowedColors())
-                allowedFuncs.push_back(FunctionID::RAND_COLOR);
-            if (parentFunc.allowedScalars())
-                allowedFuncs.push_back(FunctionID::RAND_SCALAR);
-            
-            if (allowedFuncs.empty())
+            // left children always sit at even positions
+            auto slot = node % 2 == 0 ? ChildSlot::LEFT : ChildSlot::RIGHT;
+            if (!functions.accepts(parentNode->op, slot))
                 continue;
             
-            auto func = allowedFuncs[randomInt(0, (int)allowedFuncs.size()-1)];
+            auto func = functions.select(parentNode->op, slot);
             nodes[node] = new GeneticNode(func, node, functions[func].generateRandomParameters());
         }
     }
@@ -229,15 +403,15 @@ namespace parks::genetic {
         auto& func = functions[ourNode->op];
         
         if (func.disallowsArgument())
-            return func.call({ARGS_NONE, leftC, rightC}, ourNode->set);
+            return callFunction(ourNode->op, {ARGS_NONE, leftC, rightC}, ourNode->set);
         
         // functions should always take precedence
         if (func.allowedFuncs()) {
             int l = left(node);
             int r = right(node);
             
-            auto lNode = leftNode(l);
-            auto rNode = rightNode(r);
+            auto lNode = this->node(l);
+            auto rNode = this->node(r);
             
             if (lNode != nullptr)
                 leftC = execute_internal(x, y, l);
@@ -254,13 +428,67 @@ namespace parks::genetic {
                 leftC = Color(x);
                 rightC = Color(y);
             } else {
-                BLT_WARN("Function called (%s) from node (%d) without any args!", func.name.c_str(), node);
+                BLT_WARN("Function called (%s) from node (%d) without any args!", func.name, node);
             }
         }
-        return func.call({ARGS_BOTH, leftC, rightC}, ourNode->set);
+        return callFunction(ourNode->op, {ARGS_BOTH, leftC, rightC}, ourNode->set);
+    }
+    
+    CompiledTree GeneticTree::compile() const {
+        CompiledTree program;
+        program.result = compile_internal(0, program);
+        program.separate();
+        return program;
+    }
+    
+    Operand GeneticTree::compile_internal(int node, CompiledTree& program) const {
+        auto ourNode = nodes[node];
+        auto& func = functions[ourNode->op];
+        
+        // argument-less nodes can't depend on the pixel so they are computed once here
+        if (func.disallowsArgument())
+            return program.addConstant(callFunction(ourNode->op, {ARGS_NONE, Color{0}, Color{0}}, ourNode->set));
+        
+        auto exists = [this](int pos) -> bool {
+            return pos >= 0 && pos < size && nodes[pos] != nullptr;
+        };
+        
+        Operand leftO{};
+        Operand rightO{};
+        
+        // mirrors the child resolution in execute_internal()
+        if (func.allowedFuncs()) {
+            int l = left(node);
+            int r = right(node);
+            
+            if (exists(l))
+                leftO = compile_internal(l, program);
+            else if (func.allowedVariables())
+                leftO = {OperandType::X};
+            if (exists(r))
+                rightO = compile_internal(r, program);
+            else if (func.allowedVariables())
+                rightO = {OperandType::Y};
+        } else {
+            if (func.allowedVariables()) {
+                leftO = {OperandType::X};
+                rightO = {OperandType::Y};
+            } else {
+                BLT_WARN("Function compiled (%s) from node (%d) without any args!", func.name, node);
+            }
+        }
+        // single argument operators never read the right side, don't let a variable there stop folding
+        if (func.singleArgument())
+            rightO = {OperandType::ZERO};
+        
+        // subtrees which never see x or y produce the same color for every pixel, evaluate them once and keep the literal
+        if (program.isInvariant(leftO) && program.isInvariant(rightO))
+            return program.fold(ourNode->op, leftO, rightO, ourNode->set);
+        return program.addInstruction(ourNode->op, leftO, rightO, ourNode->set, node);
     }
     
     void GeneticTree::mutate() {
+        invalidateCache();
         for (int i = 0; i < size; i++){
             if (nodes[i] == nullptr) {
                 // TODO: ?
@@ -311,7 +539,8 @@ namespace parks::genetic {
     }
     
     void GeneticTree::deleteSubtree(int n) {
-        std::queue<int> nodesToDelete;
+        invalidateCache();
+        auto nodesToDelete = nodeQueue();
         nodesToDelete.push(n);
         while (!nodesToDelete.empty()){
             auto node = nodesToDelete.front();
@@ -343,6 +572,8 @@ namespace parks::genetic {
     }
     
     void GeneticTree::crossover(GeneticTree* other) {
+        invalidateCache();
+        other->invalidateCache();
         // one point crossover for now but a better crossover system is TODO!
         auto pt = std::min(subtreeSize(0), other->subtreeSize(0));
         auto n = randomInt(std::min(pt, 1), pt);
@@ -353,8 +584,8 @@ namespace parks::genetic {
         insertSubtree(n, old2.first, old2.second);
         other->insertSubtree(n, old1.first, old1.second);
         
-        delete[] old1.first;
-        delete[] old2.first;
+        freeNodes(old1.first, old1.second);
+        freeNodes(old2.first, old2.second);
     }
     
     bool operatorsCompatible(FunctionID id1, FunctionID id2){
@@ -372,27 +603,138 @@ namespace parks::genetic {
     }
     
     GeneticTree* GeneticTree::breed(GeneticTree* parent1, GeneticTree* parent2) {
-        if (chance(60))
-            parent1->crossover(parent2);
-        
-        auto newSize = std::max(parent1->size, parent2->size);
-        auto minSize = std::min(parent1->size, parent2->size);
+        // crossover swaps subtrees between both trees, so work on copies and leave the parents alone
+        auto* child = parent1->copy();
+        if (chance(crossoverChance)) {
+            auto* other = parent2->copy();
+            child->crossover(other);
+            delete other;
+        }
+        if (chance(mutationChance))
+            child->mutate();
+        return child;
+    }
+    
+    GeneticTree* GeneticTree::copy() {
+        auto* tree = new GeneticTree(copySubtree(0), size);
+        tree->max_height = max_height;
+        return tree;
+    }
+    
+    template<typename T>
+    static inline void write(std::vector<unsigned char>& out, T value) {
+        auto pos = out.size();
+        out.resize(pos + sizeof(T));
+        std::memcpy(&out[pos], &value, sizeof(T));
+    }
+    
+    template<typename T>
+    static inline bool read(const std::vector<unsigned char>& data, size_t& offset, T& value) {
+        if (offset + sizeof(T) > data.size())
+            return false;
+        std::memcpy(&value, &data[offset], sizeof(T));
+        offset += sizeof(T);
+        return true;
+    }
+    
+    void GeneticTree::serialize(std::vector<unsigned char>& out) const {
+        uint32_t count = 0;
+        for (int i = 0; i < size; i++)
+            count += nodes[i] != nullptr;
+        write<int32_t>(out, size);
+        write<int32_t>(out, max_height);
+        write<uint32_t>(out, count);
+        for (int i = 0; i < size; i++) {
+            if (nodes[i] == nullptr)
+                continue;
+            write<uint32_t>(out, i);
+            write<uint8_t>(out, (uint8_t) nodes[i]->op);
+            write<uint32_t>(out, nodes[i]->pos);
+            write<uint8_t>(out, (uint8_t) nodes[i]->set.size());
+            for (size_t p = 0; p < nodes[i]->set.size(); p++) {
+                const auto& c = nodes[i]->set[(int) p];
+                write<double>(out, c.r);
+                write<double>(out, c.g);
+                write<double>(out, c.b);
+                write<uint8_t>(out, c.bw);
+            }
+        }
+    }
+    
+    GeneticTree* GeneticTree::deserialize(const std::vector<unsigned char>& data, size_t& offset) {
+        int32_t treeSize, height;
+        uint32_t count;
+        if (!read(data, offset, treeSize) || !read(data, offset, height) || !read(data, offset, count))
+            return nullptr;
+        // the data may come from another machine, anything a tree can't look like is rejected before it's allocated
+        if (treeSize <= 0 || treeSize > (1 << MAX_HEIGHT) + 1 || height < 0 || height > MAX_HEIGHT || count == 0 || count > (uint32_t) treeSize)
+            return nullptr;
         
-        if (operatorsCompatible(parent1->node(0)->op, parent2->node(0)->op)) {
-        
-        } else {
+        auto** treeNodes = allocateNodes(treeSize);
+        auto* tree = new GeneticTree(treeNodes, treeSize);
+        tree->max_height = height;
         
+        for (uint32_t n = 0; n < count; n++) {
+            uint32_t index, pos;
+            uint8_t op, params;
+            if (!read(data, offset, index) || !read(data, offset, op) || !read(data, offset, pos) || !read(data, offset, params) ||
+                index >= (uint32_t) treeSize || pos != index || op > (uint8_t) FunctionID::COLOR_NOISE || params > MAX_PARAMETERS ||
+                treeNodes[index] != nullptr) {
+                delete tree;
+                return nullptr;
+            }
+            // serialize() writes parents before their children, so the root comes first and every other node must
+            // hang off one already read. left() and right() put the children of p at 2p + 2 and 2p + 3
+            if (index != 0 && (index < 2 || treeNodes[index / 2 - 1] == nullptr)) {
+                delete tree;
+                return nullptr;
+            }
+            ParameterSet set;
+            for (uint8_t p = 0; p < params; p++) {
+                // built by hand, the three argument constructor would normalize the values
+                Color c(0);
+                uint8_t bw;
+                if (!read(data, offset, c.r) || !read(data, offset, c.g) || !read(data, offset, c.b) || !read(data, offset, bw)) {
+                    delete tree;
+                    return nullptr;
+                }
+                c.bw = bw;
+                set.add(c);
+            }
+            treeNodes[index] = new GeneticNode((FunctionID) op, pos, std::move(set));
+        }
+        return tree;
+    }
+    
+    GeneticNode** GeneticTree::allocateNodes(size_t count) {
+        GeneticNode** array;
+        if (auto* arena = treeArena())
+            array = (GeneticNode**) arena->allocate(memory::Tag::GENETIC_NODE_ARRAYS, count * sizeof(GeneticNode*), alignof(GeneticNode*));
+        else {
+            memory::allocated(memory::Tag::GENETIC_NODE_ARRAYS, count * sizeof(GeneticNode*));
+            array = new GeneticNode*[count];
+        }
+        for (size_t i = 0; i < count; i++)
+            array[i] = nullptr;
+        return array;
+    }
+    
+    void GeneticTree::freeNodes(GeneticNode** nodes, size_t count, GenerationArena* arena) {
+        if (nodes == nullptr)
+            return;
+        if (arena != nullptr)
+            arena->deallocate(memory::Tag::GENETIC_NODE_ARRAYS, nodes, count * sizeof(GeneticNode*), alignof(GeneticNode*));
+        else {
+            memory::freed(memory::Tag::GENETIC_NODE_ARRAYS, count * sizeof(GeneticNode*));
+            delete[] nodes;
         }
-        
-        return nullptr;
     }
     
     std::pair<GeneticNode**, size_t> GeneticTree::moveSubtree(int n) {
-        auto** newNodes = new GeneticNode*[size];
-        for (int i = 0; i < size; i++)
-            newNodes[i] = nullptr;
+        invalidateCache();
+        auto** newNodes = allocateNodes(size);
         
-        std::queue<int> nodesToMove;
+        auto nodesToMove = nodeQueue();
         nodesToMove.push(n);
         while (!nodesToMove.empty()){
             auto node = nodesToMove.front();
@@ -414,7 +756,8 @@ namespace parks::genetic {
     }
     
     void GeneticTree::insertSubtree(int n, GeneticNode** tree, size_t s) {
-        std::queue<int> nodesToMove;
+        invalidateCache();
+        auto nodesToMove = nodeQueue();
         nodesToMove.push(n);
         while (!nodesToMove.empty()){
             auto node = nodesToMove.front();
@@ -475,6 +818,10 @@ namespace parks::genetic {
     }
     
     double GeneticTree::evaluate(const unsigned char* pixels) {
+        return evaluateFitness(pixels);
+    }
+    
+    double GeneticTree::evaluateReference(const unsigned char* pixels) {
         double val = 0;
         for (unsigned int i = 0; i < WIDTH; i++){
             for (unsigned int j = 0; j < HEIGHT; j++){
@@ -519,11 +866,9 @@ namespace parks::genetic {
     }
     
     GeneticNode** GeneticTree::copySubtree(int n) {
-        auto** newNodes = new GeneticNode*[size];
-        for (int i = 0; i < size; i++)
-            newNodes[i] = nullptr;
+        auto** newNodes = allocateNodes(size);
         
-        std::queue<int> nodesToMove;
+        auto nodesToMove = nodeQueue();
         nodesToMove.push(n);
         while (!nodesToMove.empty()){
             auto node = nodesToMove.front();
@@ -0,0 +1,142 @@
+//
+// Created by brett on 7/25/23.
+//
+#include <genetic/v3/render_pool.h>
+#include <parks/trace.h>
+#include <algorithm>
+#include <string>
+
+namespace parks::genetic {
+
+    RenderPool::RenderPool(size_t threads) {
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        queues = std::make_unique<WorkQueue[]>(threads);
+        for (size_t i = 0; i < threads; i++)
+            workers.emplace_back([this, i]() { workerLoop(i); });
+    }
+
+    bool RenderPool::pop(size_t worker, size_t& task) {
+        auto& queue = queues[worker];
+        auto range = queue.range.load(std::memory_order_acquire);
+        while (true) {
+            auto begin = range >> 32;
+            auto end = range & 0xFFFFFFFF;
+            if (begin >= end)
+                return false;
+            if (queue.range.compare_exchange_weak(range, pack(begin + 1, end), std::memory_order_acq_rel)) {
+                task = begin;
+                return true;
+            }
+        }
+    }
+
+    bool RenderPool::steal(size_t worker) {
+        for (size_t i = 1; i < workers.size(); i++) {
+            auto& victim = queues[(worker + i) % workers.size()];
+            auto range = victim.range.load(std::memory_order_acquire);
+            while (true) {
+                auto begin = range >> 32;
+                auto end = range & 0xFFFFFFFF;
+                if (begin >= end)
+                    break;
+                // take the back half, the victim keeps working from the front
+                auto split = end - (end - begin + 1) / 2;
+                if (victim.range.compare_exchange_weak(range, pack(begin, split), std::memory_order_acq_rel)) {
+                    queues[worker].range.store(pack(split, end), std::memory_order_release);
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    void RenderPool::workerLoop(size_t worker) {
+        trace::setThreadName("render worker " + std::to_string(worker));
+        uint64_t lastGeneration = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(jobMutex);
+                jobStarted.wait(lock, [&]() { return !running || jobGeneration != lastGeneration; });
+                if (!running)
+                    return;
+                lastGeneration = jobGeneration;
+            }
+
+            size_t task;
+            while (pop(worker, task) || (steal(worker) && pop(worker, task))) {
+                job(task, worker);
+                completedTasks.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            {
+                std::scoped_lock<std::mutex> lock(jobMutex);
+                if (--activeWorkers == 0)
+                    jobFinished.notify_all();
+            }
+        }
+    }
+
+    void RenderPool::dispatch(size_t tasks, task_func func) {
+        std::unique_lock<std::mutex> lock(jobMutex);
+        jobFinished.wait(lock, [this]() { return activeWorkers == 0; });
+
+        job = std::move(func);
+        totalTasks = tasks;
+        completedTasks = 0;
+
+        auto perWorker = tasks / workers.size();
+        auto extra = tasks % workers.size();
+        size_t begin = 0;
+        for (size_t i = 0; i < workers.size(); i++) {
+            auto end = begin + perWorker + (i < extra ? 1 : 0);
+            queues[i].range.store(pack(begin, end), std::memory_order_relaxed);
+            begin = end;
+        }
+
+        activeWorkers = workers.size();
+        jobGeneration++;
+        jobStarted.notify_all();
+    }
+
+    void RenderPool::wait() {
+        trace::Scope scope("wait", "pool");
+        std::unique_lock<std::mutex> lock(jobMutex);
+        jobFinished.wait(lock, [this]() { return activeWorkers == 0; });
+    }
+
+    bool RenderPool::busy() {
+        std::scoped_lock<std::mutex> lock(jobMutex);
+        return activeWorkers != 0;
+    }
+
+    float RenderPool::progress() const {
+        auto total = totalTasks.load(std::memory_order_relaxed);
+        if (total == 0)
+            return 1;
+        return (float) completedTasks.load(std::memory_order_relaxed) / (float) total;
+    }
+
+    static size_t sharedThreads = 0;
+    
+    RenderPool& RenderPool::get() {
+        static RenderPool pool(sharedThreads);
+        return pool;
+    }
+    
+    void RenderPool::setSharedThreads(size_t threads) {
+        sharedThreads = threads;
+    }
+
+    RenderPool::~RenderPool() {
+        {
+            std::unique_lock<std::mutex> lock(jobMutex);
+            jobFinished.wait(lock, [this]() { return activeWorkers == 0; });
+            running = false;
+        }
+        jobStarted.notify_all();
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+}
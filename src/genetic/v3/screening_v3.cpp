@@ -0,0 +1,119 @@
+//
+// Created by brett on 7/28/23.
+//
+#include <genetic/v3/screening_v3.h>
+#include <genetic/v3/program_v3.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+namespace parks::genetic {
+    
+    // only over pairs where both scores are finite, broken images score -infinity
+    static double pearson(const std::vector<double>& a, const std::vector<double>& b) {
+        std::vector<std::pair<double, double>> pairs;
+        for (size_t i = 0; i < a.size(); i++) {
+            if (std::isfinite(a[i]) && std::isfinite(b[i]))
+                pairs.emplace_back(a[i], b[i]);
+        }
+        if (pairs.size() < 2)
+            return 0;
+        double meanA = 0, meanB = 0;
+        for (auto [x, y] : pairs) {
+            meanA += x;
+            meanB += y;
+        }
+        meanA /= (double) pairs.size();
+        meanB /= (double) pairs.size();
+        double covariance = 0, varianceA = 0, varianceB = 0;
+        for (auto [x, y] : pairs) {
+            covariance += (x - meanA) * (y - meanB);
+            varianceA += (x - meanA) * (x - meanA);
+            varianceB += (y - meanB) * (y - meanB);
+        }
+        if (varianceA == 0 || varianceB == 0)
+            return 0;
+        return covariance / std::sqrt(varianceA * varianceB);
+    }
+    
+    // renders one candidate at resolution * (resolution * HEIGHT / WIDTH), returning its score and how long it took
+    static double score(GeneticTree* tree, unsigned int resolution, const FitnessScores& metrics, std::vector<unsigned char>& pixels, double& seconds) {
+        auto width = resolution;
+        auto height = resolution * HEIGHT / WIDTH;
+        pixels.resize((size_t) width * height * CHANNELS);
+        auto scores = metrics;
+        
+        auto start = std::chrono::steady_clock::now();
+        if (width == WIDTH && height == HEIGHT)
+            tree->processImage(pixels.data(), RenderBackend::INTERPRETER, Precision::DOUBLE, &scores);
+        else
+            tree->processImage(pixels.data(), width, height, &scores);
+        auto end = std::chrono::steady_clock::now();
+        
+        seconds = std::chrono::duration<double>(end - start).count();
+        auto value = scores.combined();
+        // broken images are the worst possible candidates
+        return std::isnan(value) ? -std::numeric_limits<double>::infinity() : value;
+    }
+    
+    ScreeningReport screenCandidates(const std::vector<GeneticTree*>& candidates, std::vector<double>& fitness, const ScreeningConfig& config,
+                                     bool measure) {
+        ScreeningReport report;
+        report.candidates = candidates.size();
+        report.measured = measure;
+        fitness.assign(candidates.size(), -std::numeric_limits<double>::infinity());
+        
+        std::vector<unsigned char> pixels;
+        // every stage followed by the full render
+        auto levels = config.stages.size() + 1;
+        auto resolutionOf = [&](size_t level) {
+            return level < config.stages.size() ? config.stages[level].resolution : WIDTH;
+        };
+        
+        // scores[level][candidate], NaN where not rendered
+        std::vector<std::vector<double>> scores(levels, std::vector<double>(candidates.size(), std::numeric_limits<double>::quiet_NaN()));
+        std::vector<std::vector<double>> times(levels, std::vector<double>(candidates.size(), 0));
+        if (measure) {
+            for (size_t level = 0; level < levels; level++) {
+                for (size_t i = 0; i < candidates.size(); i++)
+                    scores[level][i] = score(candidates[i], resolutionOf(level), config.metrics, pixels, times[level][i]);
+            }
+        }
+        
+        std::vector<size_t> alive(candidates.size());
+        std::iota(alive.begin(), alive.end(), 0);
+        for (size_t level = 0; level < levels; level++) {
+            for (auto i : alive) {
+                if (!measure)
+                    scores[level][i] = score(candidates[i], resolutionOf(level), config.metrics, pixels, times[level][i]);
+                report.screenedSeconds += times[level][i];
+            }
+            if (level == config.stages.size())
+                break;
+            
+            // keep everything above the percentile, but always at least one candidate
+            std::stable_sort(alive.begin(), alive.end(), [&](size_t a, size_t b) {
+                return scores[level][a] > scores[level][b];
+            });
+            auto keep = (size_t) std::ceil((double) alive.size() * (1.0 - config.stages[level].percentile));
+            alive.resize(std::clamp<size_t>(keep, std::min<size_t>(1, alive.size()), alive.size()));
+            std::sort(alive.begin(), alive.end());
+            report.survivors.push_back(alive.size());
+        }
+        
+        for (auto i : alive)
+            fitness[i] = scores[config.stages.size()][i];
+        
+        if (measure) {
+            const auto& full = scores[config.stages.size()];
+            for (size_t level = 0; level < config.stages.size(); level++)
+                report.correlation.push_back(pearson(scores[level], full));
+            for (auto t : times[config.stages.size()])
+                report.fullSeconds += t;
+        }
+        return report;
+    }
+    
+}
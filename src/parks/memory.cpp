@@ -0,0 +1,75 @@
+//
+// Created by brett on 7/28/23.
+//
+#include <parks/memory.h>
+#include <cstdio>
+
+namespace parks::memory {
+
+    detail::Counters detail::counters[TAG_COUNT];
+
+    TagStats stats(Tag tag) {
+        const auto& c = detail::counters[(size_t) tag];
+        TagStats stats;
+        stats.frees = c.frees.load(std::memory_order_relaxed);
+        stats.allocations = c.allocations.load(std::memory_order_relaxed);
+        stats.bytes = c.bytes.load(std::memory_order_relaxed);
+        stats.liveBytes = c.liveBytes.load(std::memory_order_relaxed);
+        stats.peakBytes = c.peakBytes.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    void resetPeaks() {
+        for (auto& c : detail::counters)
+            c.peakBytes.store(c.liveBytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+
+    const char* tagName(Tag tag) {
+        switch (tag) {
+            case Tag::GENETIC_NODES:
+                return "nodes";
+            case Tag::GENETIC_NODE_ARRAYS:
+                return "node arrays";
+            case Tag::TEXTURE_DECODE:
+                return "texture decode";
+            case Tag::GL_TEXTURES:
+                return "gl textures";
+            case Tag::GL_BUFFERS:
+                return "gl buffers";
+        }
+        return "?";
+    }
+
+    const char* subsystemName(Tag tag) {
+        switch (tag) {
+            case Tag::GENETIC_NODES:
+            case Tag::GENETIC_NODE_ARRAYS:
+                return "genetic";
+            case Tag::TEXTURE_DECODE:
+                return "resources";
+            case Tag::GL_TEXTURES:
+            case Tag::GL_BUFFERS:
+                return "renderer";
+        }
+        return "?";
+    }
+
+    std::string summary() {
+        std::string out;
+        char line[256];
+        for (size_t i = 0; i < TAG_COUNT; i++) {
+            auto tag = (Tag) i;
+            auto s = stats(tag);
+            if (s.allocations == 0)
+                continue;
+            std::snprintf(line, sizeof(line), "%-9s %-14s %10lu allocations, %10lu live, %10.1f kb live, %10.1f kb peak, %12.1f kb total",
+                          subsystemName(tag), tagName(tag), (unsigned long) s.allocations, (unsigned long) s.live(),
+                          (double) s.liveBytes / 1024, (double) s.peakBytes / 1024, (double) s.bytes / 1024);
+            if (!out.empty())
+                out += '\n';
+            out += line;
+        }
+        return out;
+    }
+
+}
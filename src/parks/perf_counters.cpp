@@ -0,0 +1,303 @@
+//
+// Created by brett on 7/28/23.
+//
+#include <parks/perf_counters.h>
+#include <chrono>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+
+#ifdef __linux__
+    #include <linux/perf_event.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
+namespace parks::perf {
+
+    std::atomic<bool> detail::enabled{false};
+
+    static std::atomic<uint64_t> phaseCalls[PHASE_COUNT];
+    static std::atomic<uint64_t> phaseNanoseconds[PHASE_COUNT];
+    static std::atomic<uint64_t> phaseCountedCalls[PHASE_COUNT];
+    static std::atomic<uint64_t> phaseEnabled[PHASE_COUNT];
+    static std::atomic<uint64_t> phaseRunning[PHASE_COUNT];
+    static std::atomic<uint64_t> phaseCounters[PHASE_COUNT][COUNTER_COUNT];
+
+    // what the first thread to try opening the counters found, every thread gets the same from the same kernel
+    static std::once_flag probed;
+    static bool counterSupported[COUNTER_COUNT]{};
+    static bool anySupported = false;
+    static std::string reason;
+
+    static inline uint64_t nanoseconds() {
+        return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+#ifdef __linux__
+    struct CounterConfig {
+        uint32_t type;
+        uint64_t config;
+    };
+
+    // indexed by Counter
+    static const CounterConfig COUNTER_CONFIGS[COUNTER_COUNT] = {
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    };
+
+    /**
+     * The calling thread's counters, opened as one group so they are all read with a single syscall
+     */
+    struct ThreadCounters {
+        int fds[COUNTER_COUNT];
+        int leader = -1;
+        // position of each counter in the group's read, -1 if it isn't open
+        int slot[COUNTER_COUNT];
+        size_t opened = 0;
+        bool tried = false;
+        // set while a scope is measuring this thread, scopes nested inside it are ignored
+        bool measuring = false;
+
+        ThreadCounters() {
+            for (size_t i = 0; i < COUNTER_COUNT; i++) {
+                fds[i] = -1;
+                slot[i] = -1;
+            }
+        }
+
+        void open() {
+            tried = true;
+            int error = 0;
+            for (size_t i = 0; i < COUNTER_COUNT; i++) {
+                perf_event_attr attr{};
+                attr.size = sizeof(attr);
+                attr.type = COUNTER_CONFIGS[i].type;
+                attr.config = COUNTER_CONFIGS[i].config;
+                // the times say whether the group was multiplexed or never got a counter at all
+                attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+                // user space only, which is all an unprivileged process is allowed to count with perf_event_paranoid 2
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                auto fd = (int) syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+                if (fd < 0) {
+                    if (error == 0)
+                        error = errno;
+                    continue;
+                }
+                if (leader < 0)
+                    leader = fd;
+                fds[i] = fd;
+                slot[i] = (int) opened++;
+            }
+            std::call_once(probed, [this, error]() {
+                for (size_t i = 0; i < COUNTER_COUNT; i++)
+                    counterSupported[i] = fds[i] >= 0;
+                anySupported = opened > 0;
+                if (anySupported)
+                    return;
+                reason = std::string("perf_event_open failed: ") + std::strerror(error);
+                if (error == EACCES || error == EPERM)
+                    reason += " (see /proc/sys/kernel/perf_event_paranoid)";
+                else if (error == ENOENT || error == ENODEV || error == EOPNOTSUPP)
+                    reason += " (no hardware counters exposed, common in virtual machines)";
+            });
+        }
+
+        /**
+         * Reads every open counter into values, indexed by Counter, along with the group's enabled and running times
+         */
+        bool read(uint64_t* values, uint64_t& enabled, uint64_t& running) const {
+            if (leader < 0)
+                return false;
+            struct {
+                uint64_t count;
+                uint64_t enabled;
+                uint64_t running;
+                uint64_t values[COUNTER_COUNT];
+            } group{};
+            if (::read(leader, &group, sizeof(group)) < (ssize_t) (3 * sizeof(uint64_t)))
+                return false;
+            for (size_t i = 0; i < COUNTER_COUNT; i++)
+                values[i] = slot[i] >= 0 && (uint64_t) slot[i] < group.count ? group.values[slot[i]] : 0;
+            enabled = group.enabled;
+            running = group.running;
+            return true;
+        }
+
+        ~ThreadCounters() {
+            for (auto fd : fds) {
+                if (fd >= 0)
+                    close(fd);
+            }
+        }
+    };
+#else
+    struct ThreadCounters {
+        bool tried = false;
+        bool measuring = false;
+
+        void open() {
+            tried = true;
+            std::call_once(probed, []() {
+                reason = "hardware counters are only read on Linux";
+            });
+        }
+
+        bool read(uint64_t*, uint64_t&, uint64_t&) const {
+            return false;
+        }
+    };
+#endif
+
+    static ThreadCounters& threadCounters() {
+        thread_local ThreadCounters counters;
+        if (!counters.tried)
+            counters.open();
+        return counters;
+    }
+
+    void Scope::start() {
+        auto& counters = threadCounters();
+        if (counters.measuring)
+            return;
+        counters.measuring = true;
+        active = true;
+        counters.read(values, enabledTime, runningTime);
+        // the clock is read after the counters so the read isn't part of the phase's time
+        begin = nanoseconds();
+    }
+
+    void Scope::finish() {
+        auto end = nanoseconds();
+        auto& counters = threadCounters();
+        uint64_t now[COUNTER_COUNT]{};
+        uint64_t enabled = 0, running = 0;
+        auto counted = counters.read(now, enabled, running);
+        counters.measuring = false;
+
+        auto index = (size_t) phase;
+        phaseCalls[index].fetch_add(1, std::memory_order_relaxed);
+        phaseNanoseconds[index].fetch_add(end - begin, std::memory_order_relaxed);
+        auto enabledDelta = enabled - enabledTime;
+        auto runningDelta = running - runningTime;
+        // a group which never got on the cpu reads as zeros, which aren't counts
+        if (!counted || runningDelta == 0)
+            return;
+        phaseCountedCalls[index].fetch_add(1, std::memory_order_relaxed);
+        phaseEnabled[index].fetch_add(enabledDelta, std::memory_order_relaxed);
+        phaseRunning[index].fetch_add(runningDelta, std::memory_order_relaxed);
+        // when multiplexed, scale up from the share of the scope the group was counting
+        auto scale = (double) enabledDelta / (double) runningDelta;
+        for (size_t i = 0; i < COUNTER_COUNT; i++)
+            phaseCounters[index][i].fetch_add((uint64_t) ((double) (now[i] - values[i]) * scale + 0.5), std::memory_order_relaxed);
+    }
+
+    void setEnabled(bool enabled) {
+        detail::enabled.store(enabled, std::memory_order_relaxed);
+    }
+
+    bool available() {
+        threadCounters();
+        return anySupported;
+    }
+
+    std::string unavailableReason() {
+        threadCounters();
+        return reason;
+    }
+
+    bool supported(Counter counter) {
+        threadCounters();
+        return counterSupported[(size_t) counter];
+    }
+
+    PhaseTotals totals(Phase phase) {
+        auto index = (size_t) phase;
+        PhaseTotals totals;
+        totals.calls = phaseCalls[index].load(std::memory_order_relaxed);
+        totals.nanoseconds = phaseNanoseconds[index].load(std::memory_order_relaxed);
+        totals.countedCalls = phaseCountedCalls[index].load(std::memory_order_relaxed);
+        totals.enabledNanoseconds = phaseEnabled[index].load(std::memory_order_relaxed);
+        totals.runningNanoseconds = phaseRunning[index].load(std::memory_order_relaxed);
+        for (size_t i = 0; i < COUNTER_COUNT; i++)
+            totals.counters[i] = phaseCounters[index][i].load(std::memory_order_relaxed);
+        return totals;
+    }
+
+    void reset() {
+        for (size_t p = 0; p < PHASE_COUNT; p++) {
+            phaseCalls[p] = 0;
+            phaseNanoseconds[p] = 0;
+            phaseCountedCalls[p] = 0;
+            phaseEnabled[p] = 0;
+            phaseRunning[p] = 0;
+            for (auto& counter : phaseCounters[p])
+                counter = 0;
+        }
+    }
+
+    const char* phaseName(Phase phase) {
+        switch (phase) {
+            case Phase::RENDER:
+                return "render";
+            case Phase::FITNESS:
+                return "fitness";
+            case Phase::UPLOAD:
+                return "upload";
+        }
+        return "?";
+    }
+
+    const char* counterName(Counter counter) {
+        switch (counter) {
+            case Counter::CYCLES:
+                return "cycles";
+            case Counter::INSTRUCTIONS:
+                return "instructions";
+            case Counter::L1D_MISSES:
+                return "L1d misses";
+            case Counter::LLC_MISSES:
+                return "LLC misses";
+            case Counter::BRANCH_MISSES:
+                return "branch misses";
+        }
+        return "?";
+    }
+
+    std::string summary() {
+        std::string out;
+        char line[512];
+        auto hardware = available();
+        for (size_t p = 0; p < PHASE_COUNT; p++) {
+            auto phase = (Phase) p;
+            auto t = totals(phase);
+            if (t.calls == 0)
+                continue;
+            auto length = std::snprintf(line, sizeof(line), "%-8s %8lu calls %10.3f ms", phaseName(phase), (unsigned long) t.calls,
+                                        (double) t.nanoseconds / 1e6);
+            if (hardware && !t.scheduled()) {
+                std::snprintf(line + length, sizeof(line) - length, ", counters not scheduled, another user may hold them");
+            } else if (hardware) {
+                length += std::snprintf(line + length, sizeof(line) - length,
+                                        ", %lu cycles, %.2f ipc, per 1k instructions: %.2f L1d / %.2f LLC / %.2f branch misses",
+                                        (unsigned long) t.get(Counter::CYCLES), t.instructionsPerCycle(), t.perKiloInstruction(Counter::L1D_MISSES),
+                                        t.perKiloInstruction(Counter::LLC_MISSES), t.perKiloInstruction(Counter::BRANCH_MISSES));
+                // only part of the phase was counted, the rest is estimated
+                if (t.countedCalls < t.calls || t.runningFraction() < 0.999) {
+                    std::snprintf(line + length, sizeof(line) - length, " (scaled, counted %.0f%% of the time in %lu of %lu calls)",
+                                  t.runningFraction() * 100, (unsigned long) t.countedCalls, (unsigned long) t.calls);
+                }
+            }
+            if (!out.empty())
+                out += '\n';
+            out += line;
+        }
+        return out;
+    }
+
+}
@@ -8,7 +8,10 @@
 #include <thread>
 #include <mutex>
 #include <barrier>
-#include <genetic/v3/program_v3.h>
+#include <genetic/v3/editor_v3.h>
+#include <parks/trace.h>
+#include <parks/perf_counters.h>
+#include <parks/memory.h>
 
 namespace parks {
     
@@ -38,8 +41,112 @@ namespace parks {
         p = new genetic::Program();
     }
     
+    // per phase totals of the hardware counters, or just calls and time when they can't be opened
+    static void drawPerfCounters() {
+        static bool measuring = perf::enabled();
+        if (ImGui::Checkbox("Measure", &measuring))
+            perf::setEnabled(measuring);
+        ImGui::SameLine();
+        if (ImGui::Button("Reset"))
+            perf::reset();
+        auto hardware = perf::available();
+        if (!hardware)
+            ImGui::Text("Wall clock only, %s", perf::unavailableReason().c_str());
+        
+        auto columns = hardware ? 3 + (int) perf::COUNTER_COUNT + 2 : 3;
+        if (!ImGui::BeginTable("PerfCounters", columns, ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders | ImGuiTableFlags_SizingFixedFit))
+            return;
+        ImGui::TableSetupColumn("Phase");
+        ImGui::TableSetupColumn("Calls");
+        ImGui::TableSetupColumn("Thread ms");
+        if (hardware) {
+            for (size_t i = 0; i < perf::COUNTER_COUNT; i++)
+                ImGui::TableSetupColumn(perf::counterName((perf::Counter) i));
+            ImGui::TableSetupColumn("IPC");
+            ImGui::TableSetupColumn("Counted");
+        }
+        ImGui::TableHeadersRow();
+        for (size_t i = 0; i < perf::PHASE_COUNT; i++) {
+            auto phase = (perf::Phase) i;
+            auto totals = perf::totals(phase);
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::TextUnformatted(perf::phaseName(phase));
+            ImGui::TableNextColumn();
+            ImGui::Text("%lu", (unsigned long) totals.calls);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.3f", (double) totals.nanoseconds / 1e6);
+            if (!hardware)
+                continue;
+            // a group which never got on the cpu has nothing to show, zeros would read as real counts
+            if (totals.calls > 0 && !totals.scheduled()) {
+                for (size_t c = 0; c < perf::COUNTER_COUNT + 1; c++) {
+                    ImGui::TableNextColumn();
+                    ImGui::TextUnformatted("-");
+                }
+                ImGui::TableNextColumn();
+                ImGui::TextUnformatted("not scheduled");
+                continue;
+            }
+            // misses are shown next to their rate, a count alone says little without the amount of work done
+            for (size_t c = 0; c < perf::COUNTER_COUNT; c++) {
+                auto counter = (perf::Counter) c;
+                ImGui::TableNextColumn();
+                if (!perf::supported(counter))
+                    ImGui::TextUnformatted("n/a");
+                else if (counter == perf::Counter::CYCLES || counter == perf::Counter::INSTRUCTIONS)
+                    ImGui::Text("%lu", (unsigned long) totals.get(counter));
+                else
+                    ImGui::Text("%lu (%.2f / 1k)", (unsigned long) totals.get(counter), totals.perKiloInstruction(counter));
+            }
+            ImGui::TableNextColumn();
+            ImGui::Text("%.2f", totals.instructionsPerCycle());
+            // below 100% the kernel multiplexed the counters and the counts are scaled estimates
+            ImGui::TableNextColumn();
+            ImGui::Text("%.0f%%", totals.runningFraction() * 100);
+        }
+        ImGui::EndTable();
+    }
+    
+    // live and peak bytes of every tagged allocation site, grouped by subsystem
+    static void drawMemory() {
+        if (ImGui::Button("Reset peaks"))
+            memory::resetPeaks();
+        if (!ImGui::BeginTable("Memory", 7, ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders | ImGuiTableFlags_SizingFixedFit))
+            return;
+        ImGui::TableSetupColumn("Subsystem");
+        ImGui::TableSetupColumn("Tag");
+        ImGui::TableSetupColumn("Allocations");
+        ImGui::TableSetupColumn("Live");
+        ImGui::TableSetupColumn("Live kb");
+        ImGui::TableSetupColumn("Peak kb");
+        ImGui::TableSetupColumn("Total kb");
+        ImGui::TableHeadersRow();
+        for (size_t i = 0; i < memory::TAG_COUNT; i++) {
+            auto tag = (memory::Tag) i;
+            auto stats = memory::stats(tag);
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::TextUnformatted(memory::subsystemName(tag));
+            ImGui::TableNextColumn();
+            ImGui::TextUnformatted(memory::tagName(tag));
+            ImGui::TableNextColumn();
+            ImGui::Text("%lu", (unsigned long) stats.allocations);
+            ImGui::TableNextColumn();
+            ImGui::Text("%lu", (unsigned long) stats.live());
+            ImGui::TableNextColumn();
+            ImGui::Text("%.1f", (double) stats.liveBytes / 1024);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.1f", (double) stats.peakBytes / 1024);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.1f", (double) stats.bytes / 1024);
+        }
+        ImGui::EndTable();
+    }
+    
     void Engine::run() {
         while (!Window::isCloseRequested()) {
+            trace::Scope frameScope("frame", "engine");
             Window::preUpdate();
             glClearColor(0, 0.5, 0.0, 1.0);
             glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -74,10 +181,41 @@ namespace parks {
             ImGui::SetNextWindowSize({0, 512}, ImGuiCond_Once);
             ImGui::Begin("Genetic Controls");
                 ImGui::Checkbox("Show Image Output?", &showImage);
-                p->run();
+                {
+                    trace::Scope scope("genetic controls", "engine");
+                    p->run();
+                }
+                if (ImGui::CollapsingHeader("Trace")) {
+                    static char tracePath[256] = "parksnrec_trace.json";
+                    static std::string traceStatus;
+                    ImGui::InputText("##TracePath", tracePath, sizeof(tracePath));
+                    ImGui::SameLine();
+                    if (!trace::recording()) {
+                        if (ImGui::Button("Start recording")) {
+                            trace::start();
+                            traceStatus = "Recording";
+                        }
+                    } else if (ImGui::Button("Stop and write")) {
+                        trace::stop();
+                        traceStatus = trace::write(tracePath) ? std::string("Wrote ") + tracePath : std::string("Couldn't write ") + tracePath;
+                        if (auto dropped = trace::dropped())
+                            traceStatus += " (" + std::to_string(dropped) + " events dropped)";
+                    }
+                    if (!traceStatus.empty())
+                        ImGui::Text("%s", traceStatus.c_str());
+                }
+                if (ImGui::CollapsingHeader("Performance Counters"))
+                    drawPerfCounters();
+                if (ImGui::CollapsingHeader("Memory"))
+                    drawMemory();
             ImGui::End();
             p->draw();
-            geneticImageTexture.upload(p->getPixels(), GL_UNSIGNED_BYTE, WIDTH, HEIGHT, CHANNELS);
+            // the render pool writes into the pixels while a render is in flight
+            if (!genetic::Program::isRendering()) {
+                trace::Scope scope("upload genetic image", "gl");
+                perf::Scope counters(perf::Phase::UPLOAD);
+                geneticImageTexture.upload(p->getPixels(), GL_UNSIGNED_BYTE, WIDTH, HEIGHT, CHANNELS);
+            }
             
             if (showImage) {
                 geneticImageTexture.bind();
@@ -98,12 +236,22 @@ namespace parks {
                 glEnable(GL_DEPTH_TEST);
             }
             
-            Window::postUpdate();
+            {
+                // draws the ui and swaps, waiting on the gpu and vsync
+                trace::Scope scope("draw ui and swap", "engine");
+                Window::postUpdate();
+            }
         }
     }
     
     Engine::~Engine() {
         delete p;
+        // the program owns every tree, anything still live once it is gone has leaked
+        for (auto tag : {memory::Tag::GENETIC_NODES, memory::Tag::GENETIC_NODE_ARRAYS}) {
+            auto stats = memory::stats(tag);
+            if (stats.live() != 0)
+                BLT_WARN("Leaked %lu %s (%.1f kb)", (unsigned long) stats.live(), memory::tagName(tag), (double) stats.liveBytes / 1024);
+        }
         BLT_PRINT_PROFILE("Genetic", blt::logging::log_level::NONE, true);
     }
 }
\ No newline at end of file
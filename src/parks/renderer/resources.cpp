@@ -9,6 +9,9 @@
 #include <parks/config.h>
 #include <parks/error_logging.h>
 #include "parks/status.h"
+#include <parks/trace.h>
+#include <parks/perf_counters.h>
+#include <parks/memory.h>
 
 namespace parks {
     
@@ -20,6 +23,11 @@ namespace parks {
         void* data = nullptr;
         int width = 0, height = 0, channels = 0;
         std::string textureName;
+        
+        // stbi_load is always asked for 4 channels
+        [[nodiscard]] inline size_t decodedBytes() const {
+            return (size_t) width * height * 4;
+        }
     };
     
     struct {
@@ -51,12 +59,14 @@ namespace parks {
     }
     
     void resources::beginLoading() {
+        trace::Scope scope("beginLoading", "resources");
         BLT_DEBUG("Beginning loading of resources");
         stbi_set_flip_vertically_on_load(true);
         for (int i = 0; i < TextureLoader.numThreads; i++) {
             TextureLoader.threads[i] = new std::thread(
                     [i]() -> void {
                         try {
+                            trace::setThreadName("texture loader " + std::to_string(i));
                             stbi_set_flip_vertically_on_load_thread(true);
                             while (!TextureLoader.texturesToLoad.empty()) {
                                 LoadableTexture texture;
@@ -75,10 +85,15 @@ namespace parks {
                                     continue;
                                 BLT_TRACE("Processing Texture %s", texture.path.c_str());
                                 LoadedTexture loadedTexture;
-                                loadedTexture.data = stbi_load(
-                                        texture.path.c_str(), &loadedTexture.width,
-                                        &loadedTexture.height, &loadedTexture.channels, 4
-                                );
+                                {
+                                    trace::Scope decodeScope("decode texture", "resources");
+                                    loadedTexture.data = stbi_load(
+                                            texture.path.c_str(), &loadedTexture.width,
+                                            &loadedTexture.height, &loadedTexture.channels, 4
+                                    );
+                                    if (loadedTexture.data != nullptr)
+                                        memory::allocated(memory::Tag::TEXTURE_DECODE, loadedTexture.decodedBytes());
+                                }
                                 loadedTexture.channels = 4;
                                 loadedTexture.textureName = texture.name;
                                 try {
@@ -118,6 +133,8 @@ namespace parks {
                     texture = TextureLoader.loadedTextures.front();
                     TextureLoader.loadedTextures.pop();
                 }
+                trace::Scope uploadScope("upload texture", "gl");
+                perf::Scope counters(perf::Phase::UPLOAD);
                 auto* texture2D = new GLTexture2D;
                 texture2D->upload(
                         texture.data, GL_UNSIGNED_BYTE, texture.width, texture.height,
@@ -125,6 +142,8 @@ namespace parks {
                 );
                 glGenerateMipmap(GL_TEXTURE_2D);
                 TextureLoader.gl2DTextures[texture.textureName] = texture2D;
+                if (texture.data != nullptr)
+                    memory::freed(memory::Tag::TEXTURE_DECODE, texture.decodedBytes());
                 stbi_image_free(texture.data);
                 BLT_TRACE("Loaded texture '%s' to graphics card!", texture.textureName.c_str());
             }
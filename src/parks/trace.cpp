@@ -0,0 +1,167 @@
+//
+// Created by brett on 7/28/23.
+//
+#include <parks/trace.h>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace parks::trace {
+
+    struct Event {
+        const char* name;
+        const char* category;
+        uint64_t begin;
+        uint64_t end;
+        int64_t arg;
+    };
+
+    /**
+     * Events of one thread. Only the owning thread writes events, publishing them by storing count with release
+     * ordering, so a reader which loads count can copy everything before it without a lock.
+     */
+    struct ThreadBuffer {
+        // allocated by the first event, threads which only name themselves don't pay for it
+        std::unique_ptr<Event[]> events;
+        std::atomic<size_t> count{0};
+        std::atomic<size_t> dropped{0};
+        // recording the events belong to, the owner starts again from 0 when it sees start() was called
+        std::atomic<uint64_t> generation{0};
+        size_t id = 0;
+        std::string name;
+    };
+
+    // buffers outlive their threads so a thread which has exited still shows up in the trace
+    static std::mutex buffersMutex;
+    static std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+    static std::atomic<uint64_t> generation{0};
+    static std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+    std::atomic<bool> detail::recording{false};
+
+    static ThreadBuffer& threadBuffer() {
+        thread_local ThreadBuffer* buffer = nullptr;
+        if (buffer == nullptr) {
+            // the only lock a thread ever takes while recording, once when it records its first event
+            std::scoped_lock<std::mutex> lock(buffersMutex);
+            buffers.push_back(std::make_unique<ThreadBuffer>());
+            buffer = buffers.back().get();
+            buffer->id = buffers.size();
+            buffer->generation.store(generation.load(std::memory_order_acquire), std::memory_order_relaxed);
+        }
+        return *buffer;
+    }
+
+    uint64_t detail::now() {
+        // never 0, Scope uses that for an event which started while nothing was recording
+        return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count() + 1;
+    }
+
+    void detail::record(const char* name, const char* category, uint64_t begin, uint64_t end, int64_t arg) {
+        auto& buffer = threadBuffer();
+        auto current = generation.load(std::memory_order_acquire);
+        if (buffer.generation.load(std::memory_order_relaxed) != current) {
+            // count is cleared first so a reader which sees the new generation never sees the old count
+            buffer.count.store(0, std::memory_order_release);
+            buffer.dropped.store(0, std::memory_order_relaxed);
+            buffer.generation.store(current, std::memory_order_release);
+        }
+        if (buffer.events == nullptr)
+            buffer.events = std::make_unique<Event[]>(EVENTS_PER_THREAD);
+        auto index = buffer.count.load(std::memory_order_relaxed);
+        if (index >= EVENTS_PER_THREAD) {
+            buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        buffer.events[index] = {name, category, begin, end, arg};
+        buffer.count.store(index + 1, std::memory_order_release);
+    }
+
+    void start() {
+        generation.fetch_add(1, std::memory_order_acq_rel);
+        detail::recording.store(true, std::memory_order_release);
+    }
+
+    void stop() {
+        detail::recording.store(false, std::memory_order_release);
+    }
+
+    void setThreadName(const std::string& name) {
+        auto& buffer = threadBuffer();
+        std::scoped_lock<std::mutex> lock(buffersMutex);
+        buffer.name = name;
+    }
+
+    size_t dropped() {
+        std::scoped_lock<std::mutex> lock(buffersMutex);
+        auto current = generation.load(std::memory_order_acquire);
+        size_t total = 0;
+        for (const auto& buffer : buffers) {
+            if (buffer->generation.load(std::memory_order_acquire) == current)
+                total += buffer->dropped.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    // names and categories are literals from our own code, but keep the json valid whatever they hold
+    static void writeString(std::ofstream& out, const char* str) {
+        out << '"';
+        for (; *str != '\0'; str++) {
+            if (*str == '"' || *str == '\\')
+                out << '\\';
+            out << *str;
+        }
+        out << '"';
+    }
+
+    bool write(const std::string& path) {
+        std::ofstream out(path);
+        if (!out)
+            return false;
+        // timestamps are in microseconds, keep the nanoseconds rather than six significant digits
+        out << std::fixed << std::setprecision(3);
+        out << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n";
+        bool first = true;
+        auto separator = [&]() {
+            if (!first)
+                out << ",\n";
+            first = false;
+        };
+
+        std::scoped_lock<std::mutex> lock(buffersMutex);
+        auto current = generation.load(std::memory_order_acquire);
+        for (const auto& buffer : buffers) {
+            if (!buffer->name.empty()) {
+                separator();
+                out << R"({"name": "thread_name", "ph": "M", "pid": 1, "tid": )" << buffer->id << R"(, "args": {"name": )";
+                writeString(out, buffer->name.c_str());
+                out << "}}";
+            }
+            // a thread which hasn't recorded since start() still holds the previous recording
+            if (buffer->generation.load(std::memory_order_acquire) != current)
+                continue;
+            auto count = buffer->count.load(std::memory_order_acquire);
+            for (size_t i = 0; i < count; i++) {
+                const auto& event = buffer->events[i];
+                separator();
+                out << "{\"name\": ";
+                writeString(out, event.name);
+                out << ", \"cat\": ";
+                writeString(out, event.category);
+                // complete events, the begin and end of the scope in one
+                out << R"(, "ph": "X", "pid": 1, "tid": )" << buffer->id << ", \"ts\": " << (double) event.begin / 1000.0 << ", \"dur\": "
+                    << (double) (event.end - event.begin) / 1000.0;
+                if (event.arg >= 0)
+                    out << ", \"args\": {\"value\": " << event.arg << "}";
+                out << "}";
+            }
+        }
+        out << "\n]}\n";
+        return (bool) out;
+    }
+
+}
@@ -2,4 +2,13 @@
 // Created by brett on 7/11/23.
 //
 #define STB_PERLIN_IMPLEMENTATION
-#include <stb/stb_perlin.h>
\ No newline at end of file
+#include <stb/stb_perlin.h>
+
+// the batched noise in genetic/v3 must hash exactly like stb does, so it shares stb's permutation tables
+const unsigned char* stb_perlin_randtab() {
+    return stb__perlin_randtab;
+}
+
+const unsigned char* stb_perlin_randtab_grad_idx() {
+    return stb__perlin_randtab_grad_idx;
+}
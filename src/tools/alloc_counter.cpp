@@ -0,0 +1,52 @@
+//
+// Created by brett on 7/28/23.
+//
+#include <tools/alloc_counter.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// replaces the global allocation functions, so only link this into the headless tools
+
+static std::atomic<size_t> allocations = 0;
+
+namespace parks {
+    
+    size_t heapAllocations() {
+        return allocations.load(std::memory_order_relaxed);
+    }
+    
+}
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (auto* p = std::malloc(size == 0 ? 1 : size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+// std::pmr's default resource allocates through the aligned forms
+void* operator new(size_t size, std::align_val_t alignment) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    auto align = std::max(sizeof(void*), (size_t) alignment);
+    if (auto* p = std::aligned_alloc(align, (std::max<size_t>(size, 1) + align - 1) / align * align))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t, std::align_val_t) noexcept {
+    std::free(p);
+}
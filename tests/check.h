@@ -0,0 +1,42 @@
+//
+// Created by brett on 7/28/23.
+//
+
+#ifndef PARKSNREC_CHECK_H
+#define PARKSNREC_CHECK_H
+
+#include <blt/std/logging.h>
+#include <string>
+
+// the tests are plain executables run by ctest, they log every failed check and exit non zero if there were any
+namespace parks::test {
+    
+    inline int failures = 0;
+    
+    /**
+     * Logs what went wrong if passed is false
+     * @return passed
+     */
+    inline bool check(bool passed, const std::string& what) {
+        if (!passed) {
+            BLT_ERROR("Check failed: %s", what.c_str());
+            failures++;
+        }
+        return passed;
+    }
+    
+    /**
+     * @return the exit code of the test
+     */
+    inline int result() {
+        if (failures > 0) {
+            BLT_ERROR("%d checks failed", failures);
+            return 1;
+        }
+        BLT_INFO("All checks passed");
+        return 0;
+    }
+    
+}
+
+#endif //PARKSNREC_CHECK_H
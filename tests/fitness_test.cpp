@@ -0,0 +1,55 @@
+//
+// Created by brett on 7/28/23.
+//
+#include "check.h"
+#include <genetic/v3/program_v3.h>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace parks;
+using namespace parks::genetic;
+using parks::test::check;
+
+// the fast fitness must give exactly the scores of the original per pixel loop, evolution depends on them
+
+static bool same(double a, double b) {
+    return std::memcmp(&a, &b, sizeof(double)) == 0;
+}
+
+// every digit, so values differing in the last bits don't print the same
+static std::string exact(double value) {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.17g", value);
+    return buffer;
+}
+
+static void checkImage(const std::vector<unsigned char>& pixels, const std::string& name) {
+    auto reference = GeneticTree::evaluateReference(pixels.data());
+    auto fast = GeneticTree::evaluate(pixels.data());
+    check(same(fast, reference), "evaluate() matches evaluateReference() bit for bit on " + name + ": " + exact(fast) + " vs " + exact(reference));
+}
+
+int main() {
+    std::vector<unsigned char> pixels(WIDTH * HEIGHT * CHANNELS);
+
+    checkImage(pixels, "a black image");
+    for (unsigned int y = 0; y < HEIGHT; y++) {
+        for (unsigned int x = 0; x < WIDTH; x++)
+            std::memset(&pixels[(y * WIDTH + x) * CHANNELS], (x / 3 + y / 5) % 2 ? 255 : 0, CHANNELS);
+    }
+    checkImage(pixels, "a checkerboard");
+
+    setRandomSeed(10);
+    for (int i = 0; i < 20; i++) {
+        GeneticTree tree(6);
+        FitnessScores scores{MetricID::SIMILARITY};
+        tree.processImage(pixels.data(), RenderBackend::INTERPRETER, Precision::DOUBLE, &scores);
+        auto name = "random tree " + std::to_string(i);
+        checkImage(pixels, name);
+        check(same(scores.values[0], GeneticTree::evaluateReference(pixels.data())), "the fused render score matches evaluateReference() on " + name);
+    }
+
+    return parks::test::result();
+}
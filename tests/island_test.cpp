@@ -0,0 +1,168 @@
+//
+// Created by brett on 7/28/23.
+//
+#include "check.h"
+#include <genetic/v3/island_v3.h>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace parks;
+using namespace parks::genetic;
+using parks::test::check;
+
+// two islands on 127.0.0.1 in one process, standing in for islands on separate machines
+
+constexpr uint32_t MIGRATION_MAGIC = 0x49524E50;
+
+template<typename T>
+static void write(std::vector<unsigned char>& out, T value) {
+    auto pos = out.size();
+    out.resize(pos + sizeof(T));
+    std::memcpy(&out[pos], &value, sizeof(T));
+}
+
+// a message of count migrants with the given tree encodings, whatever they hold
+static std::vector<unsigned char> message(uint32_t count, const std::vector<unsigned char>& trees) {
+    std::vector<unsigned char> data;
+    write<uint32_t>(data, MIGRATION_MAGIC);
+    write<uint32_t>(data, 0);
+    write<uint32_t>(data, count);
+    data.insert(data.end(), trees.begin(), trees.end());
+    return data;
+}
+
+// fitness followed by a tree header and a single node, laid out like GeneticTree::serialize()
+static std::vector<unsigned char> migrant(int32_t size, int32_t height, uint32_t count, uint32_t index, uint32_t pos) {
+    std::vector<unsigned char> data;
+    write<double>(data, 1.0);
+    write<int32_t>(data, size);
+    write<int32_t>(data, height);
+    write<uint32_t>(data, count);
+    if (count > 0) {
+        write<uint32_t>(data, index);
+        write<uint8_t>(data, (uint8_t) FunctionID::ADD);
+        write<uint32_t>(data, pos);
+        write<uint8_t>(data, 0);
+    }
+    return data;
+}
+
+static bool sendRaw(uint16_t port, const std::vector<unsigned char>& data) {
+    int connection = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+    if (connection < 0 || connect(connection, (sockaddr*) &address, sizeof(address)) != 0) {
+        if (connection >= 0)
+            close(connection);
+        return false;
+    }
+    size_t written = 0;
+    while (written < data.size()) {
+        auto count = ::send(connection, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+        if (count <= 0)
+            break;
+        written += count;
+    }
+    close(connection);
+    return written == data.size();
+}
+
+// migrants arrive on the listener thread
+static bool waitForReceived(const Island& island, size_t count) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (island.getReceived() < count && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    return island.getReceived() >= count;
+}
+
+static void testRoundTrip() {
+    std::vector<unsigned char> pixels(64 * 64 * CHANNELS), copiedPixels(pixels.size());
+    for (int i = 0; i < 20; i++) {
+        GeneticTree tree(6);
+        std::vector<unsigned char> data;
+        tree.serialize(data);
+        size_t offset = 0;
+        std::unique_ptr<GeneticTree> copy(GeneticTree::deserialize(data, offset));
+        if (!check(copy != nullptr && offset == data.size(), "a serialized tree deserializes completely"))
+            continue;
+        std::vector<unsigned char> again;
+        copy->serialize(again);
+        check(again == data, "a deserialized tree serializes to the same bytes");
+        tree.processImage(pixels.data(), 64, 64);
+        copy->processImage(copiedPixels.data(), 64, 64);
+        check(pixels == copiedPixels, "a deserialized tree renders the same image");
+    }
+}
+
+static void testMigration(uint16_t basePort) {
+    IslandConfig configs[2];
+    for (size_t id = 0; id < 2; id++) {
+        configs[id].id = id;
+        configs[id].addresses = {"127.0.0.1:" + std::to_string(basePort), "127.0.0.1:" + std::to_string(basePort + 1)};
+        configs[id].migrationInterval = 1;
+        configs[id].migrants = 2;
+    }
+    Island sender(configs[0]), receiver(configs[1]);
+    if (!check(sender.start() && receiver.start(), "both islands listen on localhost"))
+        return;
+
+    EvolutionConfig evolution;
+    evolution.populationSize = 4;
+    evolution.treeHeight = 4;
+    Population from(evolution), to(evolution);
+    from.initialize();
+    to.initialize();
+
+    sender.emigrate(from);
+    check(sender.getSent() == 2, "the sender sends its two fittest members");
+    check(waitForReceived(receiver, 2) && receiver.getReceived() == 2, "the receiver gets both migrants");
+    auto best = from.fittest(2);
+    check(receiver.immigrate(to) == 2, "both migrants join the receiving population");
+    for (auto& [tree, fitness] : best) {
+        bool found = false;
+        for (size_t i = 0; i < to.getMembers().size(); i++) {
+            std::vector<unsigned char> expected, actual;
+            tree->serialize(expected);
+            to.getMembers()[i]->serialize(actual);
+            found |= expected == actual && to.getFitness()[i] == fitness;
+        }
+        check(found, "a migrant arrives unchanged along with its fitness");
+        delete tree;
+    }
+
+    // none of these may crash the island or add a migrant
+    std::vector<std::pair<const char*, std::vector<unsigned char>>> malformed = {
+            {"a message with the wrong magic", {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12}},
+            {"a truncated header", {0x50, 0x4E, 0x52, 0x49, 0, 0}},
+            {"a tree without nodes", message(1, migrant(7, 2, 0, 0, 0))},
+            {"a tree with a huge node array", message(1, migrant(1 << 24, 24, 1, 0, 0))},
+            {"a node stored at the wrong position", message(1, migrant(7, 2, 1, 0, 3))},
+            {"a node without a parent", message(1, migrant(7, 2, 1, 2, 2))},
+            {"a truncated tree", message(1, std::vector<unsigned char>(10, 0))},
+    };
+    for (const auto& [name, data] : malformed)
+        check(sendRaw(basePort + 1, data), std::string("the receiver accepts ") + name);
+
+    // the listener handles one connection at a time, so once these arrive every malformed message has been read
+    sender.emigrate(from);
+    check(waitForReceived(receiver, 4) && receiver.getReceived() == 4, "malformed messages add no migrants and don't stop the listener");
+    check(receiver.immigrate(to) == 2, "only the well formed migrants join the population");
+}
+
+int main() {
+    setRandomSeed(1);
+    testRoundTrip();
+    // keep parallel runs of the test from fighting over ports
+    testMigration((uint16_t) (20000 + (getpid() % 20000) * 2));
+    return parks::test::result();
+}
@@ -0,0 +1,170 @@
+//
+// Created by brett on 7/28/23.
+//
+#include "check.h"
+#include <genetic/v3/linear_v3.h>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace parks;
+using namespace parks::genetic;
+using parks::test::check;
+
+// LinearTree must lower to the same programs as the GeneticTree it came from and keep its spans consistent through
+// every operation which rewrites them
+
+static bool sameColor(const Color& a, const Color& b) {
+    return std::memcmp(&a.r, &b.r, sizeof(double)) == 0 && std::memcmp(&a.g, &b.g, sizeof(double)) == 0 &&
+           std::memcmp(&a.b, &b.b, sizeof(double)) == 0 && a.bw == b.bw;
+}
+
+static bool sameOperand(const Operand& a, const Operand& b) {
+    return a.type == b.type && a.index == b.index;
+}
+
+static bool sameParameters(const ParameterSet& a, const ParameterSet& b) {
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (!sameColor(a[(int) i], b[(int) i]))
+            return false;
+    }
+    return true;
+}
+
+// instruction node indices are left out, they are positions in different layouts
+static bool samePrograms(const CompiledTree& a, const CompiledTree& b) {
+    const auto& ai = a.getInstructions();
+    const auto& bi = b.getInstructions();
+    if (ai.size() != bi.size() || a.getConstants().size() != b.getConstants().size() || a.getColumns().size() != b.getColumns().size() ||
+        a.getRows().size() != b.getRows().size() || a.getFoldedCount() != b.getFoldedCount() || !sameOperand(a.getResult(), b.getResult()))
+        return false;
+    for (size_t i = 0; i < ai.size(); i++) {
+        if (ai[i].op != bi[i].op || !sameOperand(ai[i].left, bi[i].left) || !sameOperand(ai[i].right, bi[i].right) ||
+            !sameParameters(a.getParameters(i), b.getParameters(i)))
+            return false;
+    }
+    for (size_t i = 0; i < a.getConstants().size(); i++) {
+        if (!sameColor(a.getConstants()[i], b.getConstants()[i]))
+            return false;
+    }
+    for (size_t i = 0; i < a.getColumns().size(); i++) {
+        if (!samePrograms(a.getColumns()[i], b.getColumns()[i]))
+            return false;
+    }
+    for (size_t i = 0; i < a.getRows().size(); i++) {
+        if (!samePrograms(a.getRows()[i], b.getRows()[i]))
+            return false;
+    }
+    return true;
+}
+
+// every node's size and parameterIndex recomputed from scratch: prefix order keeps the pool in node order, and the
+// children bits decide which spans follow a node
+static bool consistent(const LinearTree& tree) {
+    const auto& nodes = tree.getNodes();
+    uint32_t parameterIndex = 0;
+    for (uint32_t i = 0; i < nodes.size(); i++) {
+        auto& func = functions[nodes[i].op];
+        if (nodes[i].parameterIndex != parameterIndex || nodes[i].parameterCount != func.getRequiredScalars() + func.getRequiredColors())
+            return false;
+        parameterIndex += nodes[i].parameterCount;
+    }
+    if (parameterIndex != tree.getParameters().size())
+        return false;
+
+    // walking backwards meets children before their parents
+    std::vector<uint32_t> sizes(nodes.size());
+    for (auto i = (uint32_t) nodes.size(); i-- > 0;) {
+        sizes[i] = 1;
+        uint32_t child = i + 1;
+        for (auto bit : {LINEAR_LEFT, LINEAR_RIGHT}) {
+            if (!(nodes[i].children & bit))
+                continue;
+            if (child >= nodes.size())
+                return false;
+            sizes[i] += sizes[child];
+            child += sizes[child];
+        }
+        if (nodes[i].size != sizes[i])
+            return false;
+    }
+    return nodes.empty() || sizes[0] == nodes.size();
+}
+
+static void testConversions() {
+    std::vector<unsigned char> pixels(64 * 64 * CHANNELS), convertedPixels(pixels.size());
+    std::vector<unsigned char> fullPixels(WIDTH * HEIGHT * CHANNELS), linearPixels(fullPixels.size());
+    for (int i = 0; i < 40; i++) {
+        auto name = "tree " + std::to_string(i);
+        GeneticTree tree(i % 8 + 1);
+        auto linear = LinearTree::fromTree(tree);
+        check(consistent(linear), "fromTree() lays out " + name + " consistently");
+        check(samePrograms(linear.compile(), tree.compile()), "fromTree() of " + name + " compiles to the same instructions");
+
+        std::unique_ptr<GeneticTree> converted(linear.toTree());
+        if (!check(converted != nullptr, "toTree() converts " + name + " back"))
+            continue;
+        tree.processImage(pixels.data(), 64, 64);
+        converted->processImage(convertedPixels.data(), 64, 64);
+        check(pixels == convertedPixels, "toTree(fromTree()) of " + name + " renders the same image");
+
+        if (i % 10 == 0) {
+            tree.processImage(fullPixels.data());
+            linear.processImage(linearPixels.data());
+            check(fullPixels == linearPixels, "LinearTree::processImage() of " + name + " renders the same image");
+        }
+    }
+}
+
+static void testOperations() {
+    std::vector<LinearTree> trees;
+    for (int i = 0; i < 16; i++) {
+        if (i % 2 == 0) {
+            GeneticTree tree(6);
+            trees.push_back(LinearTree::fromTree(tree));
+        } else
+            trees.push_back(LinearTree::random(i + 2));
+    }
+    for (int round = 0; round < 200; round++) {
+        auto& tree = trees[round % trees.size()];
+        auto& other = trees[(round * 7 + 3) % trees.size()];
+        if (&tree != &other)
+            tree.crossover(other);
+        tree.mutate();
+        check(consistent(tree), "sizes and parameter indices stay consistent after round " + std::to_string(round));
+        check(consistent(other), "the crossover partner stays consistent after round " + std::to_string(round));
+
+        // every subtree stands on its own and replacing it with itself changes nothing
+        auto node = (uint32_t) randomInt(0, (int) tree.size());
+        auto part = tree.subtree(node);
+        check(consistent(part), "subtree() is consistent after round " + std::to_string(round));
+        auto before = tree.getNodes().size();
+        tree.replaceSubtree(node, part);
+        check(consistent(tree) && tree.getNodes().size() == before, "replacing a subtree with itself keeps the tree intact");
+    }
+}
+
+static void testDeepTrees() {
+    // far deeper than GeneticTree's layout allows, which toTree() must refuse rather than allocate
+    LinearTree deep;
+    for (int i = 0; i < 100 && deep.depth() <= MAX_HEIGHT + 1; i++)
+        deep = LinearTree::random(MAX_HEIGHT + 8);
+    if (!check(deep.depth() > MAX_HEIGHT + 1, "random() builds trees deeper than MAX_HEIGHT"))
+        return;
+    check(consistent(deep), "a deep random tree is consistent");
+    check(deep.toTree() == nullptr, "toTree() refuses trees taller than MAX_HEIGHT");
+    auto copy = deep;
+    copy.mutate();
+    check(consistent(copy), "a deep tree stays consistent through mutation");
+}
+
+int main() {
+    setRandomSeed(3);
+    testConversions();
+    testOperations();
+    testDeepTrees();
+    return parks::test::result();
+}